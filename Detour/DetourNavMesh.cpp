@@ -20,6 +20,7 @@
 #include <float.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "DetourNavMesh.h"
 #include "DetourNode.h"
 #include "DetourCommon.h"
@@ -216,6 +217,8 @@ dtNavMesh::~dtNavMesh()
 			m_tiles[i].data = 0;
 			m_tiles[i].dataSize = 0;
 		}
+		dtFree(m_tiles[i].detailBVRoots);
+		m_tiles[i].detailBVRoots = 0;
 	}
 	dtFree(m_posLookup);
 	dtFree(m_tiles);
@@ -804,6 +807,170 @@ int dtNavMesh::queryPolygonsInTile(const dtMeshTile* tile, const float* qmin, co
 	}
 }
 
+struct dtDetailBVItem
+{
+	unsigned short bmin[2];
+	unsigned short bmax[2];
+	int i;
+};
+
+static int compareDetailItemX(const void* va, const void* vb)
+{
+	const dtDetailBVItem* a = (const dtDetailBVItem*)va;
+	const dtDetailBVItem* b = (const dtDetailBVItem*)vb;
+	if (a->bmin[0] < b->bmin[0])
+		return -1;
+	if (a->bmin[0] > b->bmin[0])
+		return 1;
+	return a->i - b->i;
+}
+
+static int compareDetailItemZ(const void* va, const void* vb)
+{
+	const dtDetailBVItem* a = (const dtDetailBVItem*)va;
+	const dtDetailBVItem* b = (const dtDetailBVItem*)vb;
+	if (a->bmin[1] < b->bmin[1])
+		return -1;
+	if (a->bmin[1] > b->bmin[1])
+		return 1;
+	return a->i - b->i;
+}
+
+static void subdivideDetail(dtDetailBVItem* items, int imin, int imax, int& curNode, dtBVNode* nodes)
+{
+	const int inum = imax - imin;
+	const int icur = curNode;
+	
+	dtBVNode& node = nodes[curNode++];
+	
+	// The detail tree is only used for 2D queries, the y-range covers everything.
+	node.bmin[1] = 0;
+	node.bmax[1] = 0xffff;
+	
+	if (inum == 1)
+	{
+		// Leaf
+		node.bmin[0] = items[imin].bmin[0];
+		node.bmin[2] = items[imin].bmin[1];
+		node.bmax[0] = items[imin].bmax[0];
+		node.bmax[2] = items[imin].bmax[1];
+		node.i = items[imin].i;
+		return;
+	}
+	
+	// Split
+	node.bmin[0] = items[imin].bmin[0];
+	node.bmin[2] = items[imin].bmin[1];
+	node.bmax[0] = items[imin].bmax[0];
+	node.bmax[2] = items[imin].bmax[1];
+	for (int i = imin+1; i < imax; ++i)
+	{
+		const dtDetailBVItem& it = items[i];
+		node.bmin[0] = dtMin(node.bmin[0], it.bmin[0]);
+		node.bmin[2] = dtMin(node.bmin[2], it.bmin[1]);
+		node.bmax[0] = dtMax(node.bmax[0], it.bmax[0]);
+		node.bmax[2] = dtMax(node.bmax[2], it.bmax[1]);
+	}
+	
+	if (node.bmax[0] - node.bmin[0] >= node.bmax[2] - node.bmin[2])
+		qsort(items+imin, inum, sizeof(dtDetailBVItem), compareDetailItemX);
+	else
+		qsort(items+imin, inum, sizeof(dtDetailBVItem), compareDetailItemZ);
+	
+	const int isplit = imin+inum/2;
+	subdivideDetail(items, imin, isplit, curNode, nodes);
+	subdivideDetail(items, isplit, imax, curNode, nodes);
+	
+	// Negative index means escape.
+	node.i = -(curNode - icur);
+}
+
+inline unsigned short quantizeDetailCoord(const float v, const float bmin, const float factor, const bool roundUp)
+{
+	const float q = dtClamp((v - bmin) * factor, -2.0f, 65537.0f);
+	const int iq = roundUp ? (int)ceilf(q) + 1 : (int)floorf(q) - 1;
+	return (unsigned short)dtClamp(iq, 0, 0xffff);
+}
+
+/// Builds the detail bounding volume trees of the polygons which have at least
+/// #DT_DETAIL_BVTREE_MIN_TRIS detail triangles.
+static bool buildDetailBVTree(dtMeshTile* tile)
+{
+	const dtMeshHeader* header = tile->header;
+	
+	int nnodes = 0;
+	for (int i = 0; i < header->detailMeshCount; ++i)
+	{
+		const int ntris = (int)tile->detailMeshes[i].triCount;
+		if (ntris >= DT_DETAIL_BVTREE_MIN_TRIS)
+			nnodes += ntris*2-1;
+	}
+	if (!nnodes)
+		return true;
+	
+	const int rootsSize = dtAlign4(sizeof(int)*header->detailMeshCount);
+	const int nodesSize = sizeof(dtBVNode)*nnodes;
+	unsigned char* mem = (unsigned char*)dtAlloc(rootsSize + nodesSize, DT_ALLOC_PERM);
+	if (!mem)
+		return false;
+	tile->detailBVRoots = (int*)mem;
+	tile->detailBVTree = (dtBVNode*)(mem + rootsSize);
+	tile->detailBVNodeCount = nnodes;
+	
+	// The bounds are quantized like the tile BV-tree and padded by one unit,
+	// so that the tree never rejects a point the exact triangle test would accept.
+	const float qf = header->bvQuantFactor;
+	dtDetailBVItem items[255];
+	int curNode = 0;
+	
+	for (int i = 0; i < header->detailMeshCount; ++i)
+	{
+		const dtPoly* poly = &tile->polys[i];
+		const dtPolyDetail* pd = &tile->detailMeshes[i];
+		const int ntris = (int)pd->triCount;
+		if (ntris < DT_DETAIL_BVTREE_MIN_TRIS)
+		{
+			tile->detailBVRoots[i] = -1;
+			continue;
+		}
+		
+		for (int j = 0; j < ntris; ++j)
+		{
+			const unsigned char* t = &tile->detailTris[(pd->triBase+j)*4];
+			float bmin[3], bmax[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				const float* v;
+				if (t[k] < poly->vertCount)
+					v = &tile->verts[poly->verts[t[k]]*3];
+				else
+					v = &tile->detailVerts[(pd->vertBase+(t[k]-poly->vertCount))*3];
+				if (k == 0)
+				{
+					dtVcopy(bmin, v);
+					dtVcopy(bmax, v);
+				}
+				else
+				{
+					dtVmin(bmin, v);
+					dtVmax(bmax, v);
+				}
+			}
+			dtDetailBVItem& it = items[j];
+			it.i = j;
+			it.bmin[0] = quantizeDetailCoord(bmin[0], header->bmin[0], qf, false);
+			it.bmin[1] = quantizeDetailCoord(bmin[2], header->bmin[2], qf, false);
+			it.bmax[0] = quantizeDetailCoord(bmax[0], header->bmin[0], qf, true);
+			it.bmax[1] = quantizeDetailCoord(bmax[2], header->bmin[2], qf, true);
+		}
+		
+		tile->detailBVRoots[i] = curNode;
+		subdivideDetail(items, 0, ntris, curNode, tile->detailBVTree);
+	}
+	
+	return true;
+}
+
 /// @par
 ///
 /// The add operation will fail if the data is in the wrong format, the allocated tile
@@ -924,6 +1091,14 @@ dtStatus dtNavMesh::addTile(unsigned char* data, int dataSize, int flags,
 	tile->data = data;
 	tile->dataSize = dataSize;
 	tile->flags = flags;
+	tile->detailBVRoots = 0;
+	tile->detailBVTree = 0;
+	tile->detailBVNodeCount = 0;
+	
+	// Build optional detail BV-tree. Failing to allocate it is not fatal,
+	// the queries will fall back to testing all the detail triangles.
+	if (flags & DT_TILE_BUILD_DETAIL_BVTREE)
+		buildDetailBVTree(tile);
 
 	connectIntLinks(tile);
 	baseOffMeshLinks(tile);
@@ -1228,6 +1403,12 @@ dtStatus dtNavMesh::removeTile(dtTileRef ref, unsigned char** data, int* dataSiz
 	tile->detailTris = 0;
 	tile->bvTree = 0;
 	tile->offMeshCons = 0;
+	
+	// Free detail BV-tree, it is owned by the navmesh.
+	dtFree(tile->detailBVRoots);
+	tile->detailBVRoots = 0;
+	tile->detailBVTree = 0;
+	tile->detailBVNodeCount = 0;
 
 	// Update salt, salt should never be zero.
 	tile->salt = (tile->salt+1) & ((1<<m_saltBits)-1);
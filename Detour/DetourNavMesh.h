@@ -71,12 +71,21 @@ static const unsigned int DT_OFFMESH_CON_BIDIR = 1;
 /// @ingroup detour
 static const int DT_MAX_AREAS = 64;
 
+/// The minimum number of detail triangles a polygon must have before a detail 
+/// bounding volume tree is built for it. (See: #DT_TILE_BUILD_DETAIL_BVTREE)
+/// @ingroup detour
+static const int DT_DETAIL_BVTREE_MIN_TRIS = 8;
+
 /// Tile flags used for various functions and fields.
 /// For an example, see dtNavMesh::addTile().
 enum dtTileFlags
 {
 	/// The navigation mesh owns the tile memory and is responsible for freeing it.
 	DT_TILE_FREE_DATA = 0x01,
+
+	/// Build a bounding volume tree over the detail triangles of the larger polygons
+	/// when the tile is added, speeds up height queries against detailed meshes.
+	DT_TILE_BUILD_DETAIL_BVTREE = 0x02,
 };
 
 /// Vertex flags returned by dtNavMeshQuery::findStraightPath.
@@ -270,6 +279,16 @@ struct dtMeshTile
 	dtBVNode* bvTree;
 
 	dtOffMeshConnection* offMeshCons;		///< The tile off-mesh connections. [Size: dtMeshHeader::offMeshConCount]
+
+	/// The root node index of the detail bounding volume tree of each detail mesh, 
+	/// or -1 if the polygon does not have a tree. [Size: dtMeshHeader::detailMeshCount]
+	/// (Will be null if the tile was not added with #DT_TILE_BUILD_DETAIL_BVTREE.)
+	int* detailBVRoots;
+
+	/// The detail bounding volume nodes. The tree of a polygon has (2 * triCount - 1) nodes,
+	/// the leaf indices are relative to dtPolyDetail::triBase. [Size: #detailBVNodeCount]
+	dtBVNode* detailBVTree;
+	int detailBVNodeCount;					///< The number of detail bounding volume nodes.
 		
 	unsigned char* data;					///< The tile data. (Not directly accessed under normal situations.)
 	int dataSize;							///< Size of the tile data.
@@ -27,6 +27,12 @@
 #include "DetourAssert.h"
 #include <new>
 
+// Define DT_NO_SIMD to disable the SSE code paths.
+#if !defined(DT_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#	define DT_QUERY_SSE 1
+#	include <xmmintrin.h>
+#endif
+
 /// @class dtQueryFilter
 ///
 /// <b>The Default Implementation</b>
@@ -83,24 +89,9 @@ float dtQueryFilter::getCost(const float* pa, const float* pb,
 {
 	return dtVdist(pa, pb) * m_areaCost[curPoly->getArea()];
 }
-#else
-inline bool dtQueryFilter::passFilter(const dtPolyRef /*ref*/,
-									  const dtMeshTile* /*tile*/,
-									  const dtPoly* poly) const
-{
-	return (poly->flags & m_includeFlags) != 0 && (poly->flags & m_excludeFlags) == 0;
-}
-
-inline float dtQueryFilter::getCost(const float* pa, const float* pb,
-									const dtPolyRef /*prevRef*/, const dtMeshTile* /*prevTile*/, const dtPoly* /*prevPoly*/,
-									const dtPolyRef /*curRef*/, const dtMeshTile* /*curTile*/, const dtPoly* curPoly,
-									const dtPolyRef /*nextRef*/, const dtMeshTile* /*nextTile*/, const dtPoly* /*nextPoly*/) const
-{
-	return dtVdist(pa, pb) * m_areaCost[curPoly->getArea()];
-}
 #endif	
 	
-static const float H_SCALE = 0.999f; // Search heuristic scale.
+static const float H_SCALE = DT_QUERY_HEURISTIC_SCALE; // Search heuristic scale.
 
 
 dtNavMeshQuery* dtAllocNavMeshQuery()
@@ -142,6 +133,7 @@ dtNavMeshQuery::dtNavMeshQuery() :
 	m_openList(0)
 {
 	memset(&m_query, 0, sizeof(dtQueryData));
+	memset(&m_straightQuery, 0, sizeof(dtStraightPathData));
 }
 
 dtNavMeshQuery::~dtNavMeshQuery()
@@ -493,6 +485,84 @@ dtStatus dtNavMeshQuery::findRandomPointAroundCircle(dtPolyRef startRef, const f
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+// Finds the height of the first detail triangle of the polygon which contains the point in 2D.
+// Uses the detail BV-tree of the polygon when the tile has one.
+static bool getDetailHeight(const dtMeshTile* tile, const dtPoly* poly, const float* pos, float& height)
+{
+	const unsigned int ip = (unsigned int)(poly - tile->polys);
+	const dtPolyDetail* pd = &tile->detailMeshes[ip];
+	
+	const int root = tile->detailBVRoots ? tile->detailBVRoots[ip] : -1;
+	if (root < 0)
+	{
+		for (int j = 0; j < pd->triCount; ++j)
+		{
+			const unsigned char* t = &tile->detailTris[(pd->triBase+j)*4];
+			const float* v[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				if (t[k] < poly->vertCount)
+					v[k] = &tile->verts[poly->verts[t[k]]*3];
+				else
+					v[k] = &tile->detailVerts[(pd->vertBase+(t[k]-poly->vertCount))*3];
+			}
+			float h;
+			if (dtClosestHeightPointTriangle(pos, v[0], v[1], v[2], h))
+			{
+				height = h;
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	// Quantize the point the same way as the tree bounds.
+	const dtMeshHeader* header = tile->header;
+	const float qf = header->bvQuantFactor;
+	const float fx = dtClamp((pos[0] - header->bmin[0]) * qf, 0.0f, 65535.0f);
+	const float fz = dtClamp((pos[2] - header->bmin[2]) * qf, 0.0f, 65535.0f);
+	const unsigned short qx = (unsigned short)fx;
+	const unsigned short qz = (unsigned short)fz;
+	
+	// Several triangles may touch the point on their shared edges, return the
+	// one with the lowest index to match the linear search above.
+	int best = pd->triCount;
+	const dtBVNode* node = &tile->detailBVTree[root];
+	const dtBVNode* end = node + (pd->triCount*2-1);
+	while (node < end)
+	{
+		const bool overlap = qx >= node->bmin[0] && qx <= node->bmax[0] &&
+							 qz >= node->bmin[2] && qz <= node->bmax[2];
+		const bool isLeafNode = node->i >= 0;
+		
+		if (isLeafNode && overlap && node->i < best)
+		{
+			const unsigned char* t = &tile->detailTris[(pd->triBase+node->i)*4];
+			const float* v[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				if (t[k] < poly->vertCount)
+					v[k] = &tile->verts[poly->verts[t[k]]*3];
+				else
+					v[k] = &tile->detailVerts[(pd->vertBase+(t[k]-poly->vertCount))*3];
+			}
+			float h;
+			if (dtClosestHeightPointTriangle(pos, v[0], v[1], v[2], h))
+			{
+				best = node->i;
+				height = h;
+			}
+		}
+		
+		if (overlap || isLeafNode)
+			node++;
+		else
+			node += -node->i;
+	}
+	
+	return best < pd->triCount;
+}
+
 /// @par
 ///
 /// Uses the detail polygons to find the surface height. (Most accurate.)
@@ -531,9 +601,6 @@ void dtNavMeshQuery::closestPointOnPolyInTile(const dtMeshTile* tile, const dtPo
 		return;
 	}
 
-	const unsigned int ip = (unsigned int)(poly - tile->polys);
-	const dtPolyDetail* pd = &tile->detailMeshes[ip];
-
 	// Clamp point to be inside the polygon.
 	float verts[DT_VERTS_PER_POLYGON*3];	
 	float edged[DT_VERTS_PER_POLYGON];
@@ -562,24 +629,9 @@ void dtNavMeshQuery::closestPointOnPolyInTile(const dtMeshTile* tile, const dtPo
 	}
 
 	// Find height at the location.
-	for (int j = 0; j < pd->triCount; ++j)
-	{
-		const unsigned char* t = &tile->detailTris[(pd->triBase+j)*4];
-		const float* v[3];
-		for (int k = 0; k < 3; ++k)
-		{
-			if (t[k] < poly->vertCount)
-				v[k] = &tile->verts[poly->verts[t[k]]*3];
-			else
-				v[k] = &tile->detailVerts[(pd->vertBase+(t[k]-poly->vertCount))*3];
-		}
-		float h;
-		if (dtClosestHeightPointTriangle(pos, v[0], v[1], v[2], h))
-		{
-			closest[1] = h;
-			break;
-		}
-	}
+	float h;
+	if (getDetailHeight(tile, poly, pos, h))
+		closest[1] = h;
 
 /*	float closestDistSqr = FLT_MAX;
 	for (int j = 0; j < pd->triCount; ++j)
@@ -691,26 +743,12 @@ dtStatus dtNavMeshQuery::getPolyHeight(dtPolyRef ref, const float* pos, float* h
 	}
 	else
 	{
-		const unsigned int ip = (unsigned int)(poly - tile->polys);
-		const dtPolyDetail* pd = &tile->detailMeshes[ip];
-		for (int j = 0; j < pd->triCount; ++j)
+		float h;
+		if (getDetailHeight(tile, poly, pos, h))
 		{
-			const unsigned char* t = &tile->detailTris[(pd->triBase+j)*4];
-			const float* v[3];
-			for (int k = 0; k < 3; ++k)
-			{
-				if (t[k] < poly->vertCount)
-					v[k] = &tile->verts[poly->verts[t[k]]*3];
-				else
-					v[k] = &tile->detailVerts[(pd->vertBase+(t[k]-poly->vertCount))*3];
-			}
-			float h;
-			if (dtClosestHeightPointTriangle(pos, v[0], v[1], v[2], h))
-			{
-				if (height)
-					*height = h;
-				return DT_SUCCESS;
-			}
+			if (height)
+				*height = h;
+			return DT_SUCCESS;
 		}
 	}
 	
@@ -980,217 +1018,7 @@ dtStatus dtNavMeshQuery::findPath(dtPolyRef startRef, dtPolyRef endRef,
 								  const dtQueryFilter* filter,
 								  dtPolyRef* path, int* pathCount, const int maxPath) const
 {
-	dtAssert(m_nav);
-	dtAssert(m_nodePool);
-	dtAssert(m_openList);
-	
-	*pathCount = 0;
-	
-	if (!startRef || !endRef)
-		return DT_FAILURE | DT_INVALID_PARAM;
-	
-	if (!maxPath)
-		return DT_FAILURE | DT_INVALID_PARAM;
-	
-	// Validate input
-	if (!m_nav->isValidPolyRef(startRef) || !m_nav->isValidPolyRef(endRef))
-		return DT_FAILURE | DT_INVALID_PARAM;
-	
-	if (startRef == endRef)//起点跟终点在一起
-	{
-		path[0] = startRef;
-		*pathCount = 1;
-		return DT_SUCCESS;
-	}
-	
-	m_nodePool->clear();//结点缓冲池
-	m_openList->clear();//open表
-	
-	dtNode* startNode = m_nodePool->getNode(startRef);//生成起点
-	dtVcopy(startNode->pos, startPos);
-	startNode->pidx = 0;
-	startNode->cost = 0;
-	startNode->total = dtVdist(startPos, endPos) * H_SCALE;
-	startNode->id = startRef;
-	startNode->flags = DT_NODE_OPEN;
-	m_openList->push(startNode);//将起点加入open表
-	
-	dtNode* lastBestNode = startNode;
-	float lastBestNodeCost = startNode->total;
-	
-	dtStatus status = DT_SUCCESS;
-	
-	while (!m_openList->empty())
-	{
-        //从open表中移除，并添加到close表中。
-		// Remove node from open list and put it in closed list.
-		dtNode* bestNode = m_openList->pop();
-		bestNode->flags &= ~DT_NODE_OPEN;
-		bestNode->flags |= DT_NODE_CLOSED;
-		
-		// Reached the goal, stop searching.
-		if (bestNode->id == endRef)
-		{
-			lastBestNode = bestNode;
-			break;
-		}
-		
-		// Get current poly and tile.
-		// The API input has been cheked already, skip checking internal data.
-		const dtPolyRef bestRef = bestNode->id;
-		const dtMeshTile* bestTile = 0;
-		const dtPoly* bestPoly = 0;
-		m_nav->getTileAndPolyByRefUnsafe(bestRef, &bestTile, &bestPoly);
-		
-		// Get parent poly and tile.
-		dtPolyRef parentRef = 0;
-		const dtMeshTile* parentTile = 0;
-		const dtPoly* parentPoly = 0;
-		if (bestNode->pidx)
-			parentRef = m_nodePool->getNodeAtIdx(bestNode->pidx)->id;//获得父多边形
-
-		if (parentRef)
-			m_nav->getTileAndPolyByRefUnsafe(parentRef, &parentTile, &parentPoly);//获得父tile
-		
-        //遍历邻接多边形
-		for (unsigned int i = bestPoly->firstLink; i != DT_NULL_LINK; i = bestTile->links[i].next)
-		{
-			dtPolyRef neighbourRef = bestTile->links[i].ref;
-			
-            //跳过无效的id，并且禁止回向遍历（防止死循环）
-			// Skip invalid ids and do not expand back to where we came from.
-			if (!neighbourRef || neighbourRef == parentRef)
-				continue;
-			
-            //获得邻接的多边形和tile
-			// Get neighbour poly and tile.
-			// The API input has been cheked already, skip checking internal data.
-			const dtMeshTile* neighbourTile = 0;
-			const dtPoly* neighbourPoly = 0;
-			m_nav->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);			
-			
-			if (!filter->passFilter(neighbourRef, neighbourTile, neighbourPoly))
-				continue;
-
-            //查找或分配邻接结点
-			dtNode* neighbourNode = m_nodePool->getNode(neighbourRef);
-			if (!neighbourNode)
-			{
-				status |= DT_OUT_OF_NODES;
-				continue;
-			}
-			
-            //第一次访问
-			// If the node is visited the first time, calculate node position.
-			if (neighbourNode->flags == 0)
-			{
-				getEdgeMidPoint(bestRef, bestPoly, bestTile,
-								neighbourRef, neighbourPoly, neighbourTile,
-								neighbourNode->pos);
-			}
-
-			// Calculate cost and heuristic.
-			float cost = 0;
-			float heuristic = 0;
-			
-            //终点
-			// Special case for last node.
-			if (neighbourRef == endRef)
-			{
-				// Cost
-				const float curCost = filter->getCost(bestNode->pos, neighbourNode->pos,
-													  parentRef, parentTile, parentPoly,
-													  bestRef, bestTile, bestPoly,
-													  neighbourRef, neighbourTile, neighbourPoly);
-				const float endCost = filter->getCost(neighbourNode->pos, endPos,
-													  bestRef, bestTile, bestPoly,
-													  neighbourRef, neighbourTile, neighbourPoly,
-													  0, 0, 0);
-				
-				cost = bestNode->cost + curCost + endCost;
-				heuristic = 0;
-			}
-			else
-			{
-				// Cost
-				const float curCost = filter->getCost(bestNode->pos, neighbourNode->pos,
-													  parentRef, parentTile, parentPoly,
-													  bestRef, bestTile, bestPoly,
-													  neighbourRef, neighbourTile, neighbourPoly);
-				cost = bestNode->cost + curCost;
-				heuristic = dtVdist(neighbourNode->pos, endPos)*H_SCALE;
-			}
-
-			const float total = cost + heuristic;
-			
-			// The node is already in open list and the new result is worse, skip.
-			if ((neighbourNode->flags & DT_NODE_OPEN) && total >= neighbourNode->total)
-				continue;
-			// The node is already visited and process, and the new result is worse, skip.
-			if ((neighbourNode->flags & DT_NODE_CLOSED) && total >= neighbourNode->total)
-				continue;
-			
-			// Add or update the node.
-			neighbourNode->pidx = m_nodePool->getNodeIdx(bestNode);
-			neighbourNode->id = neighbourRef;
-			neighbourNode->flags = (neighbourNode->flags & ~DT_NODE_CLOSED);
-			neighbourNode->cost = cost;
-			neighbourNode->total = total;
-			
-			if (neighbourNode->flags & DT_NODE_OPEN)
-			{
-				// Already in open, update node location.
-				m_openList->modify(neighbourNode);
-			}
-			else
-			{
-				// Put the node in open list.
-				neighbourNode->flags |= DT_NODE_OPEN;
-				m_openList->push(neighbourNode);
-			}
-			
-			// Update nearest node to target so far.
-			if (heuristic < lastBestNodeCost)
-			{
-				lastBestNodeCost = heuristic;
-				lastBestNode = neighbourNode;
-			}
-		}
-	}
-	
-	if (lastBestNode->id != endRef)
-		status |= DT_PARTIAL_RESULT;
-	
-	// Reverse the path.
-	dtNode* prev = 0;
-	dtNode* node = lastBestNode;
-	do
-	{
-		dtNode* next = m_nodePool->getNodeAtIdx(node->pidx);
-		node->pidx = m_nodePool->getNodeIdx(prev);
-		prev = node;
-		node = next;
-	}
-	while (node);
-	
-	// Store path
-	node = prev;
-	int n = 0;
-	do
-	{
-		path[n++] = node->id;
-		if (n >= maxPath)
-		{
-			status |= DT_BUFFER_TOO_SMALL;
-			break;
-		}
-		node = m_nodePool->getNodeAtIdx(node->pidx);
-	}
-	while (node);
-	
-	*pathCount = n;
-	
-	return status;
+	return findPath<dtQueryFilter>(startRef, endRef, startPos, endPos, filter, path, pathCount, maxPath);
 }
 
 /// @par
@@ -1675,216 +1503,325 @@ dtStatus dtNavMeshQuery::findStraightPath(const float* startPos, const float* en
 	
 	*straightPathCount = 0;
 	
-	if (!maxStraightPath)
-		return DT_FAILURE | DT_INVALID_PARAM;
+	dtStraightPathData state;
+	dtStatus stat = initStraightPath(state, startPos, endPos, path, pathSize,
+									 straightPath, straightPathFlags, straightPathRefs,
+									 maxStraightPath, options);
+	if (stat == DT_IN_PROGRESS)
+		stat = updateStraightPath(state, 0x7fffffff, 0);
 	
-	if (!path[0])
-		return DT_FAILURE | DT_INVALID_PARAM;
+	*straightPathCount = state.straightPathCount;
 	
-	dtStatus stat = 0;
+	return stat;
+}
+
+/// @par
+///
+/// The sliced string pulling produces exactly the same result as findStraightPath(),
+/// but the funnel can be advanced a limited number of portals at a time. 
+///
+/// The @p path and the result buffers are stored and used for the duration of 
+/// the query, they must stay valid until updateSlicedFindStraightPath() completes.
+/// The sliced string pulling state is separate from the sliced path query state,
+/// so both can be in progress at the same time.
+///
+dtStatus dtNavMeshQuery::initSlicedFindStraightPath(const float* startPos, const float* endPos,
+													const dtPolyRef* path, const int pathSize,
+													float* straightPath, unsigned char* straightPathFlags, dtPolyRef* straightPathRefs,
+													const int maxStraightPath, const int options)
+{
+	dtAssert(m_nav);
+	
+	return initStraightPath(m_straightQuery, startPos, endPos, path, pathSize,
+							straightPath, straightPathFlags, straightPathRefs,
+							maxStraightPath, options);
+}
+
+/// @par
+///
+/// Every processed portal, including the portals revisited when the funnel
+/// restarts from a new apex, counts as one iteration.
+///
+/// The corners are streamed to the buffers passed to initSlicedFindStraightPath()
+/// as soon as they are found. While the query is in progress, the last reported 
+/// corner may still have its flags and polygon reference updated if the next 
+/// corner is at the same location, all the corners before it are final.
+///
+dtStatus dtNavMeshQuery::updateSlicedFindStraightPath(const int maxIter, int* doneIters, int* straightPathCount)
+{
+	if (m_straightQuery.status == DT_IN_PROGRESS)
+		updateStraightPath(m_straightQuery, maxIter, doneIters);
+	else if (doneIters)
+		*doneIters = 0;
+	
+	if (straightPathCount)
+		*straightPathCount = m_straightQuery.straightPathCount;
+	
+	return m_straightQuery.status;
+}
+
+dtStatus dtNavMeshQuery::initStraightPath(dtStraightPathData& sp, const float* startPos, const float* endPos,
+										  const dtPolyRef* path, const int pathSize,
+										  float* straightPath, unsigned char* straightPathFlags, dtPolyRef* straightPathRefs,
+										  const int maxStraightPath, const int options) const
+{
+	memset(&sp, 0, sizeof(dtStraightPathData));
+	sp.status = DT_FAILURE | DT_INVALID_PARAM;
+	
+	if (!maxStraightPath)
+		return sp.status;
+	
+	if (!path[0])
+		return sp.status;
+	
+	sp.path = path;
+	sp.pathSize = pathSize;
+	sp.straightPath = straightPath;
+	sp.straightPathFlags = straightPathFlags;
+	sp.straightPathRefs = straightPathRefs;
+	sp.maxStraightPath = maxStraightPath;
+	sp.options = options;
+	dtVcopy(sp.endPos, endPos);
 	
 	// TODO: Should this be callers responsibility?
 	float closestStartPos[3];
 	if (dtStatusFailed(closestPointOnPolyBoundary(path[0], startPos, closestStartPos)))
-		return DT_FAILURE | DT_INVALID_PARAM;
+		return sp.status;
 
-	float closestEndPos[3];
-	if (dtStatusFailed(closestPointOnPolyBoundary(path[pathSize-1], endPos, closestEndPos)))
-		return DT_FAILURE | DT_INVALID_PARAM;
+	if (dtStatusFailed(closestPointOnPolyBoundary(path[pathSize-1], endPos, sp.closestEndPos)))
+		return sp.status;
 	
 	// Add start point.
-	stat = appendVertex(closestStartPos, DT_STRAIGHTPATH_START, path[0],
-						straightPath, straightPathFlags, straightPathRefs,
-						straightPathCount, maxStraightPath);
-	if (stat != DT_IN_PROGRESS)
-		return stat;
+	sp.status = appendVertex(closestStartPos, DT_STRAIGHTPATH_START, path[0],
+							 straightPath, straightPathFlags, straightPathRefs,
+							 &sp.straightPathCount, maxStraightPath);
+	if (sp.status != DT_IN_PROGRESS)
+		return sp.status;
+	
+	dtVcopy(sp.portalApex, closestStartPos);
+	dtVcopy(sp.portalLeft, sp.portalApex);
+	dtVcopy(sp.portalRight, sp.portalApex);
+	sp.leftPolyRef = path[0];
+	sp.rightPolyRef = path[0];
+	
+	// Single polygon path only needs the end point.
+	sp.index = pathSize > 1 ? 0 : pathSize;
+	
+	return sp.status;
+}
+
+dtStatus dtNavMeshQuery::updateStraightPath(dtStraightPathData& sp, const int maxIter, int* doneIters) const
+{
+	const dtPolyRef* path = sp.path;
+	const int pathSize = sp.pathSize;
+	const int options = sp.options;
 	
-	if (pathSize > 1)
+	dtStatus stat = 0;
+	int iter = 0;
+	
+	while (sp.index < pathSize && iter < maxIter)
 	{
-		float portalApex[3], portalLeft[3], portalRight[3];
-		dtVcopy(portalApex, closestStartPos);
-		dtVcopy(portalLeft, portalApex);
-		dtVcopy(portalRight, portalApex);
-		int apexIndex = 0;
-		int leftIndex = 0;
-		int rightIndex = 0;
+		iter++;
 		
-		unsigned char leftPolyType = 0;
-		unsigned char rightPolyType = 0;
+		const int i = sp.index;
+		sp.index = i+1;
 		
-		dtPolyRef leftPolyRef = path[0];
-		dtPolyRef rightPolyRef = path[0];
+		float left[3], right[3];
+		unsigned char fromType, toType;
 		
-		for (int i = 0; i < pathSize; ++i)
+		if (i+1 < pathSize)
 		{
-			float left[3], right[3];
-			unsigned char fromType, toType;
-			
-			if (i+1 < pathSize)
+			// Next portal.
+			if (dtStatusFailed(getPortalPoints(path[i], path[i+1], left, right, fromType, toType)))
 			{
-				// Next portal.
-				if (dtStatusFailed(getPortalPoints(path[i], path[i+1], left, right, fromType, toType)))
+				// Failed to get portal points, in practice this means that path[i+1] is invalid polygon.
+				// Clamp the end point to path[i], and return the path so far.
+				
+				if (dtStatusFailed(closestPointOnPolyBoundary(path[i], sp.endPos, sp.closestEndPos)))
 				{
-					// Failed to get portal points, in practice this means that path[i+1] is invalid polygon.
-					// Clamp the end point to path[i], and return the path so far.
-					
-					if (dtStatusFailed(closestPointOnPolyBoundary(path[i], endPos, closestEndPos)))
-					{
-						// This should only happen when the first polygon is invalid.
-						return DT_FAILURE | DT_INVALID_PARAM;
-					}
-
-					// Apeend portals along the current straight path segment.
-					if (options & (DT_STRAIGHTPATH_AREA_CROSSINGS | DT_STRAIGHTPATH_ALL_CROSSINGS))
-					{
-						stat = appendPortals(apexIndex, i, closestEndPos, path,
-											 straightPath, straightPathFlags, straightPathRefs,
-											 straightPathCount, maxStraightPath, options);
-					}
-
-					stat = appendVertex(closestEndPos, 0, path[i],
-										straightPath, straightPathFlags, straightPathRefs,
-										straightPathCount, maxStraightPath);
-					
-					return DT_SUCCESS | DT_PARTIAL_RESULT | ((*straightPathCount >= maxStraightPath) ? DT_BUFFER_TOO_SMALL : 0);
+					// This should only happen when the first polygon is invalid.
+					sp.status = DT_FAILURE | DT_INVALID_PARAM;
+					break;
 				}
-				
-				// If starting really close the portal, advance.
-				if (i == 0)
+
+				// Apeend portals along the current straight path segment.
+				if (options & (DT_STRAIGHTPATH_AREA_CROSSINGS | DT_STRAIGHTPATH_ALL_CROSSINGS))
 				{
-					float t;
-					if (dtDistancePtSegSqr2D(portalApex, left, right, t) < dtSqr(0.001f))
-						continue;
+					stat = appendPortals(sp.apexIndex, i, sp.closestEndPos, path,
+										 sp.straightPath, sp.straightPathFlags, sp.straightPathRefs,
+										 &sp.straightPathCount, sp.maxStraightPath, options);
 				}
+
+				stat = appendVertex(sp.closestEndPos, 0, path[i],
+									sp.straightPath, sp.straightPathFlags, sp.straightPathRefs,
+									&sp.straightPathCount, sp.maxStraightPath);
+				
+				sp.status = DT_SUCCESS | DT_PARTIAL_RESULT | ((sp.straightPathCount >= sp.maxStraightPath) ? DT_BUFFER_TOO_SMALL : 0);
+				break;
 			}
-			else
+			
+			// If starting really close the portal, advance.
+			if (i == 0)
 			{
-				// End of the path.
-				dtVcopy(left, closestEndPos);
-				dtVcopy(right, closestEndPos);
-				
-				fromType = toType = DT_POLYTYPE_GROUND;
+				float t;
+				if (dtDistancePtSegSqr2D(sp.portalApex, left, right, t) < dtSqr(0.001f))
+					continue;
 			}
+		}
+		else
+		{
+			// End of the path.
+			dtVcopy(left, sp.closestEndPos);
+			dtVcopy(right, sp.closestEndPos);
 			
-			// Right vertex.
-			if (dtTriArea2D(portalApex, portalRight, right) <= 0.0f)
+			fromType = toType = DT_POLYTYPE_GROUND;
+		}
+		
+		// Right vertex.
+		if (dtTriArea2D(sp.portalApex, sp.portalRight, right) <= 0.0f)
+		{
+			if (dtVequal(sp.portalApex, sp.portalRight) || dtTriArea2D(sp.portalApex, sp.portalLeft, right) > 0.0f)
 			{
-				if (dtVequal(portalApex, portalRight) || dtTriArea2D(portalApex, portalLeft, right) > 0.0f)
-				{
-					dtVcopy(portalRight, right);
-					rightPolyRef = (i+1 < pathSize) ? path[i+1] : 0;
-					rightPolyType = toType;
-					rightIndex = i;
-				}
-				else
+				dtVcopy(sp.portalRight, right);
+				sp.rightPolyRef = (i+1 < pathSize) ? path[i+1] : 0;
+				sp.rightPolyType = toType;
+				sp.rightIndex = i;
+			}
+			else
+			{
+				// Append portals along the current straight path segment.
+				if (options & (DT_STRAIGHTPATH_AREA_CROSSINGS | DT_STRAIGHTPATH_ALL_CROSSINGS))
 				{
-					// Append portals along the current straight path segment.
-					if (options & (DT_STRAIGHTPATH_AREA_CROSSINGS | DT_STRAIGHTPATH_ALL_CROSSINGS))
+					stat = appendPortals(sp.apexIndex, sp.leftIndex, sp.portalLeft, path,
+										 sp.straightPath, sp.straightPathFlags, sp.straightPathRefs,
+										 &sp.straightPathCount, sp.maxStraightPath, options);
+					if (stat != DT_IN_PROGRESS)
 					{
-						stat = appendPortals(apexIndex, leftIndex, portalLeft, path,
-											 straightPath, straightPathFlags, straightPathRefs,
-											 straightPathCount, maxStraightPath, options);
-						if (stat != DT_IN_PROGRESS)
-							return stat;					
+						sp.status = stat;
+						break;
 					}
-				
-					dtVcopy(portalApex, portalLeft);
-					apexIndex = leftIndex;
-					
-					unsigned char flags = 0;
-					if (!leftPolyRef)
-						flags = DT_STRAIGHTPATH_END;
-					else if (leftPolyType == DT_POLYTYPE_OFFMESH_CONNECTION)
-						flags = DT_STRAIGHTPATH_OFFMESH_CONNECTION;
-					dtPolyRef ref = leftPolyRef;
-					
-					// Append or update vertex
-					stat = appendVertex(portalApex, flags, ref,
-										straightPath, straightPathFlags, straightPathRefs,
-										straightPathCount, maxStraightPath);
-					if (stat != DT_IN_PROGRESS)
-						return stat;
-					
-					dtVcopy(portalLeft, portalApex);
-					dtVcopy(portalRight, portalApex);
-					leftIndex = apexIndex;
-					rightIndex = apexIndex;
-					
-					// Restart
-					i = apexIndex;
-					
-					continue;
 				}
-			}
 			
-			// Left vertex.
-			if (dtTriArea2D(portalApex, portalLeft, left) >= 0.0f)
-			{
-				if (dtVequal(portalApex, portalLeft) || dtTriArea2D(portalApex, portalRight, left) < 0.0f)
+				dtVcopy(sp.portalApex, sp.portalLeft);
+				sp.apexIndex = sp.leftIndex;
+				
+				unsigned char flags = 0;
+				if (!sp.leftPolyRef)
+					flags = DT_STRAIGHTPATH_END;
+				else if (sp.leftPolyType == DT_POLYTYPE_OFFMESH_CONNECTION)
+					flags = DT_STRAIGHTPATH_OFFMESH_CONNECTION;
+				dtPolyRef ref = sp.leftPolyRef;
+				
+				// Append or update vertex
+				stat = appendVertex(sp.portalApex, flags, ref,
+									sp.straightPath, sp.straightPathFlags, sp.straightPathRefs,
+									&sp.straightPathCount, sp.maxStraightPath);
+				if (stat != DT_IN_PROGRESS)
 				{
-					dtVcopy(portalLeft, left);
-					leftPolyRef = (i+1 < pathSize) ? path[i+1] : 0;
-					leftPolyType = toType;
-					leftIndex = i;
+					sp.status = stat;
+					break;
 				}
-				else
+				
+				dtVcopy(sp.portalLeft, sp.portalApex);
+				dtVcopy(sp.portalRight, sp.portalApex);
+				sp.leftIndex = sp.apexIndex;
+				sp.rightIndex = sp.apexIndex;
+				
+				// Restart
+				sp.index = sp.apexIndex+1;
+				
+				continue;
+			}
+		}
+		
+		// Left vertex.
+		if (dtTriArea2D(sp.portalApex, sp.portalLeft, left) >= 0.0f)
+		{
+			if (dtVequal(sp.portalApex, sp.portalLeft) || dtTriArea2D(sp.portalApex, sp.portalRight, left) < 0.0f)
+			{
+				dtVcopy(sp.portalLeft, left);
+				sp.leftPolyRef = (i+1 < pathSize) ? path[i+1] : 0;
+				sp.leftPolyType = toType;
+				sp.leftIndex = i;
+			}
+			else
+			{
+				// Append portals along the current straight path segment.
+				if (options & (DT_STRAIGHTPATH_AREA_CROSSINGS | DT_STRAIGHTPATH_ALL_CROSSINGS))
 				{
-					// Append portals along the current straight path segment.
-					if (options & (DT_STRAIGHTPATH_AREA_CROSSINGS | DT_STRAIGHTPATH_ALL_CROSSINGS))
+					stat = appendPortals(sp.apexIndex, sp.rightIndex, sp.portalRight, path,
+										 sp.straightPath, sp.straightPathFlags, sp.straightPathRefs,
+										 &sp.straightPathCount, sp.maxStraightPath, options);
+					if (stat != DT_IN_PROGRESS)
 					{
-						stat = appendPortals(apexIndex, rightIndex, portalRight, path,
-											 straightPath, straightPathFlags, straightPathRefs,
-											 straightPathCount, maxStraightPath, options);
-						if (stat != DT_IN_PROGRESS)
-							return stat;
+						sp.status = stat;
+						break;
 					}
+				}
 
-					dtVcopy(portalApex, portalRight);
-					apexIndex = rightIndex;
-					
-					unsigned char flags = 0;
-					if (!rightPolyRef)
-						flags = DT_STRAIGHTPATH_END;
-					else if (rightPolyType == DT_POLYTYPE_OFFMESH_CONNECTION)
-						flags = DT_STRAIGHTPATH_OFFMESH_CONNECTION;
-					dtPolyRef ref = rightPolyRef;
-
-					// Append or update vertex
-					stat = appendVertex(portalApex, flags, ref,
-										straightPath, straightPathFlags, straightPathRefs,
-										straightPathCount, maxStraightPath);
-					if (stat != DT_IN_PROGRESS)
-						return stat;
-					
-					dtVcopy(portalLeft, portalApex);
-					dtVcopy(portalRight, portalApex);
-					leftIndex = apexIndex;
-					rightIndex = apexIndex;
-					
-					// Restart
-					i = apexIndex;
-					
-					continue;
+				dtVcopy(sp.portalApex, sp.portalRight);
+				sp.apexIndex = sp.rightIndex;
+				
+				unsigned char flags = 0;
+				if (!sp.rightPolyRef)
+					flags = DT_STRAIGHTPATH_END;
+				else if (sp.rightPolyType == DT_POLYTYPE_OFFMESH_CONNECTION)
+					flags = DT_STRAIGHTPATH_OFFMESH_CONNECTION;
+				dtPolyRef ref = sp.rightPolyRef;
+
+				// Append or update vertex
+				stat = appendVertex(sp.portalApex, flags, ref,
+									sp.straightPath, sp.straightPathFlags, sp.straightPathRefs,
+									&sp.straightPathCount, sp.maxStraightPath);
+				if (stat != DT_IN_PROGRESS)
+				{
+					sp.status = stat;
+					break;
 				}
+				
+				dtVcopy(sp.portalLeft, sp.portalApex);
+				dtVcopy(sp.portalRight, sp.portalApex);
+				sp.leftIndex = sp.apexIndex;
+				sp.rightIndex = sp.apexIndex;
+				
+				// Restart
+				sp.index = sp.apexIndex+1;
+				
+				continue;
 			}
 		}
-
+	}
+	
+	if (doneIters)
+		*doneIters = iter;
+	
+	if (sp.status != DT_IN_PROGRESS || sp.index < pathSize)
+		return sp.status;
+	
+	// The funnel has reached the end of the path.
+	if (pathSize > 1)
+	{
 		// Append portals along the current straight path segment.
 		if (options & (DT_STRAIGHTPATH_AREA_CROSSINGS | DT_STRAIGHTPATH_ALL_CROSSINGS))
 		{
-			stat = appendPortals(apexIndex, pathSize-1, closestEndPos, path,
-								 straightPath, straightPathFlags, straightPathRefs,
-								 straightPathCount, maxStraightPath, options);
+			stat = appendPortals(sp.apexIndex, pathSize-1, sp.closestEndPos, path,
+								 sp.straightPath, sp.straightPathFlags, sp.straightPathRefs,
+								 &sp.straightPathCount, sp.maxStraightPath, options);
 			if (stat != DT_IN_PROGRESS)
-				return stat;
+			{
+				sp.status = stat;
+				return sp.status;
+			}
 		}
 	}
 
-	stat = appendVertex(closestEndPos, DT_STRAIGHTPATH_END, 0,
-						straightPath, straightPathFlags, straightPathRefs,
-						straightPathCount, maxStraightPath);
+	stat = appendVertex(sp.closestEndPos, DT_STRAIGHTPATH_END, 0,
+						sp.straightPath, sp.straightPathFlags, sp.straightPathRefs,
+						&sp.straightPathCount, sp.maxStraightPath);
+	
+	sp.status = DT_SUCCESS | ((sp.straightPathCount >= sp.maxStraightPath) ? DT_BUFFER_TOO_SMALL : 0);
 	
-	return DT_SUCCESS | ((*straightPathCount >= maxStraightPath) ? DT_BUFFER_TOO_SMALL : 0);
+	return sp.status;
 }
 
 /// @par
@@ -2225,6 +2162,111 @@ dtStatus dtNavMeshQuery::getEdgeMidPoint(dtPolyRef from, const dtPoly* fromPoly,
 	return DT_SUCCESS;
 }
 
+
+// Number of edge slots evaluated by the segment/polygon kernel, rounded up to full SIMD lanes.
+static const int MAX_POLY_EDGES = (DT_VERTS_PER_POLYGON+3) & ~3;
+
+// Intersects the segment p0-p1 with the polygon in 2D, same results as dtIntersectSegmentPoly2D().
+// The vertices are read directly from the tile, and the edge equations for all edges
+// are evaluated up front, four edges at a time when SSE is available.
+static bool intersectSegmentPolyEdges2D(const float* p0, const float* p1,
+										const dtMeshTile* tile, const dtPoly* poly,
+										float& tmin, float& tmax, int& segMin, int& segMax)
+{
+	static const float EPS = 0.00000001f;
+	
+	tmin = 0;
+	tmax = 1;
+	segMin = -1;
+	segMax = -1;
+	
+	// Edge i goes from vertex i-1 to vertex i.
+	const int nv = (int)poly->vertCount;
+	float ax[MAX_POLY_EDGES], az[MAX_POLY_EDGES];
+	float bx[MAX_POLY_EDGES], bz[MAX_POLY_EDGES];
+	for (int i = 0, j = nv-1; i < nv; j = i++)
+	{
+		const float* va = &tile->verts[poly->verts[j]*3];
+		const float* vb = &tile->verts[poly->verts[i]*3];
+		ax[i] = va[0]; az[i] = va[2];
+		bx[i] = vb[0]; bz[i] = vb[2];
+	}
+	for (int i = nv; i < MAX_POLY_EDGES; ++i)
+		ax[i] = az[i] = bx[i] = bz[i] = 0;
+	
+	const float dirx = p1[0] - p0[0];
+	const float dirz = p1[2] - p0[2];
+	
+	float n[MAX_POLY_EDGES], d[MAX_POLY_EDGES];
+#ifdef DT_QUERY_SSE
+	const __m128 px = _mm_set1_ps(p0[0]);
+	const __m128 pz = _mm_set1_ps(p0[2]);
+	const __m128 dx = _mm_set1_ps(dirx);
+	const __m128 dz = _mm_set1_ps(dirz);
+	for (int i = 0; i < nv; i += 4)
+	{
+		const __m128 x0 = _mm_loadu_ps(&ax[i]);
+		const __m128 z0 = _mm_loadu_ps(&az[i]);
+		const __m128 ex = _mm_sub_ps(_mm_loadu_ps(&bx[i]), x0);
+		const __m128 ez = _mm_sub_ps(_mm_loadu_ps(&bz[i]), z0);
+		const __m128 fx = _mm_sub_ps(px, x0);
+		const __m128 fz = _mm_sub_ps(pz, z0);
+		// n = perp(edge, diff), d = perp(dir, edge)
+		_mm_storeu_ps(&n[i], _mm_sub_ps(_mm_mul_ps(ez, fx), _mm_mul_ps(ex, fz)));
+		_mm_storeu_ps(&d[i], _mm_sub_ps(_mm_mul_ps(dz, ex), _mm_mul_ps(dx, ez)));
+	}
+#else
+	for (int i = 0; i < nv; ++i)
+	{
+		const float ex = bx[i] - ax[i];
+		const float ez = bz[i] - az[i];
+		const float fx = p0[0] - ax[i];
+		const float fz = p0[2] - az[i];
+		n[i] = ez*fx - ex*fz;
+		d[i] = dirz*ex - dirx*ez;
+	}
+#endif
+	
+	for (int i = 0, j = nv-1; i < nv; j = i++)
+	{
+		if (fabsf(d[i]) < EPS)
+		{
+			// S is nearly parallel to this edge
+			if (n[i] < 0)
+				return false;
+			else
+				continue;
+		}
+		const float t = n[i] / d[i];
+		if (d[i] < 0)
+		{
+			// segment S is entering across this edge
+			if (t > tmin)
+			{
+				tmin = t;
+				segMin = j;
+				// S enters after leaving polygon
+				if (tmin > tmax)
+					return false;
+			}
+		}
+		else
+		{
+			// segment S is leaving across this edge
+			if (t < tmax)
+			{
+				tmax = t;
+				segMax = j;
+				// S leaves before entering polygon
+				if (tmax < tmin)
+					return false;
+			}
+		}
+	}
+	
+	return true;
+}
+
 /// @par
 ///
 /// This method is meant to be used for quick, short distance checks.
@@ -2278,7 +2320,6 @@ dtStatus dtNavMeshQuery::raycast(dtPolyRef startRef, const float* startPos, cons
 		return DT_FAILURE | DT_INVALID_PARAM;
 	
 	dtPolyRef curRef = startRef;
-	float verts[DT_VERTS_PER_POLYGON*3];	
 	int n = 0;
 	
 	hitNormal[0] = 0;
@@ -2296,17 +2337,9 @@ dtStatus dtNavMeshQuery::raycast(dtPolyRef startRef, const float* startPos, cons
 		const dtPoly* poly = 0;
 		m_nav->getTileAndPolyByRefUnsafe(curRef, &tile, &poly);
 		
-		// Collect vertices.
-		int nv = 0;
-		for (int i = 0; i < (int)poly->vertCount; ++i)
-		{
-			dtVcopy(&verts[nv*3], &tile->verts[poly->verts[i]*3]);
-			nv++;
-		}		
-		
 		float tmin, tmax;
 		int segMin, segMax;
-		if (!dtIntersectSegmentPoly2D(startPos, endPos, verts, nv, tmin, tmax, segMin, segMax))
+		if (!intersectSegmentPolyEdges2D(startPos, endPos, tile, poly, tmin, tmax, segMin, segMax))
 		{
 			// Could not hit the polygon, keep the old t and report hit.
 			if (pathCount)
@@ -2419,9 +2452,9 @@ dtStatus dtNavMeshQuery::raycast(dtPolyRef startRef, const float* startPos, cons
 			
 			// Calculate hit normal.
 			const int a = segMax;
-			const int b = segMax+1 < nv ? segMax+1 : 0;
-			const float* va = &verts[a*3];
-			const float* vb = &verts[b*3];
+			const int b = segMax+1 < (int)poly->vertCount ? segMax+1 : 0;
+			const float* va = &tile->verts[poly->verts[a]*3];
+			const float* vb = &tile->verts[poly->verts[b]*3];
 			const float dx = vb[0] - va[0];
 			const float dz = vb[2] - va[2];
 			hitNormal[0] = dz;
@@ -2444,6 +2477,52 @@ dtStatus dtNavMeshQuery::raycast(dtPolyRef startRef, const float* startPos, cons
 	return status;
 }
 
+/// @par
+///
+/// Casts @p rayCount independent rays, see raycast() for the details of a single ray.
+/// The inputs and outputs of ray @e i are found at the following offsets:
+/// 
+/// - startPos, endPos, hitNormals: [i*3]
+/// - path: [i*maxPath]
+/// 
+/// The per ray status is stored in @p rayStatus when it is provided. The returned
+/// status contains the detail flags of all rays, and fails only if every ray failed.
+///
+dtStatus dtNavMeshQuery::raycastBatch(const dtPolyRef* startRefs, const float* startPos, const float* endPos,
+									  const int rayCount, const dtQueryFilter* filter,
+									  float* t, float* hitNormals, dtStatus* rayStatus,
+									  dtPolyRef* path, int* pathCounts, const int maxPath) const
+{
+	dtAssert(m_nav);
+	
+	if (!startRefs || !startPos || !endPos || !filter || !t || !hitNormals || rayCount < 0)
+		return DT_FAILURE | DT_INVALID_PARAM;
+	if (path && (!pathCounts || maxPath <= 0))
+		return DT_FAILURE | DT_INVALID_PARAM;
+	
+	dtStatus details = 0;
+	int nfailed = 0;
+	
+	for (int i = 0; i < rayCount; ++i)
+	{
+		dtStatus rs = raycast(startRefs[i], &startPos[i*3], &endPos[i*3], filter,
+							  &t[i], &hitNormals[i*3],
+							  path ? &path[i*maxPath] : 0, pathCounts ? &pathCounts[i] : 0,
+							  path ? maxPath : 0);
+		if (rayStatus)
+			rayStatus[i] = rs;
+		details |= rs & DT_STATUS_DETAIL_MASK;
+		if (dtStatusFailed(rs))
+			nfailed++;
+	}
+	
+	// The batch fails only if every ray failed.
+	if (rayCount > 0 && nfailed == rayCount)
+		return DT_FAILURE | details;
+	
+	return DT_SUCCESS | details;
+}
+
 /// @par
 ///
 /// At least one result array must be provided.
@@ -2477,11 +2556,42 @@ dtStatus dtNavMeshQuery::findPolysAroundCircle(dtPolyRef startRef, const float*
 											   const dtQueryFilter* filter,
 											   dtPolyRef* resultRef, dtPolyRef* resultParent, float* resultCost,
 											   int* resultCount, const int maxResult) const
+{
+	return findPolysAroundCircle<dtQueryFilter>(startRef, centerPos, radius, filter,
+												resultRef, resultParent, resultCost, resultCount, maxResult);
+}
+
+/// @par
+///
+/// The order of the result set is from least to highest cost.
+/// 
+/// At least one result array must be provided.
+///
+/// A common use case for this method is to perform Dijkstra searches. 
+/// Candidate polygons are found by searching the graph beginning at the start 
+/// polygon.
+/// 
+/// The same intersection test restrictions that apply to findPolysAroundCircle()
+/// method apply to this method.
+/// 
+/// The 3D centroid of the search polygon is used as the start position for cost 
+/// calculations.
+/// 
+/// Intersection tests occur in 2D. All polygons are projected onto the 
+/// xz-plane. So the y-values of the vertices do not effect intersection tests.
+/// 
+/// If the result arrays are is too small to hold the entire result set, they will 
+/// be filled to capacity.
+///
+dtStatus dtNavMeshQuery::findPolysAroundShape(dtPolyRef startRef, const float* verts, const int nverts,
+											  const dtQueryFilter* filter,
+											  dtPolyRef* resultRef, dtPolyRef* resultParent, float* resultCost,
+											  int* resultCount, const int maxResult) const
 {
 	dtAssert(m_nav);
 	dtAssert(m_nodePool);
 	dtAssert(m_openList);
-
+	
 	*resultCount = 0;
 	
 	// Validate input
@@ -2491,6 +2601,11 @@ dtStatus dtNavMeshQuery::findPolysAroundCircle(dtPolyRef startRef, const float*
 	m_nodePool->clear();
 	m_openList->clear();
 	
+	float centerPos[3] = {0,0,0};
+	for (int i = 0; i < nverts; ++i)
+		dtVadd(centerPos,centerPos,&verts[i*3]);
+	dtVscale(centerPos,centerPos,1.0f/nverts);
+
 	dtNode* startNode = m_nodePool->getNode(startRef);
 	dtVcopy(startNode->pos, centerPos);
 	startNode->pidx = 0;
@@ -2501,7 +2616,7 @@ dtStatus dtNavMeshQuery::findPolysAroundCircle(dtPolyRef startRef, const float*
 	m_openList->push(startNode);
 	
 	dtStatus status = DT_SUCCESS;
-	
+
 	int n = 0;
 	if (n < maxResult)
 	{
@@ -2518,8 +2633,6 @@ dtStatus dtNavMeshQuery::findPolysAroundCircle(dtPolyRef startRef, const float*
 		status |= DT_BUFFER_TOO_SMALL;
 	}
 	
-	const float radiusSqr = dtSqr(radius);
-	
 	while (!m_openList->empty())
 	{
 		dtNode* bestNode = m_openList->pop();
@@ -2554,7 +2667,7 @@ dtStatus dtNavMeshQuery::findPolysAroundCircle(dtPolyRef startRef, const float*
 			const dtMeshTile* neighbourTile = 0;
 			const dtPoly* neighbourPoly = 0;
 			m_nav->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);
-		
+			
 			// Do not advance if the polygon is excluded by the filter.
 			if (!filter->passFilter(neighbourRef, neighbourTile, neighbourPoly))
 				continue;
@@ -2564,10 +2677,12 @@ dtStatus dtNavMeshQuery::findPolysAroundCircle(dtPolyRef startRef, const float*
 			if (!getPortalPoints(bestRef, bestPoly, bestTile, neighbourRef, neighbourPoly, neighbourTile, va, vb))
 				continue;
 			
-			// If the circle is not touching the next polygon, skip it.
-			float tseg;
-			float distSqr = dtDistancePtSegSqr2D(centerPos, va, vb, tseg);
-			if (distSqr > radiusSqr)
+			// If the poly is not touching the edge to the next polygon, skip the connection it.
+			float tmin, tmax;
+			int segMin, segMax;
+			if (!dtIntersectSegmentPoly2D(va, vb, verts, nverts, tmin, tmax, segMin, segMax))
+				continue;
+			if (tmin > 1.0f || tmax < 0.0f)
 				continue;
 			
 			dtNode* neighbourNode = m_nodePool->getNode(neighbourRef);
@@ -2576,7 +2691,7 @@ dtStatus dtNavMeshQuery::findPolysAroundCircle(dtPolyRef startRef, const float*
 				status |= DT_OUT_OF_NODES;
 				continue;
 			}
-				
+			
 			if (neighbourNode->flags & DT_NODE_CLOSED)
 				continue;
 			
@@ -2628,51 +2743,49 @@ dtStatus dtNavMeshQuery::findPolysAroundCircle(dtPolyRef startRef, const float*
 
 /// @par
 ///
-/// The order of the result set is from least to highest cost.
-/// 
-/// At least one result array must be provided.
+/// This is a one-to-many version of findPath(). The search expands from the start 
+/// polygon in order of increasing cost, and stops when all the target polygons 
+/// have been settled, or when the cheapest open node costs more than @p maxCost.
+/// Use it to pick the closest of several destinations with a single search.
 ///
-/// A common use case for this method is to perform Dijkstra searches. 
-/// Candidate polygons are found by searching the graph beginning at the start 
-/// polygon.
-/// 
-/// The same intersection test restrictions that apply to findPolysAroundCircle()
-/// method apply to this method.
-/// 
-/// The 3D centroid of the search polygon is used as the start position for cost 
-/// calculations.
-/// 
-/// Intersection tests occur in 2D. All polygons are projected onto the 
-/// xz-plane. So the y-values of the vertices do not effect intersection tests.
-/// 
-/// If the result arrays are is too small to hold the entire result set, they will 
-/// be filled to capacity.
+/// The costs are calculated using the filter in the same way as findPath(). When
+/// @p targetPos is provided, the cost from the entry point of each target polygon
+/// to its target position is included.
 ///
-dtStatus dtNavMeshQuery::findPolysAroundShape(dtPolyRef startRef, const float* verts, const int nverts,
-											  const dtQueryFilter* filter,
-											  dtPolyRef* resultRef, dtPolyRef* resultParent, float* resultCost,
-											  int* resultCount, const int maxResult) const
+/// The result includes #DT_PARTIAL_RESULT if any of the targets was not reached.
+/// The explored nodes are left in the node pool, so the path to any reached
+/// target can be retrieved using getPathFromDijkstraSearch().
+///
+/// The target list is scanned linearly for each settled polygon, so the method 
+/// is meant for tens of targets rather than thousands.
+///
+dtStatus dtNavMeshQuery::findCostsToTargets(dtPolyRef startRef, const float* startPos,
+											const dtPolyRef* targetRefs, const float* targetPos, const int targetCount,
+											const float maxCost, const dtQueryFilter* filter,
+											float* targetCosts, dtPolyRef* targetParents) const
 {
 	dtAssert(m_nav);
 	dtAssert(m_nodePool);
 	dtAssert(m_openList);
 	
-	*resultCount = 0;
-	
 	// Validate input
 	if (!startRef || !m_nav->isValidPolyRef(startRef))
 		return DT_FAILURE | DT_INVALID_PARAM;
+	if (!startPos || !filter || !targetCosts || (targetCount > 0 && !targetRefs) || targetCount < 0)
+		return DT_FAILURE | DT_INVALID_PARAM;
+	
+	for (int i = 0; i < targetCount; ++i)
+	{
+		targetCosts[i] = FLT_MAX;
+		if (targetParents)
+			targetParents[i] = 0;
+	}
 	
 	m_nodePool->clear();
 	m_openList->clear();
 	
-	float centerPos[3] = {0,0,0};
-	for (int i = 0; i < nverts; ++i)
-		dtVadd(centerPos,centerPos,&verts[i*3]);
-	dtVscale(centerPos,centerPos,1.0f/nverts);
-
 	dtNode* startNode = m_nodePool->getNode(startRef);
-	dtVcopy(startNode->pos, centerPos);
+	dtVcopy(startNode->pos, startPos);
 	startNode->pidx = 0;
 	startNode->cost = 0;
 	startNode->total = 0;
@@ -2681,30 +2794,22 @@ dtStatus dtNavMeshQuery::findPolysAroundShape(dtPolyRef startRef, const float* v
 	m_openList->push(startNode);
 	
 	dtStatus status = DT_SUCCESS;
-
-	int n = 0;
-	if (n < maxResult)
-	{
-		if (resultRef)
-			resultRef[n] = startNode->id;
-		if (resultParent)
-			resultParent[n] = 0;
-		if (resultCost)
-			resultCost[n] = 0;
-		++n;
-	}
-	else
-	{
-		status |= DT_BUFFER_TOO_SMALL;
-	}
+	int remaining = targetCount;
 	
-	while (!m_openList->empty())
+	while (!m_openList->empty() && remaining > 0)
 	{
 		dtNode* bestNode = m_openList->pop();
 		bestNode->flags &= ~DT_NODE_OPEN;
 		bestNode->flags |= DT_NODE_CLOSED;
 		
-		// Get poly and tile.
+		// Everything left in the open list is too expensive.
+		if (bestNode->cost > maxCost)
+		{
+			bestNode->flags &= ~DT_NODE_CLOSED;
+			break;
+		}
+		
+		// Get current poly and tile.
 		// The API input has been cheked already, skip checking internal data.
 		const dtPolyRef bestRef = bestNode->id;
 		const dtMeshTile* bestTile = 0;
@@ -2720,36 +2825,42 @@ dtStatus dtNavMeshQuery::findPolysAroundShape(dtPolyRef startRef, const float* v
 		if (parentRef)
 			m_nav->getTileAndPolyByRefUnsafe(parentRef, &parentTile, &parentPoly);
 		
+		// Settle targets.
+		for (int i = 0; i < targetCount; ++i)
+		{
+			if (targetRefs[i] != bestRef)
+				continue;
+			float cost = bestNode->cost;
+			if (targetPos)
+			{
+				cost += filter->getCost(bestNode->pos, &targetPos[i*3],
+										parentRef, parentTile, parentPoly,
+										bestRef, bestTile, bestPoly,
+										0, 0, 0);
+			}
+			targetCosts[i] = cost;
+			if (targetParents)
+				targetParents[i] = parentRef;
+			remaining--;
+		}
+		
 		for (unsigned int i = bestPoly->firstLink; i != DT_NULL_LINK; i = bestTile->links[i].next)
 		{
-			const dtLink* link = &bestTile->links[i];
-			dtPolyRef neighbourRef = link->ref;
-			// Skip invalid neighbours and do not follow back to parent.
+			dtPolyRef neighbourRef = bestTile->links[i].ref;
+			
+			// Skip invalid ids and do not expand back to where we came from.
 			if (!neighbourRef || neighbourRef == parentRef)
 				continue;
 			
-			// Expand to neighbour
+			// Get neighbour poly and tile.
+			// The API input has been cheked already, skip checking internal data.
 			const dtMeshTile* neighbourTile = 0;
 			const dtPoly* neighbourPoly = 0;
 			m_nav->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);
 			
-			// Do not advance if the polygon is excluded by the filter.
 			if (!filter->passFilter(neighbourRef, neighbourTile, neighbourPoly))
 				continue;
 			
-			// Find edge and calc distance to the edge.
-			float va[3], vb[3];
-			if (!getPortalPoints(bestRef, bestPoly, bestTile, neighbourRef, neighbourPoly, neighbourTile, va, vb))
-				continue;
-			
-			// If the poly is not touching the edge to the next polygon, skip the connection it.
-			float tmin, tmax;
-			int segMin, segMax;
-			if (!dtIntersectSegmentPoly2D(va, vb, verts, nverts, tmin, tmax, segMin, segMax))
-				continue;
-			if (tmin > 1.0f || tmax < 0.0f)
-				continue;
-			
 			dtNode* neighbourNode = m_nodePool->getNode(neighbourRef);
 			if (!neighbourNode)
 			{
@@ -2760,20 +2871,27 @@ dtStatus dtNavMeshQuery::findPolysAroundShape(dtPolyRef startRef, const float* v
 			if (neighbourNode->flags & DT_NODE_CLOSED)
 				continue;
 			
-			// Cost
+			// If the node is visited the first time, calculate node position.
 			if (neighbourNode->flags == 0)
-				dtVlerp(neighbourNode->pos, va, vb, 0.5f);
+			{
+				getEdgeMidPoint(bestRef, bestPoly, bestTile,
+								neighbourRef, neighbourPoly, neighbourTile,
+								neighbourNode->pos);
+			}
 			
-			const float total = bestNode->total + dtVdist(bestNode->pos, neighbourNode->pos);
+			const float cost = bestNode->cost + filter->getCost(bestNode->pos, neighbourNode->pos,
+																 parentRef, parentTile, parentPoly,
+																 bestRef, bestTile, bestPoly,
+																 neighbourRef, neighbourTile, neighbourPoly);
 			
 			// The node is already in open list and the new result is worse, skip.
-			if ((neighbourNode->flags & DT_NODE_OPEN) && total >= neighbourNode->total)
+			if ((neighbourNode->flags & DT_NODE_OPEN) && cost >= neighbourNode->total)
 				continue;
 			
 			neighbourNode->id = neighbourRef;
-			neighbourNode->flags = (neighbourNode->flags & ~DT_NODE_CLOSED);
 			neighbourNode->pidx = m_nodePool->getNodeIdx(bestNode);
-			neighbourNode->total = total;
+			neighbourNode->cost = cost;
+			neighbourNode->total = cost;
 			
 			if (neighbourNode->flags & DT_NODE_OPEN)
 			{
@@ -2781,31 +2899,69 @@ dtStatus dtNavMeshQuery::findPolysAroundShape(dtPolyRef startRef, const float* v
 			}
 			else
 			{
-				if (n < maxResult)
-				{
-					if (resultRef)
-						resultRef[n] = neighbourNode->id;
-					if (resultParent)
-						resultParent[n] = m_nodePool->getNodeAtIdx(neighbourNode->pidx)->id;
-					if (resultCost)
-						resultCost[n] = neighbourNode->total;
-					++n;
-				}
-				else
-				{
-					status |= DT_BUFFER_TOO_SMALL;
-				}
 				neighbourNode->flags = DT_NODE_OPEN;
 				m_openList->push(neighbourNode);
 			}
 		}
 	}
 	
-	*resultCount = n;
+	if (remaining > 0)
+		status |= DT_PARTIAL_RESULT;
 	
 	return status;
 }
 
+/// @par
+///
+/// The path is built from the parent links left in the node pool by the previous
+/// Dijkstra search, e.g. findCostsToTargets() or findPolysAroundCircle().
+///
+/// If the @p path array is too small to hold the full result, it will be filled 
+/// as far as possible from the start polygon toward the end polygon.
+///
+dtStatus dtNavMeshQuery::getPathFromDijkstraSearch(dtPolyRef endRef, dtPolyRef* path, int* pathCount, const int maxPath) const
+{
+	dtAssert(m_nodePool);
+	
+	*pathCount = 0;
+	
+	if (!endRef || !path || maxPath <= 0)
+		return DT_FAILURE | DT_INVALID_PARAM;
+	
+	const dtNode* endNode = m_nodePool->findNode(endRef);
+	if (!endNode || (endNode->flags & DT_NODE_CLOSED) == 0)
+		return DT_FAILURE | DT_INVALID_PARAM;
+	
+	// Find the length of the path.
+	int length = 0;
+	const dtNode* node = endNode;
+	do
+	{
+		length++;
+		node = m_nodePool->getNodeAtIdx(node->pidx);
+	}
+	while (node);
+	
+	// Skip the polygons which do not fit, and write the rest backwards.
+	node = endNode;
+	for (int i = length; i > maxPath; --i)
+		node = m_nodePool->getNodeAtIdx(node->pidx);
+	
+	const int n = dtMin(length, maxPath);
+	for (int i = n-1; i >= 0; --i)
+	{
+		path[i] = node->id;
+		node = m_nodePool->getNodeAtIdx(node->pidx);
+	}
+	
+	*pathCount = n;
+	
+	if (length > maxPath)
+		return DT_SUCCESS | DT_BUFFER_TOO_SMALL;
+	
+	return DT_SUCCESS;
+}
+
 /// @par
 ///
 /// This method is optimized for a small search radius and small number of result 
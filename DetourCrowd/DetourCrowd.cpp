@@ -49,32 +49,201 @@ void dtFreeCrowd(dtCrowd* ptr)
 static const int MAX_ITERS_PER_UPDATE = 100;
 
 static const int MAX_PATHQUEUE_NODES = 4096;
+static const int MAX_PATHQUEUE_REQUESTS = 32;
+static const int MAX_PATHQUEUE_SEARCHES = 4;
 static const int MAX_COMMON_NODES = 512;
+static const int MAX_PATH_RESULT = 256;
+
+/// The number of polygons put to an agent's corridor from a flow field at a time.
+static const int MAX_FLOW_FIELD_PATH = 64;
+
+static const int MAX_BOUNDARY_CACHE_POLYS_PER_AGENT = 4;
+static const int MAX_BOUNDARY_CACHE_SEGS_PER_POLY = 4;
+
+static const int MAX_AVOIDANCE_CIRCLES = 6;
+static const int MAX_AVOIDANCE_SEGMENTS = 8;
+
+/// How many path queue updates a request for a new move target is ahead of a replan.
+static const float NEW_TARGET_PATH_PRIORITY = 4.0f;
+
+/// The work units of the path tasks, the polygons their queries visit at most.
+/// (See: dtPathCorridor::optimizePathVisibility(), dtPathCorridor::optimizePathTopology())
+static const int MAX_OPTIMIZE_VIS_COST = 32;
+static const int OPTIMIZE_TOPO_COST = 32;
+
+/// The number of agents processed by one update job.
+static const int UPDATE_JOB_AGENTS = 32;
+
+/// The number of nodes the search repairing a corridor may visit before the agent replans instead.
+static const int MAX_REPAIR_ITERS = 128;
+
+/// The default maximum number of collision iterations of an update.
+static const int MAX_COLLISION_ITERATIONS = 4;
+
+/// Neighbours closer than this many times the sum of the radii are considered by the collision iterations.
+static const float COLLISION_CONTACT_RANGE = 2.0f;
+
+/// The collisions are resolved when no agent moves more than this fraction of its radius in an iteration.
+static const float COLLISION_TOLERANCE = 0.01f;
+
+/// The batch of the agents not taking part in the collision iterations.
+static const unsigned char NO_COLLISION_BATCH = 0xff;
+
+
+dtCrowdQueryPool* dtAllocCrowdQueryPool()
+{
+	void* mem = dtAlloc(sizeof(dtCrowdQueryPool), DT_ALLOC_PERM);
+	if (!mem) return 0;
+	return new(mem) dtCrowdQueryPool;
+}
+
+void dtFreeCrowdQueryPool(dtCrowdQueryPool* ptr)
+{
+	if (!ptr) return;
+	ptr->~dtCrowdQueryPool();
+	dtFree(ptr);
+}
+
+/**
+@class dtCrowdQueryPool
+
+Crowds sharing a navigation mesh can share their query objects and path queue, see
+dtCrowd::init(const int, const float, dtCrowdQueryPool*). The crowds then use the memory of one
+crowd for the searches and the path queue can run the searches of all crowds within one limit
+of iterations. The proximity grid, the boundary cache and the agents stay with each crowd.
+
+The query objects are used by the crowds in turn, so the crowds sharing a pool must be updated
+one after the other and not at the same time. The path queue is updated by #update() once per
+frame, and each crowd limits the requests of its agents with dtCrowd::setPathQueueQuota() so
+that one crowd can not fill the queue.
+
+@see dtAllocCrowdQueryPool(), dtFreeCrowdQueryPool(), dtCrowd
+*/
+
+dtCrowdQueryPool::dtCrowdQueryPool() :
+	m_nav(0),
+	m_navqueries(0),
+	m_obstacleQueries(0),
+	m_nworkers(0)
+{
+}
+
+dtCrowdQueryPool::~dtCrowdQueryPool()
+{
+	purge();
+}
+
+void dtCrowdQueryPool::purgeWorkers()
+{
+	for (int i = 0; i < m_nworkers; ++i)
+	{
+		dtFreeNavMeshQuery(m_navqueries[i]);
+		dtFreeObstacleAvoidanceQuery(m_obstacleQueries[i]);
+	}
+	dtFree(m_navqueries);
+	m_navqueries = 0;
+	dtFree(m_obstacleQueries);
+	m_obstacleQueries = 0;
+	m_nworkers = 0;
+}
+
+void dtCrowdQueryPool::purge()
+{
+	purgeWorkers();
+	m_nav = 0;
+}
+
+/// @par
+///
+/// The pool has the query objects of one worker until #setJobDispatcher() is called.
+///
+/// May be called more than once to purge and re-initialize the pool, the crowds using the pool
+/// must be initialized again after that.
+bool dtCrowdQueryPool::init(dtNavMesh* nav, const int maxPathRequests, const int maxPathSearches)
+{
+	purge();
+	
+	m_nav = nav;
+	
+	if (!m_pathq.init(MAX_PATH_RESULT, MAX_PATHQUEUE_NODES, nav, maxPathRequests, maxPathSearches))
+		return false;
+	
+	return setJobDispatcher(0);
+}
+
+/// @par
+///
+/// Must be called before the crowds using the pool are initialized, a crowd can use at most
+/// as many workers as the pool has query objects for.
+bool dtCrowdQueryPool::setJobDispatcher(dtCrowdJobDispatcher* dispatcher)
+{
+	dtAssert(m_nav);
+	
+	purgeWorkers();
+	
+	m_pathq.setJobDispatcher(dispatcher);
+	
+	const int nworkers = dispatcher ? dispatcher->getWorkerCount() : 1;
+	m_navqueries = (dtNavMeshQuery**)dtAlloc(sizeof(dtNavMeshQuery*)*nworkers, DT_ALLOC_PERM);
+	if (!m_navqueries)
+		return false;
+	memset(m_navqueries, 0, sizeof(dtNavMeshQuery*)*nworkers);
+	m_obstacleQueries = (dtObstacleAvoidanceQuery**)dtAlloc(sizeof(dtObstacleAvoidanceQuery*)*nworkers, DT_ALLOC_PERM);
+	if (!m_obstacleQueries)
+	{
+		dtFree(m_navqueries);
+		m_navqueries = 0;
+		return false;
+	}
+	memset(m_obstacleQueries, 0, sizeof(dtObstacleAvoidanceQuery*)*nworkers);
+	m_nworkers = nworkers;
+	
+	for (int i = 0; i < m_nworkers; ++i)
+	{
+		m_navqueries[i] = dtAllocNavMeshQuery();
+		if (!m_navqueries[i])
+			return false;
+		if (dtStatusFailed(m_navqueries[i]->init(m_nav, MAX_COMMON_NODES)))
+			return false;
+		m_obstacleQueries[i] = dtAllocObstacleAvoidanceQuery();
+		if (!m_obstacleQueries[i])
+			return false;
+		if (!m_obstacleQueries[i]->init(MAX_AVOIDANCE_CIRCLES, MAX_AVOIDANCE_SEGMENTS))
+			return false;
+	}
+	
+	return true;
+}
+
+void dtCrowdQueryPool::update(const int maxIters)
+{
+	m_pathq.update(maxIters);
+}
 
 inline float tween(const float t, const float t0, const float t1)
 {
 	return dtClamp((t-t0) / (t1-t0), 0.0f, 1.0f);
 }
 
-static void integrate(dtCrowdAgent* ag, const float dt)
+static void integrate(float* npos, float* vel, const float* nvel, const float maxAcceleration, const float dt)
 {
 	// Fake dynamic constraint.
-	const float maxDelta = ag->params.maxAcceleration * dt;
+	const float maxDelta = maxAcceleration * dt;
 	float dv[3];
-	dtVsub(dv, ag->nvel, ag->vel);
+	dtVsub(dv, nvel, vel);
 	float ds = dtVlen(dv);
 	if (ds > maxDelta)
 		dtVscale(dv, dv, maxDelta/ds);
-	dtVadd(ag->vel, ag->vel, dv);
+	dtVadd(vel, vel, dv);
 	
 	// Integrate
-	if (dtVlen(ag->vel) > 0.0001f)
-		dtVmad(ag->npos, ag->npos, ag->vel, dt);
+	if (dtVlen(vel) > 0.0001f)
+		dtVmad(npos, npos, vel, dt);
 	else
-		dtVset(ag->vel,0,0,0);
+		dtVset(vel,0,0,0);
 }
 
-static bool overOffmeshConnection(const dtCrowdAgent* ag, const float radius)
+static bool overOffmeshConnection(const dtCrowdAgent* ag, const float* npos, const float radius)
 {
 	if (!ag->ncorners)
 		return false;
@@ -82,7 +251,7 @@ static bool overOffmeshConnection(const dtCrowdAgent* ag, const float radius)
 	const bool offMeshConnection = (ag->cornerFlags[ag->ncorners-1] & DT_STRAIGHTPATH_OFFMESH_CONNECTION) ? true : false;
 	if (offMeshConnection)
 	{
-		const float distSq = dtVdist2DSqr(ag->npos, &ag->cornerVerts[(ag->ncorners-1)*3]);
+		const float distSq = dtVdist2DSqr(npos, &ag->cornerVerts[(ag->ncorners-1)*3]);
 		if (distSq < radius*radius)
 			return true;
 	}
@@ -90,19 +259,19 @@ static bool overOffmeshConnection(const dtCrowdAgent* ag, const float radius)
 	return false;
 }
 
-static float getDistanceToGoal(const dtCrowdAgent* ag, const float range)
+static float getDistanceToGoal(const dtCrowdAgent* ag, const float* npos, const float range)
 {
 	if (!ag->ncorners)
 		return range;
 	
 	const bool endOfPath = (ag->cornerFlags[ag->ncorners-1] & DT_STRAIGHTPATH_END) ? true : false;
 	if (endOfPath)
-		return dtMin(dtVdist2D(ag->npos, &ag->cornerVerts[(ag->ncorners-1)*3]), range);
+		return dtMin(dtVdist2D(npos, &ag->cornerVerts[(ag->ncorners-1)*3]), range);
 	
 	return range;
 }
 
-static void calcSmoothSteerDirection(const dtCrowdAgent* ag, float* dir)
+static void calcSmoothSteerDirection(const dtCrowdAgent* ag, const float* npos, float* dir)
 {
 	if (!ag->ncorners)
 	{
@@ -116,8 +285,8 @@ static void calcSmoothSteerDirection(const dtCrowdAgent* ag, float* dir)
 	const float* p1 = &ag->cornerVerts[ip1*3];
 	
 	float dir0[3], dir1[3];
-	dtVsub(dir0, p0, ag->npos);
-	dtVsub(dir1, p1, ag->npos);
+	dtVsub(dir0, p0, npos);
+	dtVsub(dir1, p1, npos);
 	dir0[1] = 0;
 	dir1[1] = 0;
 	
@@ -133,136 +302,79 @@ static void calcSmoothSteerDirection(const dtCrowdAgent* ag, float* dir)
 	dtVnormalize(dir);
 }
 
-static void calcStraightSteerDirection(const dtCrowdAgent* ag, float* dir)
+static void calcStraightSteerDirection(const dtCrowdAgent* ag, const float* npos, float* dir)
 {
 	if (!ag->ncorners)
 	{
 		dtVset(dir, 0,0,0);
 		return;
 	}
-	dtVsub(dir, &ag->cornerVerts[0], ag->npos);
+	dtVsub(dir, &ag->cornerVerts[0], npos);
 	dir[1] = 0;
 	dtVnormalize(dir);
 }
 
-static int addNeighbour(const int idx, const float dist,
-						dtCrowdNeighbour* neis, const int nneis, const int maxNeis)
+/// The agents a neighbour query can return.
+struct NeighbourFilter
 {
-	// Insert neighbour based on the distance.
-	dtCrowdNeighbour* nei = 0;
-	if (!nneis)
-	{
-		nei = &neis[nneis];
-	}
-	else if (dist >= neis[nneis-1].dist)
-	{
-		if (nneis >= maxNeis)
-			return nneis;
-		nei = &neis[nneis];
-	}
-	else
-	{
-		int i;
-		for (i = 0; i < nneis; ++i)
-			if (dist <= neis[i].dist)
-				break;
-		
-		const int tgt = i+1;
-		const int n = dtMin(nneis-i, maxNeis-tgt);
-		
-		dtAssert(tgt+n <= maxNeis);
-		
-		if (n > 0)
-			memmove(&neis[tgt], &neis[i], sizeof(dtCrowdNeighbour)*n);
-		nei = &neis[i];
-	}
-	
-	memset(nei, 0, sizeof(dtCrowdNeighbour));
-	
-	nei->idx = idx;
-	nei->dist = dist;
+	float pos[3];
+	float height;
+	int skip;
+	dtCrowdAgent* const* agentChunks;
+	const float* agentPos;
+};
+
+static bool passNeighbourFilter(void* data, const unsigned short id)
+{
+	const NeighbourFilter* filter = (const NeighbourFilter*)data;
+	const int idx = (int)id;
+	if (idx == filter->skip)
+		return false;
 	
-	return dtMin(nneis+1, maxNeis);
+	// Check for overlap.
+	const dtCrowdAgent* other = &filter->agentChunks[idx >> DT_CROWD_AGENT_CHUNK_BITS][idx & ((1 << DT_CROWD_AGENT_CHUNK_BITS) - 1)];
+	return fabsf(filter->pos[1] - filter->agentPos[idx*3+1]) < (filter->height+other->params.height)/2.0f;
 }
 
 static int getNeighbours(const float* pos, const float height, const float range,
-						 const dtCrowdAgent* skip, dtCrowdNeighbour* result, const int maxResult,
-						 dtCrowdAgent** agents, const int /*nagents*/, dtProximityGrid* grid)
+						 const int skip, dtCrowdNeighbour* result, const int maxResult,
+						 dtCrowdAgent* const* agentChunks, const float* agentPos, const dtProximityGrid* grid)
 {
-	int n = 0;
-	
-	static const int MAX_NEIS = 32;
-	unsigned short ids[MAX_NEIS];
-	int nids = grid->queryItems(pos[0]-range, pos[2]-range,
-								pos[0]+range, pos[2]+range,
-								ids, MAX_NEIS);
-	
-	for (int i = 0; i < nids; ++i)
+	NeighbourFilter filter;
+	dtVcopy(filter.pos, pos);
+	filter.height = height;
+	filter.skip = skip;
+	filter.agentChunks = agentChunks;
+	filter.agentPos = agentPos;
+	
+	// The grid returns the nearest agents within range which pass the filter, nearest first.
+	unsigned short ids[DT_CROWDAGENT_MAX_NEIGHBOURS];
+	float dists[DT_CROWDAGENT_MAX_NEIGHBOURS];
+	const int n = grid->queryNearestItems(pos[0], pos[2], range, ids, dists,
+										  dtMin(maxResult, DT_CROWDAGENT_MAX_NEIGHBOURS),
+										  passNeighbourFilter, &filter);
+	
+	for (int i = 0; i < n; ++i)
 	{
-		const dtCrowdAgent* ag = agents[ids[i]];
-		
-		if (ag == skip) continue;
-		
-		// Check for overlap.
-		float diff[3];
-		dtVsub(diff, pos, ag->npos);
-		if (fabsf(diff[1]) >= (height+ag->params.height)/2.0f)
-			continue;
-		diff[1] = 0;
-		const float distSqr = dtVlenSqr(diff);
-		if (distSqr > dtSqr(range))
-			continue;
-		
-		n = addNeighbour(ids[i], distSqr, result, n, maxResult);
+		dtCrowdNeighbour* nei = &result[i];
+		memset(nei, 0, sizeof(dtCrowdNeighbour));
+		nei->idx = (int)ids[i];
+		nei->dist = dists[i];
 	}
 	return n;
 }
 
-static int addToOptQueue(dtCrowdAgent* newag, dtCrowdAgent** agents, const int nagents, const int maxAgents)
-{
-	// Insert neighbour based on greatest time.
-	int slot = 0;
-	if (!nagents)
-	{
-		slot = nagents;
-	}
-	else if (newag->topologyOptTime <= agents[nagents-1]->topologyOptTime)
-	{
-		if (nagents >= maxAgents)
-			return nagents;
-		slot = nagents;
-	}
-	else
-	{
-		int i;
-		for (i = 0; i < nagents; ++i)
-			if (newag->topologyOptTime >= agents[i]->topologyOptTime)
-				break;
-		
-		const int tgt = i+1;
-		const int n = dtMin(nagents-i, maxAgents-tgt);
-		
-		dtAssert(tgt+n <= maxAgents);
-		
-		if (n > 0)
-			memmove(&agents[tgt], &agents[i], sizeof(dtCrowdAgent*)*n);
-		slot = i;
-	}
-	
-	agents[slot] = newag;
-	
-	return dtMin(nagents+1, maxAgents);
-}
-
-static int addToPathQueue(dtCrowdAgent* newag, dtCrowdAgent** agents, const int nagents, const int maxAgents)
+/// Inserts @p newag into @p agents, sorted by the greatest value of the time @p key.
+/// The agent is dropped if the queue is full and its time is not greater than the last one.
+static int addToQueue(dtCrowdAgent* newag, float dtCrowdAgent::*key, dtCrowdAgent** agents, const int nagents, const int maxAgents)
 {
-	// Insert neighbour based on greatest time.
+	// Insert agent based on greatest time.
 	int slot = 0;
 	if (!nagents)
 	{
 		slot = nagents;
 	}
-	else if (newag->targetReplanTime <= agents[nagents-1]->targetReplanTime)
+	else if (newag->*key <= agents[nagents-1]->*key)
 	{
 		if (nagents >= maxAgents)
 			return nagents;
@@ -272,7 +384,7 @@ static int addToPathQueue(dtCrowdAgent* newag, dtCrowdAgent** agents, const int
 	{
 		int i;
 		for (i = 0; i < nagents; ++i)
-			if (newag->targetReplanTime >= agents[i]->targetReplanTime)
+			if (newag->*key >= agents[i]->*key)
 				break;
 		
 		const int tgt = i+1;
@@ -331,17 +443,50 @@ Notes:
 
 dtCrowd::dtCrowd() :
 	m_maxAgents(0),
-	m_agents(0),
+	m_agentChunks(0),
+	m_nagentChunks(0),
 	m_activeAgents(0),
+	m_nactiveAgents(0),
+	m_activeSlots(0),
+	m_freeAgents(0),
+	m_nfreeAgents(0),
+	m_updateAgents(0),
+	m_nupdateAgents(0),
+	m_lodQueue(0),
+	m_lodInterval(0),
+	m_lodBudget(0),
 	m_agentAnims(0),
+	m_agentPos(0),
+	m_agentVel(0),
+	m_agentDvel(0),
+	m_agentNvel(0),
+	m_agentDisp(0),
+	m_agentContacts(0),
+	m_agentBatch(0),
+	m_agentBatchMask(0),
+	m_agentMoved(0),
+	m_agentRadius(0),
+	m_agentState(0),
+	m_pathQueue(&m_pathq),
+	m_pathQueueQuota(MAX_PATHQUEUE_REQUESTS),
+	m_pool(0),
 	m_obstacleQuery(0),
 	m_grid(0),
 	m_pathResult(0),
 	m_maxPathResult(0),
 	m_maxAgentRadius(0),
 	m_velocitySampleCount(0),
-	m_navquery(0)
+	m_collisionAgents(0),
+	m_collisionIterations(MAX_COLLISION_ITERATIONS),
+	m_clock(0),
+	m_navquery(0),
+	m_dispatcher(0),
+	m_workers(0),
+	m_nworkers(0),
+	m_deterministic(false)
 {
+	memset(m_collisionBatches, 0, sizeof(m_collisionBatches));
+	memset(&m_stats, 0, sizeof(m_stats));
 }
 
 dtCrowd::~dtCrowd()
@@ -351,54 +496,131 @@ dtCrowd::~dtCrowd()
 
 void dtCrowd::purge()
 {
-	for (int i = 0; i < m_maxAgents; ++i)
-		m_agents[i].~dtCrowdAgent();
-	dtFree(m_agents);
-	m_agents = 0;
+	// The requests in the shared path queue of a pool point to the filter of the crowd.
+	if (m_pool)
+		m_pathQueue->cancelRequests(&m_filter);
+	
+	purgeWorkers();
+	
+	const int chunkSize = 1 << DT_CROWD_AGENT_CHUNK_BITS;
+	for (int i = 0; i < m_nagentChunks; ++i)
+	{
+		for (int j = 0; j < chunkSize; ++j)
+			m_agentChunks[i][j].~dtCrowdAgent();
+		dtFree(m_agentChunks[i]);
+	}
+	dtFree(m_agentChunks);
+	m_agentChunks = 0;
+	m_nagentChunks = 0;
 	m_maxAgents = 0;
 	
 	dtFree(m_activeAgents);
 	m_activeAgents = 0;
+	m_nactiveAgents = 0;
+	dtFree(m_activeSlots);
+	m_activeSlots = 0;
+	dtFree(m_freeAgents);
+	m_freeAgents = 0;
+	m_nfreeAgents = 0;
+	dtFree(m_updateAgents);
+	m_updateAgents = 0;
+	m_nupdateAgents = 0;
+	dtFree(m_lodQueue);
+	m_lodQueue = 0;
 
 	dtFree(m_agentAnims);
 	m_agentAnims = 0;
 	
+	dtFree(m_agentPos);
+	m_agentPos = 0;
+	dtFree(m_agentVel);
+	m_agentVel = 0;
+	dtFree(m_agentDvel);
+	m_agentDvel = 0;
+	dtFree(m_agentNvel);
+	m_agentNvel = 0;
+	dtFree(m_agentDisp);
+	m_agentDisp = 0;
+	dtFree(m_agentContacts);
+	m_agentContacts = 0;
+	dtFree(m_agentBatch);
+	m_agentBatch = 0;
+	dtFree(m_agentBatchMask);
+	m_agentBatchMask = 0;
+	dtFree(m_agentMoved);
+	m_agentMoved = 0;
+	dtFree(m_agentRadius);
+	m_agentRadius = 0;
+	dtFree(m_agentState);
+	m_agentState = 0;
+	dtFree(m_collisionAgents);
+	m_collisionAgents = 0;
+	
 	dtFree(m_pathResult);
 	m_pathResult = 0;
 	
 	dtFreeProximityGrid(m_grid);
 	m_grid = 0;
 
-	dtFreeObstacleAvoidanceQuery(m_obstacleQuery);
+	// The query objects of a pool are owned by the pool.
+	if (!m_pool)
+	{
+		dtFreeObstacleAvoidanceQuery(m_obstacleQuery);
+		dtFreeNavMeshQuery(m_navquery);
+	}
 	m_obstacleQuery = 0;
-	
-	dtFreeNavMeshQuery(m_navquery);
 	m_navquery = 0;
+	
+	m_pool = 0;
+	m_pathQueue = &m_pathq;
 }
 
 /// @par
 ///
 /// May be called more than once to purge and re-initialize the crowd.
 bool dtCrowd::init(const int maxAgents, const float maxAgentRadius, dtNavMesh* nav)
+{
+	return initCrowd(maxAgents, maxAgentRadius, nav, 0);
+}
+
+/// @par
+///
+/// The crowd uses the query objects and the path queue of the pool instead of allocating its own.
+/// The path queue is updated by dtCrowdQueryPool::update() instead of #update(), so the path
+/// results of a request are processed on the next update after the pool's update. The path share
+/// distance is a setting of the shared path queue, see dtCrowdQueryPool::setPathShareDistance().
+/// The pending path requests of the crowd are removed from the shared queue when the crowd is
+/// purged or initialized again.
+///
+/// May be called more than once to purge and re-initialize the crowd.
+bool dtCrowd::init(const int maxAgents, const float maxAgentRadius, dtCrowdQueryPool* pool)
+{
+	dtAssert(pool);
+	return initCrowd(maxAgents, maxAgentRadius, pool->getNavMesh(), pool);
+}
+
+bool dtCrowd::initCrowd(const int maxAgents, const float maxAgentRadius, dtNavMesh* nav, dtCrowdQueryPool* pool)
 {
 	purge();
 	
-	m_maxAgents = maxAgents;
 	m_maxAgentRadius = maxAgentRadius;
 
 	dtVset(m_ext, m_maxAgentRadius*2.0f,m_maxAgentRadius*1.5f,m_maxAgentRadius*2.0f);
 	
-	m_grid = dtAllocProximityGrid();
-	if (!m_grid)
-		return false;
-	if (!m_grid->init(m_maxAgents*4, maxAgentRadius*3))
-		return false;
-	
-	m_obstacleQuery = dtAllocObstacleAvoidanceQuery();
-	if (!m_obstacleQuery)
-		return false;
-	if (!m_obstacleQuery->init(6, 8))
-		return false;
+	if (pool)
+	{
+		m_pool = pool;
+		m_obstacleQuery = m_pool->getObstacleAvoidanceQuery(0);
+	}
+	else
+	{
+		m_obstacleQuery = dtAllocObstacleAvoidanceQuery();
+		if (!m_obstacleQuery)
+			return false;
+		if (!m_obstacleQuery->init(MAX_AVOIDANCE_CIRCLES, MAX_AVOIDANCE_SEGMENTS))
+			return false;
+	}
+	m_obstacleQuery->setDeterministic(m_deterministic);
 
 	// Init obstacle query params.
 	memset(m_obstacleQueryParams, 0, sizeof(m_obstacleQueryParams));
@@ -415,134 +637,948 @@ bool dtCrowd::init(const int maxAgents, const float maxAgentRadius, dtNavMesh* n
 		params->adaptiveDivs = 7;
 		params->adaptiveRings = 2;
 		params->adaptiveDepth = 5;
+		params->method = DT_OBSTACLE_AVOIDANCE_SAMPLED;
 	}
 	
 	// Allocate temp buffer for merging paths.
-	m_maxPathResult = 256;
+	m_maxPathResult = MAX_PATH_RESULT;
 	m_pathResult = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef)*m_maxPathResult, DT_ALLOC_PERM);
 	if (!m_pathResult)
 		return false;
 	
-	if (!m_pathq.init(m_maxPathResult, MAX_PATHQUEUE_NODES, nav))
-		return false;
+	if (m_pool)
+	{
+		m_pathQueue = m_pool->getPathQueue();
+	}
+	else
+	{
+		if (!m_pathq.init(m_maxPathResult, MAX_PATHQUEUE_NODES, nav, MAX_PATHQUEUE_REQUESTS, MAX_PATHQUEUE_SEARCHES))
+			return false;
+		m_pathq.setShareDistance(m_maxAgentRadius);
+	}
+	m_pathQueueQuota = m_pathQueue->getMaxRequests();
 	
-	m_agents = (dtCrowdAgent*)dtAlloc(sizeof(dtCrowdAgent)*m_maxAgents, DT_ALLOC_PERM);
-	if (!m_agents)
+	// Allocate the agents and the per agent data.
+	m_nactiveAgents = 0;
+	m_nfreeAgents = 0;
+	if (!growAgents(maxAgents))
 		return false;
 	
-	m_activeAgents = (dtCrowdAgent**)dtAlloc(sizeof(dtCrowdAgent*)*m_maxAgents, DT_ALLOC_PERM);
-	if (!m_activeAgents)
-		return false;
-
-	m_agentAnims = (dtCrowdAgentAnimation*)dtAlloc(sizeof(dtCrowdAgentAnimation)*m_maxAgents, DT_ALLOC_PERM);
-	if (!m_agentAnims)
-		return false;
+	m_lodInterval = 0.25f;
+	m_lodBudget = m_maxAgents;
 	
-	for (int i = 0; i < m_maxAgents; ++i)
+	memset(&m_pathSchedule, 0, sizeof(m_pathSchedule));
+	m_pathSchedule.budget = 6144;
+	m_pathSchedule.budgetShare[DT_CROWD_PATH_CHECK_VALIDITY] = 0.45f;
+	m_pathSchedule.budgetShare[DT_CROWD_PATH_OPTIMIZE_VIS] = 0.45f;
+	m_pathSchedule.budgetShare[DT_CROWD_PATH_OPTIMIZE_TOPO] = 0.1f;
+	m_pathSchedule.minInterval[DT_CROWD_PATH_OPTIMIZE_TOPO] = 0.5f;
+	m_pathSchedule.validityLookahead = 10;
+	memset(m_pathTaskStats, 0, sizeof(m_pathTaskStats));
+	memset(m_pathTaskCursor, 0, sizeof(m_pathTaskCursor));
+
+	if (m_pool)
 	{
-		new(&m_agents[i]) dtCrowdAgent();
-		m_agents[i].active = 0;
-		if (!m_agents[i].corridor.init(m_maxPathResult))
-			return false;
+		m_navquery = m_pool->getNavMeshQuery(0);
 	}
-
-	for (int i = 0; i < m_maxAgents; ++i)
+	else
 	{
-		m_agentAnims[i].active = 0;
+		// The navquery is mostly used for local searches, no need for large node pool.
+		m_navquery = dtAllocNavMeshQuery();
+		if (!m_navquery)
+			return false;
+		if (dtStatusFailed(m_navquery->init(nav, MAX_COMMON_NODES)))
+			return false;
 	}
-
-	// The navquery is mostly used for local searches, no need for large node pool.
-	m_navquery = dtAllocNavMeshQuery();
-	if (!m_navquery)
-		return false;
-	if (dtStatusFailed(m_navquery->init(nav, MAX_COMMON_NODES)))
+	
+	if (!initWorkers(m_dispatcher ? m_dispatcher->getWorkerCount() : 1))
 		return false;
 	
 	return true;
 }
 
-void dtCrowd::setObstacleAvoidanceParams(const int idx, const dtObstacleAvoidanceParams* params)
-{
-	if (idx >= 0 && idx < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS)
-		memcpy(&m_obstacleQueryParams[idx], params, sizeof(dtObstacleAvoidanceParams));
-}
-
-const dtObstacleAvoidanceParams* dtCrowd::getObstacleAvoidanceParams(const int idx) const
-{
-	if (idx >= 0 && idx < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS)
-		return &m_obstacleQueryParams[idx];
-	return 0;
-}
-
-const int dtCrowd::getAgentCount() const
-{
-	return m_maxAgents;
-}
-
-/// @par
-/// 
-/// Agents in the pool may not be in use.  Check #dtCrowdAgent.active before using the returned object.
-const dtCrowdAgent* dtCrowd::getAgent(const int idx)
+/// Destroys the agents of a chunk and frees it.
+static void freeAgentChunk(dtCrowdAgent* chunk)
 {
-	return &m_agents[idx];
+	const int chunkSize = 1 << DT_CROWD_AGENT_CHUNK_BITS;
+	for (int i = 0; i < chunkSize; ++i)
+		chunk[i].~dtCrowdAgent();
+	dtFree(chunk);
 }
 
-void dtCrowd::updateAgentParameters(const int idx, const dtCrowdAgentParams* params)
+/// Allocates a chunk of inactive agents starting at index @p base.
+/// Returns null if an allocation fails.
+static dtCrowdAgent* allocAgentChunk(const int base, const int maxPath)
 {
-	if (idx < 0 || idx > m_maxAgents)
-		return;
-	memcpy(&m_agents[idx].params, params, sizeof(dtCrowdAgentParams));
+	const int chunkSize = 1 << DT_CROWD_AGENT_CHUNK_BITS;
+	dtCrowdAgent* chunk = (dtCrowdAgent*)dtAlloc(sizeof(dtCrowdAgent)*chunkSize, DT_ALLOC_PERM);
+	if (!chunk)
+		return 0;
+	for (int i = 0; i < chunkSize; ++i)
+	{
+		new(&chunk[i]) dtCrowdAgent();
+		chunk[i].active = 0;
+		chunk[i].idx = base + i;
+	}
+	// The corridors allocate their path buffers as the paths grow.
+	for (int i = 0; i < chunkSize; ++i)
+	{
+		if (!chunk[i].corridor.init(maxPath))
+		{
+			freeAgentChunk(chunk);
+			return 0;
+		}
+	}
+	return chunk;
 }
 
 /// @par
 ///
-/// The agent's position will be constrained to the surface of the navigation mesh.
-int dtCrowd::addAgent(const float* pos, const dtCrowdAgentParams* params)
+/// The agents are allocated in chunks so that they do not move when the crowd grows, the arrays
+/// indexed by the agent index are reallocated. The new agents are handed out after the free agents
+/// which already exist, lowest index first. Everything is allocated before the crowd is changed,
+/// so the crowd keeps its agents and size if an allocation fails.
+bool dtCrowd::growAgents(const int maxAgents)
 {
-	// Find empty slot.
-	int idx = -1;
-	for (int i = 0; i < m_maxAgents; ++i)
+	const int chunkSize = 1 << DT_CROWD_AGENT_CHUNK_BITS;
+	const int nchunks = (dtMin(maxAgents, DT_CROWD_MAX_AGENTS) + chunkSize-1) >> DT_CROWD_AGENT_CHUNK_BITS;
+	const int oldMax = m_maxAgents;
+	const int newMax = nchunks << DT_CROWD_AGENT_CHUNK_BITS;
+	if (newMax <= oldMax)
+		return maxAgents <= oldMax;
+	dtAssert(m_nagentChunks << DT_CROWD_AGENT_CHUNK_BITS == oldMax);
+	
+	// The arrays indexed by the agent index, in the order in which they are assigned below.
+	void* const oldBufs[] =
+	{
+		m_activeAgents, m_activeSlots, m_freeAgents, m_updateAgents, m_lodQueue, m_agentAnims,
+		m_agentPos, m_agentVel, m_agentDvel, m_agentNvel, m_agentDisp,
+		m_agentContacts, m_agentBatch, m_agentBatchMask, m_agentMoved, m_agentRadius, m_agentState,
+		m_collisionAgents,
+	};
+	const int elemSizes[] =
 	{
-		if (!m_agents[i].active)
+		sizeof(dtCrowdAgent*), sizeof(int), sizeof(int), sizeof(dtCrowdAgent*), sizeof(dtCrowdAgent*), sizeof(dtCrowdAgentAnimation),
+		sizeof(float)*3, sizeof(float)*3, sizeof(float)*3, sizeof(float)*3, sizeof(float)*3,
+		sizeof(unsigned char), sizeof(unsigned char), sizeof(unsigned int), sizeof(int), sizeof(float), sizeof(unsigned char),
+		sizeof(dtCrowdAgent*),
+	};
+	static const int NBUFS = sizeof(elemSizes) / sizeof(elemSizes[0]);
+	
+	void* bufs[NBUFS];
+	memset(bufs, 0, sizeof(bufs));
+	dtCrowdAgent** chunks = 0;
+	dtProximityGrid* grid = 0;
+	bool ok = true;
+	
+	for (int i = 0; i < NBUFS && ok; ++i)
+	{
+		bufs[i] = dtAlloc(elemSizes[i]*newMax, DT_ALLOC_PERM);
+		ok = bufs[i] != 0;
+	}
+	
+	int nnewChunks = 0;
+	if (ok)
+	{
+		chunks = (dtCrowdAgent**)dtAlloc(sizeof(dtCrowdAgent*)*nchunks, DT_ALLOC_PERM);
+		ok = chunks != 0;
+	}
+	if (ok)
+	{
+		if (m_nagentChunks)
+			memcpy(chunks, m_agentChunks, sizeof(dtCrowdAgent*)*m_nagentChunks);
+		for (int i = m_nagentChunks; i < nchunks && ok; ++i)
 		{
-			idx = i;
-			break;
+			chunks[i] = allocAgentChunk(i << DT_CROWD_AGENT_CHUNK_BITS, m_maxPathResult);
+			ok = chunks[i] != 0;
+			if (ok)
+				nnewChunks++;
 		}
 	}
-	if (idx == -1)
-		return -1;
 	
-	dtCrowdAgent* ag = &m_agents[idx];
-
-	// Find nearest position on navmesh and place the agent there.
-	float nearest[3];
-	dtPolyRef ref;
-	m_navquery->findNearestPoly(pos, m_ext, &m_filter, &ref, nearest);
+	// The grid and the boundary cache are rebuilt every update. The cache keeps its buffers
+	// if it cannot be initialized, so it is initialized last.
+	if (ok)
+	{
+		grid = dtAllocProximityGrid();
+		ok = grid && grid->init(newMax, m_maxAgentRadius*3);
+	}
+	if (ok)
+	{
+		const int maxCachePolys = newMax*MAX_BOUNDARY_CACHE_POLYS_PER_AGENT;
+		ok = m_boundaryCache.init(maxCachePolys, maxCachePolys*MAX_BOUNDARY_CACHE_SEGS_PER_POLY);
+	}
 	
-	ag->corridor.reset(ref, nearest);
-	ag->boundary.reset();
-
-	updateAgentParameters(idx, params);
+	if (!ok)
+	{
+		for (int i = 0; i < nnewChunks; ++i)
+			freeAgentChunk(chunks[m_nagentChunks+i]);
+		dtFree(chunks);
+		for (int i = 0; i < NBUFS; ++i)
+			dtFree(bufs[i]);
+		dtFreeProximityGrid(grid);
+		return false;
+	}
 	
-	ag->topologyOptTime = 0;
-	ag->targetReplanTime = 0;
-	ag->nneis = 0;
+	// Everything is allocated, nothing below can fail.
+	for (int i = 0; i < NBUFS; ++i)
+	{
+		if (oldMax)
+			memcpy(bufs[i], oldBufs[i], elemSizes[i]*oldMax);
+		memset((unsigned char*)bufs[i] + elemSizes[i]*oldMax, 0, elemSizes[i]*(newMax-oldMax));
+		dtFree(oldBufs[i]);
+	}
+	int n = 0;
+	m_activeAgents = (dtCrowdAgent**)bufs[n++];
+	m_activeSlots = (int*)bufs[n++];
+	m_freeAgents = (int*)bufs[n++];
+	m_updateAgents = (dtCrowdAgent**)bufs[n++];
+	m_lodQueue = (dtCrowdAgent**)bufs[n++];
+	m_agentAnims = (dtCrowdAgentAnimation*)bufs[n++];
+	m_agentPos = (float*)bufs[n++];
+	m_agentVel = (float*)bufs[n++];
+	m_agentDvel = (float*)bufs[n++];
+	m_agentNvel = (float*)bufs[n++];
+	m_agentDisp = (float*)bufs[n++];
+	m_agentContacts = (unsigned char*)bufs[n++];
+	m_agentBatch = (unsigned char*)bufs[n++];
+	m_agentBatchMask = (unsigned int*)bufs[n++];
+	m_agentMoved = (int*)bufs[n++];
+	m_agentRadius = (float*)bufs[n++];
+	m_agentState = (unsigned char*)bufs[n++];
+	m_collisionAgents = (dtCrowdAgent**)bufs[n++];
+	dtAssert(n == NBUFS);
+	
+	dtFree(m_agentChunks);
+	m_agentChunks = chunks;
+	m_nagentChunks = nchunks;
 	
-	dtVset(ag->dvel, 0,0,0);
-	dtVset(ag->nvel, 0,0,0);
-	dtVset(ag->vel, 0,0,0);
-	dtVcopy(ag->npos, nearest);
+	dtFreeProximityGrid(m_grid);
+	m_grid = grid;
 	
-	ag->desiredSpeed = 0;
-
+	// Free agents are popped from the top of the stack, put the new agents below the old free agents.
+	const int nnew = newMax - oldMax;
+	memmove(m_freeAgents + nnew, m_freeAgents, sizeof(int)*m_nfreeAgents);
+	for (int i = 0; i < nnew; ++i)
+	{
+		m_activeSlots[oldMax+i] = -1;
+		m_agentBatch[oldMax+i] = NO_COLLISION_BATCH;
+		m_agentMoved[oldMax+i] = -1;
+		m_freeAgents[i] = newMax-1 - i;
+	}
+	m_nfreeAgents += nnew;
+	
+	if (m_lodBudget == oldMax)
+		m_lodBudget = newMax;
+	
+	m_maxAgents = newMax;
+	
+	return true;
+}
+
+void dtCrowd::purgeWorkers()
+{
+	// The first worker uses the crowd's own query objects.
+	for (int i = 1; i < m_nworkers && !m_pool; ++i)
+	{
+		dtFreeNavMeshQuery(m_workers[i].navquery);
+		dtFreeObstacleAvoidanceQuery(m_workers[i].obstacleQuery);
+	}
+	dtFree(m_workers);
+	m_workers = 0;
+	m_nworkers = 0;
+}
+
+bool dtCrowd::initWorkers(const int nworkers)
+{
+	dtAssert(nworkers >= 1);
+	dtAssert(m_navquery);
+	dtAssert(m_obstacleQuery);
+	
+	purgeWorkers();
+	
+	if (m_pool && nworkers > m_pool->getWorkerCount())
+		return false;
+	
+	m_workers = (Worker*)dtAlloc(sizeof(Worker)*nworkers, DT_ALLOC_PERM);
+	if (!m_workers)
+		return false;
+	memset(m_workers, 0, sizeof(Worker)*nworkers);
+	m_nworkers = nworkers;
+	
+	m_workers[0].navquery = m_navquery;
+	m_workers[0].obstacleQuery = m_obstacleQuery;
+	
+	for (int i = 1; i < m_nworkers; ++i)
+	{
+		Worker& worker = m_workers[i];
+		if (m_pool)
+		{
+			worker.navquery = m_pool->getNavMeshQuery(i);
+			worker.obstacleQuery = m_pool->getObstacleAvoidanceQuery(i);
+			worker.obstacleQuery->setDeterministic(m_deterministic);
+			continue;
+		}
+		worker.navquery = dtAllocNavMeshQuery();
+		worker.obstacleQuery = dtAllocObstacleAvoidanceQuery();
+		if (!worker.navquery || dtStatusFailed(worker.navquery->init(m_navquery->getAttachedNavMesh(), MAX_COMMON_NODES)) ||
+			!worker.obstacleQuery || !worker.obstacleQuery->init(MAX_AVOIDANCE_CIRCLES, MAX_AVOIDANCE_SEGMENTS))
+		{
+			// Do not leave workers without query objects behind.
+			purgeWorkers();
+			return false;
+		}
+		worker.obstacleQuery->setDeterministic(m_deterministic);
+	}
+	
+	return true;
+}
+
+/// @par
+///
+/// Every worker of the dispatcher gets its own navigation mesh and obstacle avoidance query, so the
+/// worker count must not change while the dispatcher is in use. The results of #update() are the same
+/// with or without a dispatcher, and do not depend on the number of workers. The dispatcher is also
+/// used by the path queue to run its searches in parallel.
+///
+/// A crowd using a query pool can have at most as many workers as the pool, and its path
+/// queue uses the dispatcher of the pool.
+///
+/// If the query objects of the workers cannot be allocated, the dispatcher is not used and the
+/// crowd is updated on the calling thread.
+///
+/// May be called before or after #init(). The dispatcher is not owned by the crowd.
+bool dtCrowd::setJobDispatcher(dtCrowdJobDispatcher* dispatcher)
+{
+	m_dispatcher = dispatcher;
+	m_pathq.setJobDispatcher(m_dispatcher);
+	
+	// The workers are allocated by init().
+	if (!m_navquery)
+		return true;
+	
+	if (initWorkers(m_dispatcher ? m_dispatcher->getWorkerCount() : 1))
+		return true;
+	
+	m_dispatcher = 0;
+	m_pathq.setJobDispatcher(0);
+	initWorkers(1);
+	return false;
+}
+
+/// @par
+///
+/// The update of the crowd is deterministic on one platform in any case: it does not depend on the
+/// job dispatcher, and the collisions are resolved in batches of agents which do not collide with each other.
+/// The deterministic mode also makes the results reproducible between platforms and between crowds
+/// which got to the same state through a different history, as needed by lockstep simulations:
+/// - The agents are processed in the order of their indices instead of the order they were added in.
+/// - The obstacle avoidance does not use the math library functions which round differently between platforms.
+///
+/// The remaining math only uses operations which are exactly rounded, so the library must be built
+/// without floating point contraction or excess precision (e.g. -ffp-contract=off and SSE2 math on x86,
+/// /fp:precise with MSVC). Use #getStateHash() to compare the crowds of the clients.
+void dtCrowd::setDeterministic(const bool deterministic)
+{
+	m_deterministic = deterministic;
+	for (int i = 0; i < m_nworkers; ++i)
+		m_workers[i].obstacleQuery->setDeterministic(m_deterministic);
+	
+	if (m_deterministic)
+	{
+		// Pack the active agents in index order.
+		m_nactiveAgents = 0;
+		for (int i = 0; i < m_maxAgents; ++i)
+		{
+			if (!getAgentAt(i)->active)
+				continue;
+			m_activeSlots[i] = m_nactiveAgents;
+			m_activeAgents[m_nactiveAgents++] = getAgentAt(i);
+		}
+	}
+}
+
+static unsigned int hashBytes(unsigned int h, const void* data, const int size)
+{
+	// FNV-1a
+	const unsigned char* p = (const unsigned char*)data;
+	for (int i = 0; i < size; ++i)
+	{
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/// @par
+///
+/// The hash covers the index, state, position, velocity, move request and corridor of each active
+/// agent, in index order.
+unsigned int dtCrowd::getStateHash() const
+{
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < m_maxAgents; ++i)
+	{
+		const dtCrowdAgent* ag = getAgentAt(i);
+		if (!ag->active)
+			continue;
+		h = hashBytes(h, &i, sizeof(i));
+		h = hashBytes(h, &m_agentState[i], sizeof(unsigned char));
+		h = hashBytes(h, &m_agentPos[i*3], sizeof(float)*3);
+		h = hashBytes(h, &m_agentVel[i*3], sizeof(float)*3);
+		h = hashBytes(h, &ag->targetState, sizeof(ag->targetState));
+		h = hashBytes(h, &ag->targetRef, sizeof(ag->targetRef));
+		h = hashBytes(h, ag->targetPos, sizeof(float)*3);
+		const int npath = ag->corridor.getPathCount();
+		h = hashBytes(h, &npath, sizeof(npath));
+		h = hashBytes(h, ag->corridor.getPath(), sizeof(dtPolyRef)*npath);
+		h = hashBytes(h, ag->corridor.getTarget(), sizeof(float)*3);
+	}
+	return h;
+}
+
+struct dtCrowdState
+{
+	int magic;								// Magic number, used to identify the data.
+	int version;							// Data version number.
+	int maxAgents;							// The agent count of the crowd at the time of storing the data.
+	int nactiveAgents;						// The number of agent states.
+	int nfreeAgents;						// The number of free agent indices.
+	int npathPolys;							// The total number of corridor polygons.
+	int deterministic;
+	float lodInterval;
+	int lodBudget;
+	float pathShareDist;
+	dtCrowdPathScheduleParams pathSchedule;
+	int pathTaskCursor[DT_CROWD_MAX_PATH_TASKS];
+	dtObstacleAvoidanceParams obstacleQueryParams[DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS];
+	float areaCost[DT_MAX_AREAS];
+	unsigned short includeFlags;
+	unsigned short excludeFlags;
+};
+
+struct dtCrowdAgentState
+{
+	int idx;								// The index of the agent.
+	float radius, height, maxAcceleration, maxSpeed;
+	float collisionQueryRange, neighbourQueryRange, pathOptimizationRange, separationWeight;
+	unsigned char updateFlags, obstacleAvoidanceType, lod, maxNeighbours;
+	unsigned char state;
+	float pos[3], vel[3], dvel[3], nvel[3];
+	float desiredSpeed;
+	float pathTaskTime[DT_CROWD_MAX_PATH_TASKS];
+	float lodTime;
+	unsigned char targetState;
+	unsigned char targetReplan;
+	dtPolyRef targetRef;
+	float targetPos[3];
+	float targetReplanTime;
+	float corridorPos[3], corridorTarget[3];
+	int npath;								// The number of corridor polygons following the agent states.
+	unsigned char animActive;
+	dtPolyRef animPolyRef;
+	float animInitPos[3], animStartPos[3], animEndPos[3];
+	float animT, animTmax;
+};
+
+int dtCrowd::getStateSize() const
+{
+	int npathPolys = 0;
+	for (int i = 0; i < m_nactiveAgents; ++i)
+		npathPolys += m_activeAgents[i]->corridor.getPathCount();
+	const int headerSize = dtAlign4(sizeof(dtCrowdState));
+	const int freeSize = dtAlign4(sizeof(int)*m_nfreeAgents);
+	const int agentSize = dtAlign4(sizeof(dtCrowdAgentState)*m_nactiveAgents);
+	const int pathSize = dtAlign4(sizeof(dtPolyRef)*npathPolys);
+	return headerSize + freeSize + agentSize + pathSize;
+}
+
+/// @par
+///
+/// The state includes the agents with their parameters, corridors, move requests and off-mesh
+/// animations, the order of the free agent indices, and the settings of the crowd. The local
+/// boundaries, neighbours and corners are rebuilt by the next update, so restoring a crowd does not
+/// search any paths again. The data is in native byte order.
+/// @see #getStateSize, #restoreState
+dtStatus dtCrowd::storeState(unsigned char* data, const int maxDataSize) const
+{
+	// Make sure there is enough space to store the state.
+	const int sizeReq = getStateSize();
+	if (maxDataSize < sizeReq)
+		return DT_FAILURE | DT_BUFFER_TOO_SMALL;
+	
+	memset(data, 0, sizeReq);
+	dtCrowdState* state = (dtCrowdState*)data; data += dtAlign4(sizeof(dtCrowdState));
+	int* freeAgents = (int*)data; data += dtAlign4(sizeof(int)*m_nfreeAgents);
+	dtCrowdAgentState* agentStates = (dtCrowdAgentState*)data; data += dtAlign4(sizeof(dtCrowdAgentState)*m_nactiveAgents);
+	dtPolyRef* pathPolys = (dtPolyRef*)data;
+	
+	// Store crowd state.
+	state->magic = DT_CROWD_STATE_MAGIC;
+	state->version = DT_CROWD_STATE_VERSION;
+	state->maxAgents = m_maxAgents;
+	state->nactiveAgents = m_nactiveAgents;
+	state->nfreeAgents = m_nfreeAgents;
+	state->deterministic = m_deterministic ? 1 : 0;
+	state->lodInterval = m_lodInterval;
+	state->lodBudget = m_lodBudget;
+	state->pathShareDist = m_pathQueue->getShareDistance();
+	memcpy(&state->pathSchedule, &m_pathSchedule, sizeof(m_pathSchedule));
+	memcpy(state->pathTaskCursor, m_pathTaskCursor, sizeof(m_pathTaskCursor));
+	memcpy(state->obstacleQueryParams, m_obstacleQueryParams, sizeof(m_obstacleQueryParams));
+	for (int i = 0; i < DT_MAX_AREAS; ++i)
+		state->areaCost[i] = m_filter.getAreaCost(i);
+	state->includeFlags = m_filter.getIncludeFlags();
+	state->excludeFlags = m_filter.getExcludeFlags();
+	
+	memcpy(freeAgents, m_freeAgents, sizeof(int)*m_nfreeAgents);
+	
+	// Store per agent state, in the order of the active agents.
+	int npathPolys = 0;
+	for (int i = 0; i < m_nactiveAgents; ++i)
+	{
+		const dtCrowdAgent* ag = m_activeAgents[i];
+		const int idx = getAgentIndex(ag);
+		const dtCrowdAgentAnimation* anim = &m_agentAnims[idx];
+		dtCrowdAgentState* s = &agentStates[i];
+		
+		s->idx = idx;
+		s->radius = ag->params.radius;
+		s->height = ag->params.height;
+		s->maxAcceleration = ag->params.maxAcceleration;
+		s->maxSpeed = ag->params.maxSpeed;
+		s->collisionQueryRange = ag->params.collisionQueryRange;
+		s->neighbourQueryRange = ag->params.neighbourQueryRange;
+		s->pathOptimizationRange = ag->params.pathOptimizationRange;
+		s->separationWeight = ag->params.separationWeight;
+		s->updateFlags = ag->params.updateFlags;
+		s->obstacleAvoidanceType = ag->params.obstacleAvoidanceType;
+		s->lod = ag->params.lod;
+		s->maxNeighbours = ag->params.maxNeighbours;
+		s->state = m_agentState[idx];
+		dtVcopy(s->pos, &m_agentPos[idx*3]);
+		dtVcopy(s->vel, &m_agentVel[idx*3]);
+		dtVcopy(s->dvel, &m_agentDvel[idx*3]);
+		dtVcopy(s->nvel, &m_agentNvel[idx*3]);
+		s->desiredSpeed = ag->desiredSpeed;
+		memcpy(s->pathTaskTime, ag->pathTaskTime, sizeof(ag->pathTaskTime));
+		s->lodTime = ag->lodTime;
+		s->targetState = ag->targetState;
+		s->targetReplan = ag->targetReplan ? 1 : 0;
+		s->targetRef = ag->targetRef;
+		dtVcopy(s->targetPos, ag->targetPos);
+		s->targetReplanTime = ag->targetReplanTime;
+		dtVcopy(s->corridorPos, ag->corridor.getPos());
+		dtVcopy(s->corridorTarget, ag->corridor.getTarget());
+		s->npath = ag->corridor.getPathCount();
+		s->animActive = anim->active;
+		s->animPolyRef = anim->polyRef;
+		dtVcopy(s->animInitPos, anim->initPos);
+		dtVcopy(s->animStartPos, anim->startPos);
+		dtVcopy(s->animEndPos, anim->endPos);
+		s->animT = anim->t;
+		s->animTmax = anim->tmax;
+		
+		memcpy(pathPolys + npathPolys, ag->corridor.getPath(), sizeof(dtPolyRef)*s->npath);
+		npathPolys += s->npath;
+	}
+	state->npathPolys = npathPolys;
+	
+	return DT_SUCCESS;
+}
+
+/// @par
+///
+/// The crowd must be initialized on the same navigation mesh, it grows to the number of agents
+/// of the stored crowd when it is smaller. The agents keep their indices. The move requests which were
+/// waiting for the path queue are requested again, and agents following a flow field move to
+/// the goal of the field with a regular move request, as the field is not part of the state.
+/// Agents whose stored corridor is longer than the corridors of this crowd replan to their target.
+/// The path share distance is only restored when the crowd owns its path queue.
+/// The user data of the agents is cleared.
+/// @see #storeState
+dtStatus dtCrowd::restoreState(const unsigned char* data, const int dataSize)
+{
+	if (dataSize < (int)sizeof(dtCrowdState))
+		return DT_FAILURE | DT_INVALID_PARAM;
+	
+	const dtCrowdState* state = (const dtCrowdState*)data; data += dtAlign4(sizeof(dtCrowdState));
+	
+	// Check that the restore is possible.
+	if (state->magic != DT_CROWD_STATE_MAGIC)
+		return DT_FAILURE | DT_WRONG_MAGIC;
+	if (state->version != DT_CROWD_STATE_VERSION)
+		return DT_FAILURE | DT_WRONG_VERSION;
+	if (state->maxAgents < 0 || state->maxAgents > DT_CROWD_MAX_AGENTS ||
+		state->nactiveAgents < 0 || state->nactiveAgents > state->maxAgents ||
+		state->nfreeAgents < 0 || state->nfreeAgents > state->maxAgents ||
+		state->npathPolys < 0 || state->npathPolys > state->nactiveAgents*m_maxPathResult)
+		return DT_FAILURE | DT_INVALID_PARAM;
+	const int sizeReq = dtAlign4(sizeof(dtCrowdState)) + dtAlign4(sizeof(int)*state->nfreeAgents) +
+		dtAlign4(sizeof(dtCrowdAgentState)*state->nactiveAgents) + dtAlign4(sizeof(dtPolyRef)*state->npathPolys);
+	if (dataSize < sizeReq)
+		return DT_FAILURE | DT_INVALID_PARAM;
+	
+	const int* freeAgents = (const int*)data; data += dtAlign4(sizeof(int)*state->nfreeAgents);
+	const dtCrowdAgentState* agentStates = (const dtCrowdAgentState*)data; data += dtAlign4(sizeof(dtCrowdAgentState)*state->nactiveAgents);
+	const dtPolyRef* pathPolys = (const dtPolyRef*)data;
+	
+	// Check the agents before anything is modified: each index may appear once, the paths
+	// must be within the stored polygons, and the parameters and states must be in range.
+	const int seenSize = (state->maxAgents+31) / 32;
+	unsigned int* seen = (unsigned int*)dtAlloc(sizeof(unsigned int)*dtMax(seenSize, 1), DT_ALLOC_TEMP);
+	if (!seen)
+		return DT_FAILURE | DT_OUT_OF_MEMORY;
+	memset(seen, 0, sizeof(unsigned int)*seenSize);
+	int totalPathPolys = 0;
+	bool valid = true;
+	for (int i = 0; i < state->nactiveAgents && valid; ++i)
+	{
+		const dtCrowdAgentState* s = &agentStates[i];
+		const int idx = s->idx;
+		const int npath = s->npath;
+		if (idx < 0 || idx >= state->maxAgents || npath < 0 || npath > state->npathPolys - totalPathPolys ||
+			(seen[idx >> 5] & (1u << (idx & 31))) ||
+			s->obstacleAvoidanceType >= DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS ||
+			s->lod > DT_CROWDAGENT_LOD_FROZEN || s->maxNeighbours > DT_CROWDAGENT_MAX_NEIGHBOURS ||
+			s->state > DT_CROWDAGENT_STATE_OFFMESH || s->targetState > DT_CROWDAGENT_TARGET_FLOW_FIELD)
+		{
+			valid = false;
+			break;
+		}
+		seen[idx >> 5] |= 1u << (idx & 31);
+		totalPathPolys += npath;
+	}
+	if (!valid)
+	{
+		dtFree(seen);
+		return DT_FAILURE | DT_INVALID_PARAM;
+	}
+	
+	// Grow the crowd to the size of the stored crowd.
+	if (!growAgents(state->maxAgents))
+	{
+		dtFree(seen);
+		return DT_FAILURE | DT_OUT_OF_MEMORY;
+	}
+	
+	// Remove the current agents. Like removeAgent() the corridors of the agents which are not
+	// restored free their path buffers, the restored agents reuse theirs.
+	for (int i = 0; i < m_maxAgents; ++i)
+	{
+		dtCrowdAgent* ag = getAgentAt(i);
+		if (ag->active && (i >= state->maxAgents || !(seen[i >> 5] & (1u << (i & 31)))))
+			ag->corridor.release();
+		ag->active = 0;
+		m_agentAnims[i].active = 0;
+		m_activeSlots[i] = -1;
+	}
+	m_nactiveAgents = 0;
+	dtFree(seen);
+	
+	// Restore crowd settings.
+	m_lodInterval = state->lodInterval;
+	m_lodBudget = state->lodBudget;
+	// The path queue of a pool is shared with other crowds and keeps its own setting.
+	if (!m_pool)
+		m_pathq.setShareDistance(state->pathShareDist);
+	setPathSchedule(&state->pathSchedule);
+	memcpy(m_pathTaskCursor, state->pathTaskCursor, sizeof(m_pathTaskCursor));
+	memcpy(m_obstacleQueryParams, state->obstacleQueryParams, sizeof(m_obstacleQueryParams));
+	for (int i = 0; i < DT_MAX_AREAS; ++i)
+		m_filter.setAreaCost(i, state->areaCost[i]);
+	m_filter.setIncludeFlags(state->includeFlags);
+	m_filter.setExcludeFlags(state->excludeFlags);
+	
+	// Restore per agent state.
+	int npathPolys = 0;
+	for (int i = 0; i < state->nactiveAgents; ++i)
+	{
+		const dtCrowdAgentState* s = &agentStates[i];
+		const int idx = s->idx;
+		dtCrowdAgent* ag = getAgentAt(idx);
+		dtCrowdAgentAnimation* anim = &m_agentAnims[idx];
+		
+		dtCrowdAgentParams params;
+		memset(&params, 0, sizeof(params));
+		params.radius = s->radius;
+		params.height = s->height;
+		params.maxAcceleration = s->maxAcceleration;
+		params.maxSpeed = s->maxSpeed;
+		params.collisionQueryRange = s->collisionQueryRange;
+		params.neighbourQueryRange = s->neighbourQueryRange;
+		params.pathOptimizationRange = s->pathOptimizationRange;
+		params.separationWeight = s->separationWeight;
+		params.updateFlags = s->updateFlags;
+		params.obstacleAvoidanceType = s->obstacleAvoidanceType;
+		params.lod = s->lod;
+		params.maxNeighbours = s->maxNeighbours;
+		updateAgentParameters(idx, &params);
+		
+		m_agentState[idx] = s->state;
+		dtVcopy(&m_agentPos[idx*3], s->pos);
+		dtVcopy(&m_agentVel[idx*3], s->vel);
+		dtVcopy(&m_agentDvel[idx*3], s->dvel);
+		dtVcopy(&m_agentNvel[idx*3], s->nvel);
+		dtVset(&m_agentDisp[idx*3], 0,0,0);
+		ag->desiredSpeed = s->desiredSpeed;
+		memcpy(ag->pathTaskTime, s->pathTaskTime, sizeof(ag->pathTaskTime));
+		ag->pathTasks = 0;
+		ag->lodTime = s->lodTime;
+		ag->lodUpdate = true;
+		ag->nneis = 0;
+		ag->ncorners = 0;
+		
+		// Restore the corridor. The stored path may not fit if the crowd uses shorter corridors,
+		// the agent then replans from its first polygon below.
+		const dtPolyRef* path = pathPolys + npathPolys;
+		npathPolys += s->npath;
+		ag->corridor.reset(s->npath ? path[0] : 0, s->corridorPos);
+		const bool pathFits = s->npath < m_maxPathResult;
+		if (s->npath > 0 && pathFits)
+			ag->corridor.setCorridor(s->corridorTarget, path, s->npath);
+		ag->boundary.reset();
+		
+		ag->targetState = s->targetState;
+		ag->targetReplan = s->targetReplan != 0;
+		ag->targetRef = s->targetRef;
+		dtVcopy(ag->targetPos, s->targetPos);
+		ag->targetReplanTime = s->targetReplanTime;
+		ag->targetPathqRef = DT_PATHQ_INVALID;
+		ag->flowField = 0;
+		ag->flowFieldVersion = 0;
+		if (ag->targetState == DT_CROWDAGENT_TARGET_WAITING_FOR_PATH)
+			ag->targetState = DT_CROWDAGENT_TARGET_WAITING_FOR_QUEUE;
+		else if (ag->targetState == DT_CROWDAGENT_TARGET_FLOW_FIELD)
+			ag->targetState = DT_CROWDAGENT_TARGET_REQUESTING;
+		if (!pathFits && ag->targetState != DT_CROWDAGENT_TARGET_NONE &&
+			ag->targetState != DT_CROWDAGENT_TARGET_FAILED && ag->targetState != DT_CROWDAGENT_TARGET_VELOCITY)
+			requestMoveTargetReplan(idx, ag->targetRef, ag->targetPos);
+		
+		anim->active = s->animActive;
+		anim->polyRef = s->animPolyRef;
+		dtVcopy(anim->initPos, s->animInitPos);
+		dtVcopy(anim->startPos, s->animStartPos);
+		dtVcopy(anim->endPos, s->animEndPos);
+		anim->t = s->animT;
+		anim->tmax = s->animTmax;
+		
+		ag->active = 1;
+		m_activeSlots[idx] = m_nactiveAgents;
+		m_activeAgents[m_nactiveAgents++] = ag;
+		
+		updateAgentView(idx);
+	}
+	
+	// Restore the order in which the free indices are handed out when the crowd size matches.
+	m_nfreeAgents = 0;
+	if (state->maxAgents == m_maxAgents && state->nfreeAgents + state->nactiveAgents == m_maxAgents)
+	{
+		for (int i = 0; i < state->nfreeAgents; ++i)
+		{
+			if (freeAgents[i] >= 0 && freeAgents[i] < m_maxAgents && !getAgentAt(freeAgents[i])->active)
+				m_freeAgents[m_nfreeAgents++] = freeAgents[i];
+		}
+	}
+	if (m_nfreeAgents + m_nactiveAgents != m_maxAgents)
+	{
+		m_nfreeAgents = 0;
+		for (int i = m_maxAgents-1; i >= 0; --i)
+		{
+			if (!getAgentAt(i)->active)
+				m_freeAgents[m_nfreeAgents++] = i;
+		}
+	}
+	
+	// Sorts the active agents when needed.
+	setDeterministic(state->deterministic != 0);
+	
+	return DT_SUCCESS;
+}
+
+/// @par
+///
+/// Agents heading for the same target usually request their paths between the same polygons
+/// and from nearly the same positions, so they share one search and each copies the result into
+/// its corridor. The default distance is the maximum agent radius, see dtPathQueueStats::numShared
+/// for the number of shared requests.
+///
+/// A crowd using a query pool cannot change the distance, as the path queue is shared with the
+/// other crowds of the pool. Use dtCrowdQueryPool::setPathShareDistance() instead.
+bool dtCrowd::setPathShareDistance(const float dist)
+{
+	if (m_pool)
+		return false;
+	m_pathq.setShareDistance(dist);
+	return true;
+}
+
+/// @par
+///
+/// Limits the number of the crowd's agents waiting for a path from the path queue, the rest of
+/// the agents wait for their turn. The default is the size of the path queue. When crowds share
+/// a path queue, the sum of their quotas should not exceed dtPathQueue::getMaxRequests() so that
+/// each crowd gets its requests into the queue.
+void dtCrowd::setPathQueueQuota(const int maxRequests)
+{
+	m_pathQueueQuota = dtMax(maxRequests, 1);
+}
+
+void dtCrowd::setCollisionIterations(const int maxIterations)
+{
+	m_collisionIterations = dtMax(maxIterations, 0);
+}
+
+/// @par
+///
+/// Each tick the agents due for a task are visited in turn, continuing after the last agent the task
+/// was run for in the previous tick, and the task is run until its share of the budget is used.
+/// A task is run for at least one agent per tick when any agent is due.
+void dtCrowd::setPathSchedule(const dtCrowdPathScheduleParams* params)
+{
+	memcpy(&m_pathSchedule, params, sizeof(dtCrowdPathScheduleParams));
+	m_pathSchedule.budget = dtMax(m_pathSchedule.budget, 0);
+	for (int i = 0; i < DT_CROWD_MAX_PATH_TASKS; ++i)
+	{
+		m_pathSchedule.budgetShare[i] = dtMax(m_pathSchedule.budgetShare[i], 0.0f);
+		m_pathSchedule.minInterval[i] = dtMax(m_pathSchedule.minInterval[i], 0.0f);
+	}
+	m_pathSchedule.validityLookahead = dtMax(m_pathSchedule.validityLookahead, 1);
+}
+
+/// @par
+///
+/// Each tick the agents using #DT_CROWDAGENT_LOD_REDUCED whose last update is at least @p interval
+/// seconds old are scheduled, the ones waiting the longest first, at most @p maxAgents of them.
+/// The other reduced detail agents keep their local boundary and the velocity chosen by their last
+/// obstacle avoidance update. The schedule is reset by #init().
+void dtCrowd::setLodSchedule(const float interval, const int maxAgents)
+{
+	m_lodInterval = dtMax(interval, 0.0f);
+	m_lodBudget = dtClamp(maxAgents, 1, dtMax(m_maxAgents, 1));
+}
+
+void dtCrowd::setObstacleAvoidanceParams(const int idx, const dtObstacleAvoidanceParams* params)
+{
+	if (idx >= 0 && idx < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS)
+		memcpy(&m_obstacleQueryParams[idx], params, sizeof(dtObstacleAvoidanceParams));
+}
+
+const dtObstacleAvoidanceParams* dtCrowd::getObstacleAvoidanceParams(const int idx) const
+{
+	if (idx >= 0 && idx < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS)
+		return &m_obstacleQueryParams[idx];
+	return 0;
+}
+
+const int dtCrowd::getAgentCount() const
+{
+	return m_maxAgents;
+}
+
+/// @par
+/// 
+/// Agents in the pool may not be in use.  Check #dtCrowdAgent.active before using the returned object.
+///
+/// The crowd keeps the position, velocities, radius and state of the agents in separate arrays.
+/// The returned object is a view of the agent that is refreshed by #addAgent() and at the end of #update().
+const dtCrowdAgent* dtCrowd::getAgent(const int idx)
+{
+	return getAgentAt(idx);
+}
+
+void dtCrowd::updateAgentView(const int idx)
+{
+	dtCrowdAgent* ag = getAgentAt(idx);
+	dtVcopy(ag->npos, &m_agentPos[idx*3]);
+	dtVcopy(ag->vel, &m_agentVel[idx*3]);
+	dtVcopy(ag->dvel, &m_agentDvel[idx*3]);
+	dtVcopy(ag->nvel, &m_agentNvel[idx*3]);
+	dtVcopy(ag->disp, &m_agentDisp[idx*3]);
+	ag->state = m_agentState[idx];
+}
+
+void dtCrowd::updateAgentParameters(const int idx, const dtCrowdAgentParams* params)
+{
+	if (idx < 0 || idx >= m_maxAgents)
+		return;
+	memcpy(&getAgentAt(idx)->params, params, sizeof(dtCrowdAgentParams));
+	m_agentRadius[idx] = params->radius;
+}
+
+/// @par
+///
+/// The agent's position will be constrained to the surface of the navigation mesh.
+///
+/// When all agents are in use, the crowd allocates another <tt>1 << #DT_CROWD_AGENT_CHUNK_BITS</tt>
+/// agents, up to #DT_CROWD_MAX_AGENTS. The agents already added are not moved.
+int dtCrowd::addAgent(const float* pos, const dtCrowdAgentParams* params)
+{
+	// Find empty slot, grow the crowd by a chunk of agents when full.
+	if (!m_nfreeAgents && !growAgents(m_maxAgents+1))
+		return -1;
+	const int idx = m_freeAgents[--m_nfreeAgents];
+	
+	dtCrowdAgent* ag = getAgentAt(idx);
+
+	// Find nearest position on navmesh and place the agent there.
+	float nearest[3];
+	dtPolyRef ref;
+	m_navquery->findNearestPoly(pos, m_ext, &m_filter, &ref, nearest);
+	
+	// The corridor of a removed agent allocates its path buffer again.
+	ag->corridor.reset(ref, nearest);
+	if (!ag->corridor.getPathCount())
+	{
+		m_nfreeAgents++;
+		return -1;
+	}
+	ag->boundary.reset();
+
+	updateAgentParameters(idx, params);
+	
+	for (int i = 0; i < DT_CROWD_MAX_PATH_TASKS; ++i)
+		ag->pathTaskTime[i] = 0;
+	ag->pathTasks = 0;
+	ag->targetReplanTime = 0;
+	ag->nneis = 0;
+	
+	// Schedule reduced detail agents on the first update.
+	ag->lodTime = m_lodInterval;
+	ag->lodUpdate = true;
+	
+	dtVset(&m_agentDvel[idx*3], 0,0,0);
+	dtVset(&m_agentNvel[idx*3], 0,0,0);
+	dtVset(&m_agentVel[idx*3], 0,0,0);
+	dtVset(&m_agentDisp[idx*3], 0,0,0);
+	dtVcopy(&m_agentPos[idx*3], nearest);
+	
+	ag->desiredSpeed = 0;
+
 	if (ref)
-		ag->state = DT_CROWDAGENT_STATE_WALKING;
+		m_agentState[idx] = DT_CROWDAGENT_STATE_WALKING;
 	else
-		ag->state = DT_CROWDAGENT_STATE_INVALID;
+		m_agentState[idx] = DT_CROWDAGENT_STATE_INVALID;
 	
 	ag->targetState = DT_CROWDAGENT_TARGET_NONE;
+	ag->flowField = 0;
 	
 	ag->active = 1;
+	int slot = m_nactiveAgents++;
+	if (m_deterministic)
+	{
+		// Keep the active agents in index order.
+		while (slot > 0 && getAgentIndex(m_activeAgents[slot-1]) > idx)
+		{
+			m_activeAgents[slot] = m_activeAgents[slot-1];
+			m_activeSlots[getAgentIndex(m_activeAgents[slot])] = slot;
+			slot--;
+		}
+	}
+	m_activeSlots[idx] = slot;
+	m_activeAgents[slot] = ag;
+	
+	updateAgentView(idx);
 
 	return idx;
 }
@@ -555,21 +1591,51 @@ void dtCrowd::removeAgent(const int idx)
 {
 	if (idx >= 0 && idx < m_maxAgents)
 	{
-		m_agents[idx].active = 0;
+		dtCrowdAgent* ag = getAgentAt(idx);
+		if (!ag->active)
+			return;
+		ag->active = 0;
+		m_agentAnims[idx].active = 0;
+		
+		// Idle agents do not keep their path buffers.
+		ag->corridor.release();
+		
+		const int slot = m_activeSlots[idx];
+		if (m_deterministic)
+		{
+			// Shift the following agents down to keep the index order.
+			m_nactiveAgents--;
+			for (int i = slot; i < m_nactiveAgents; ++i)
+			{
+				m_activeAgents[i] = m_activeAgents[i+1];
+				m_activeSlots[getAgentIndex(m_activeAgents[i])] = i;
+			}
+		}
+		else
+		{
+			// Swap the last active agent into the removed agent's slot.
+			dtCrowdAgent* last = m_activeAgents[--m_nactiveAgents];
+			m_activeAgents[slot] = last;
+			m_activeSlots[getAgentIndex(last)] = slot;
+		}
+		m_activeSlots[idx] = -1;
+		
+		m_freeAgents[m_nfreeAgents++] = idx;
 	}
 }
 
 bool dtCrowd::requestMoveTargetReplan(const int idx, dtPolyRef ref, const float* pos)
 {
-	if (idx < 0 || idx > m_maxAgents)
+	if (idx < 0 || idx >= m_maxAgents)
 		return false;
 	
-	dtCrowdAgent* ag = &m_agents[idx];
+	dtCrowdAgent* ag = getAgentAt(idx);
 	
 	// Initialize request.
 	ag->targetRef = ref;
 	dtVcopy(ag->targetPos, pos);
 	ag->targetPathqRef = DT_PATHQ_INVALID;
+	ag->flowField = 0;
 	ag->targetReplan = true;
 	if (ag->targetRef)
 		ag->targetState = DT_CROWDAGENT_TARGET_REQUESTING;
@@ -588,17 +1654,18 @@ bool dtCrowd::requestMoveTargetReplan(const int idx, dtPolyRef ref, const float*
 /// The request will be processed during the next #update().
 bool dtCrowd::requestMoveTarget(const int idx, dtPolyRef ref, const float* pos)
 {
-	if (idx < 0 || idx > m_maxAgents)
+	if (idx < 0 || idx >= m_maxAgents)
 		return false;
 	if (!ref)
 		return false;
 
-	dtCrowdAgent* ag = &m_agents[idx];
+	dtCrowdAgent* ag = getAgentAt(idx);
 	
 	// Initialize request.
 	ag->targetRef = ref;
 	dtVcopy(ag->targetPos, pos);
 	ag->targetPathqRef = DT_PATHQ_INVALID;
+	ag->flowField = 0;
 	ag->targetReplan = false;
 	if (ag->targetRef)
 		ag->targetState = DT_CROWDAGENT_TARGET_REQUESTING;
@@ -610,47 +1677,217 @@ bool dtCrowd::requestMoveTarget(const int idx, dtPolyRef ref, const float* pos)
 
 bool dtCrowd::requestMoveVelocity(const int idx, const float* vel)
 {
-	if (idx < 0 || idx > m_maxAgents)
+	if (idx < 0 || idx >= m_maxAgents)
 		return false;
 	
-	dtCrowdAgent* ag = &m_agents[idx];
+	dtCrowdAgent* ag = getAgentAt(idx);
 	
 	// Initialize request.
 	ag->targetRef = 0;
 	dtVcopy(ag->targetPos, vel);
 	ag->targetPathqRef = DT_PATHQ_INVALID;
+	ag->flowField = 0;
 	ag->targetReplan = false;
 	ag->targetState = DT_CROWDAGENT_TARGET_VELOCITY;
 	
 	return true;
 }
 
+/// @par
+///
+/// The agent's corridor is filled from the flow field instead of a path request, and refilled
+/// when the field changes or the agent nears the end of the corridor. If the agent's polygon is
+/// not reached by the field, the move request fails.
+///
+/// The request will be processed during the next #update().
+bool dtCrowd::requestMoveFlowField(const int idx, const dtFlowField* field)
+{
+	if (idx < 0 || idx >= m_maxAgents)
+		return false;
+	if (!field || !field->getGoalRef())
+		return false;
+	
+	dtCrowdAgent* ag = getAgentAt(idx);
+	
+	// Initialize request.
+	ag->targetRef = field->getGoalRef();
+	dtVcopy(ag->targetPos, field->getGoalPos());
+	ag->targetPathqRef = DT_PATHQ_INVALID;
+	ag->flowField = field;
+	ag->flowFieldVersion = 0;
+	ag->targetReplan = false;
+	ag->targetState = DT_CROWDAGENT_TARGET_FLOW_FIELD;
+	
+	return true;
+}
+
 bool dtCrowd::resetMoveTarget(const int idx)
 {
-	if (idx < 0 || idx > m_maxAgents)
+	if (idx < 0 || idx >= m_maxAgents)
 		return false;
 	
-	dtCrowdAgent* ag = &m_agents[idx];
+	dtCrowdAgent* ag = getAgentAt(idx);
 	
 	// Initialize request.
 	ag->targetRef = 0;
 	dtVset(ag->targetPos, 0,0,0);
 	ag->targetPathqRef = DT_PATHQ_INVALID;
+	ag->flowField = 0;
 	ag->targetReplan = false;
 	ag->targetState = DT_CROWDAGENT_TARGET_NONE;
 	
 	return true;
 }
 
-int dtCrowd::getActiveAgents(dtCrowdAgent** agents, const int maxAgents)
+static bool isPolyInTiles(const dtNavMesh* nav, const dtPolyRef ref, const dtTileRef* tiles, const int ntiles)
 {
-	int n = 0;
-	for (int i = 0; i < m_maxAgents; ++i)
+	unsigned int salt, it, ip;
+	nav->decodePolyId(ref, salt, it, ip);
+	const dtTileRef tileRef = (dtTileRef)nav->encodePolyId(salt, it, 0);
+	for (int i = 0; i < ntiles; ++i)
+	{
+		if (tiles[i] == tileRef)
+			return true;
+	}
+	return false;
+}
+
+/// @par
+///
+/// Call this after tiles have been replaced, e.g. when dtTileCache::update() reports the tile it rebuilt,
+/// and before the next #update(). Otherwise the invalid polygons are only found when they come within the
+/// validity check of the agents, which then replan their whole paths.
+///
+/// The part of each corridor in the rebuilt tiles is searched again between the polygons around it,
+/// within a small search budget. An agent or a target standing in a rebuilt tile is moved to the nearest
+/// polygon first. If the local search fails, the agent replans its path.
+int dtCrowd::repairCorridors(const dtTileRef* tiles, const int ntiles)
+{
+	if (!m_navquery || !tiles || ntiles <= 0)
+		return 0;
+	
+	int nrepaired = 0;
+	for (int i = 0; i < m_nactiveAgents; ++i)
+	{
+		if (repairCorridor(m_activeAgents[i], tiles, ntiles))
+			nrepaired++;
+	}
+	
+	return nrepaired;
+}
+
+bool dtCrowd::repairCorridor(dtCrowdAgent* ag, const dtTileRef* tiles, const int ntiles)
+{
+	const int idx = getAgentIndex(ag);
+	if (m_agentState[idx] != DT_CROWDAGENT_STATE_WALKING || ag->targetState != DT_CROWDAGENT_TARGET_VALID)
+		return false;
+	
+	const dtNavMesh* nav = m_navquery->getAttachedNavMesh();
+	const dtPolyRef* path = ag->corridor.getPath();
+	const int npath = ag->corridor.getPathCount();
+	
+	// Find the span of the corridor in the rebuilt tiles.
+	int first = -1, last = -1;
+	for (int i = 0; i < npath; ++i)
+	{
+		if (isPolyInTiles(nav, path[i], tiles, ntiles))
+		{
+			if (first == -1)
+				first = i;
+			last = i;
+		}
+	}
+	if (first == -1)
+		return false;
+	
+	float* npos = &m_agentPos[idx*3];
+	float target[3];
+	dtVcopy(target, ag->corridor.getTarget());
+	const bool endsAtTarget = path[npath-1] == ag->targetRef;
+	
+	// Search from the polygon before the span, or from the agent's new location.
+	dtPolyRef startRef = 0;
+	float startPos[3];
+	if (first > 0)
+	{
+		startRef = path[first-1];
+		m_navquery->closestPointOnPolyBoundary(startRef, npos, startPos);
+	}
+	else
+	{
+		// The validity check handles agents which are not on the navmesh anymore.
+		m_navquery->findNearestPoly(npos, m_ext, &m_filter, &startRef, startPos);
+		if (!startRef)
+			return false;
+	}
+	
+	// Search to the polygon after the span, or to the target's new location.
+	dtPolyRef endRef = 0;
+	float endPos[3];
+	if (last < npath-1)
 	{
-		if (!m_agents[i].active) continue;
-		if (n < maxAgents)
-			agents[n++] = &m_agents[i];
+		endRef = path[last+1];
+		m_navquery->closestPointOnPolyBoundary(endRef, target, endPos);
 	}
+	else
+	{
+		m_navquery->findNearestPoly(target, m_ext, &m_filter, &endRef, endPos);
+		if (!endRef)
+			return false;
+		dtVcopy(target, endPos);
+		if (endsAtTarget)
+		{
+			ag->targetRef = endRef;
+			dtVcopy(ag->targetPos, endPos);
+		}
+	}
+	
+	// Splice the new span between the unchanged parts of the corridor.
+	const int nprefix = dtMax(first-1, 0);
+	const int nsuffix = npath - dtMin(last+2, npath);
+	const int maxSpan = m_maxPathResult-1 - nprefix - nsuffix;
+	int nspan = 0;
+	bool found = false;
+	if (maxSpan > 0)
+	{
+		m_navquery->initSlicedFindPath(startRef, endRef, startPos, endPos, &m_filter);
+		if (dtStatusSucceed(m_navquery->updateSlicedFindPath(MAX_REPAIR_ITERS, 0)))
+		{
+			const dtStatus status = m_navquery->finalizeSlicedFindPath(m_pathResult + nprefix, &nspan, maxSpan);
+			found = dtStatusSucceed(status) && nspan > 0 && m_pathResult[nprefix+nspan-1] == endRef;
+		}
+	}
+	
+	if (!found)
+	{
+		// The agents standing in the rebuilt tiles are replanned by the validity check.
+		if (first > 0)
+			requestMoveTargetReplan(idx, ag->targetRef, ag->targetPos);
+		return false;
+	}
+	
+	memcpy(m_pathResult, path, sizeof(dtPolyRef)*nprefix);
+	memcpy(m_pathResult + nprefix + nspan, path + npath - nsuffix, sizeof(dtPolyRef)*nsuffix);
+	
+	if (first == 0)
+	{
+		ag->corridor.reset(startRef, startPos);
+		ag->boundary.reset();
+		dtVcopy(npos, startPos);
+	}
+	ag->corridor.setCorridor(target, m_pathResult, nprefix + nspan + nsuffix);
+	updateAgentView(idx);
+	
+	return true;
+}
+
+/// @par
+///
+/// The agents are returned in the order they are processed by #update(), which is not the order of the agent indices.
+int dtCrowd::getActiveAgents(dtCrowdAgent** agents, const int maxAgents)
+{
+	const int n = dtMin(m_nactiveAgents, maxAgents);
+	memcpy(agents, m_activeAgents, sizeof(dtCrowdAgent*)*n);
 	return n;
 }
 
@@ -662,12 +1899,11 @@ void dtCrowd::updateMoveRequest(const float /*dt*/)
 	int nqueue = 0;
 	
 	// Fire off new requests.
-	for (int i = 0; i < m_maxAgents; ++i)
+	for (int i = 0; i < m_nactiveAgents; ++i)
 	{
-		dtCrowdAgent* ag = &m_agents[i];
-		if (!ag->active)
-			continue;
-		if (ag->state == DT_CROWDAGENT_STATE_INVALID)
+		dtCrowdAgent* ag = m_activeAgents[i];
+		const int idx = getAgentIndex(ag);
+		if (m_agentState[idx] == DT_CROWDAGENT_STATE_INVALID)
 			continue;
 		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
 			continue;
@@ -685,8 +1921,11 @@ void dtCrowd::updateMoveRequest(const float /*dt*/)
 
 			// Quick seach towards the goal.
 			static const int MAX_ITER = 20;
-			m_navquery->initSlicedFindPath(path[0], ag->targetRef, ag->npos, ag->targetPos, &m_filter);
-			m_navquery->updateSlicedFindPath(MAX_ITER, 0);
+			int doneIters = 0;
+			m_navquery->initSlicedFindPath(path[0], ag->targetRef, &m_agentPos[idx*3], ag->targetPos, &m_filter);
+			m_navquery->updateSlicedFindPath(MAX_ITER, &doneIters);
+			m_stats.numQueries++;
+			m_stats.numNodes += doneIters;
 			dtStatus status = 0;
 			if (ag->targetReplan) // && npath > 10)
 			{
@@ -722,7 +1961,7 @@ void dtCrowd::updateMoveRequest(const float /*dt*/)
 			if (!reqPathCount)
 			{
 				// Could not find path, start the request from current location.
-				dtVcopy(reqPos, ag->npos);
+				dtVcopy(reqPos, &m_agentPos[idx*3]);
 				reqPath[0] = path[0];
 				reqPathCount = 1;
 			}
@@ -744,38 +1983,55 @@ void dtCrowd::updateMoveRequest(const float /*dt*/)
 		
 		if (ag->targetState == DT_CROWDAGENT_TARGET_WAITING_FOR_QUEUE)
 		{
-			nqueue = addToPathQueue(ag, queue, nqueue, PATH_MAX_AGENTS);
+			nqueue = addToQueue(ag, &dtCrowdAgent::targetReplanTime, queue, nqueue, PATH_MAX_AGENTS);
 		}
 	}
 
+	// Keep the requests of the crowd within its quota.
+	int nwaiting = 0;
+	for (int i = 0; i < m_nactiveAgents; ++i)
+	{
+		if (m_activeAgents[i]->targetState == DT_CROWDAGENT_TARGET_WAITING_FOR_PATH)
+			nwaiting++;
+	}
+	nqueue = dtMin(nqueue, dtMax(m_pathQueueQuota - nwaiting, 0));
+
 	for (int i = 0; i < nqueue; ++i)
 	{
 		dtCrowdAgent* ag = queue[i];
-		ag->targetPathqRef = m_pathq.request(ag->corridor.getLastPoly(), ag->targetRef,
-											 ag->corridor.getTarget(), ag->targetPos, &m_filter);
+		// Agents heading for a new target are more urgent than the ones replanning their path.
+		const float priority = ag->targetReplan ? 0.0f : NEW_TARGET_PATH_PRIORITY;
+		ag->targetPathqRef = m_pathQueue->request(ag->corridor.getLastPoly(), ag->targetRef,
+											 ag->corridor.getTarget(), ag->targetPos, &m_filter, priority);
 		if (ag->targetPathqRef != DT_PATHQ_INVALID)
+		{
 			ag->targetState = DT_CROWDAGENT_TARGET_WAITING_FOR_PATH;
+			m_stats.numPathRequests++;
+		}
 	}
 
 	
-	// Update requests.
-	m_pathq.update(MAX_ITERS_PER_UPDATE);
+	// Update requests, the path queue of a pool is updated by the pool.
+	if (!m_pool)
+	{
+		const int numIters = m_pathq.getStats()->numIters;
+		m_pathq.update(MAX_ITERS_PER_UPDATE);
+		m_stats.numNodes += m_pathq.getStats()->numIters - numIters;
+	}
 
 	dtStatus status;
 
 	// Process path results.
-	for (int i = 0; i < m_maxAgents; ++i)
+	for (int i = 0; i < m_nactiveAgents; ++i)
 	{
-		dtCrowdAgent* ag = &m_agents[i];
-		if (!ag->active)
-			continue;
+		dtCrowdAgent* ag = m_activeAgents[i];
 		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
 			continue;
 		
 		if (ag->targetState == DT_CROWDAGENT_TARGET_WAITING_FOR_PATH)
 		{
 			// Poll path queue.
-			status = m_pathq.getRequestStatus(ag->targetPathqRef);
+			status = m_pathQueue->getRequestStatus(ag->targetPathqRef);
 			if (dtStatusFailed(status))
 			{
 				// Path find failed, retry if the target location is still valid.
@@ -799,7 +2055,7 @@ void dtCrowd::updateMoveRequest(const float /*dt*/)
 				dtPolyRef* res = m_pathResult;
 				bool valid = true;
 				int nres = 0;
-				status = m_pathq.getPathResult(ag->targetPathqRef, res, &nres, m_maxPathResult);
+				status = m_pathQueue->getPathResult(ag->targetPathqRef, res, &nres, m_maxPathResult);
 				if (dtStatusFailed(status) || !nres)
 					valid = false;
 				
@@ -879,49 +2135,150 @@ void dtCrowd::updateMoveRequest(const float /*dt*/)
 }
 
 
-void dtCrowd::updateTopologyOptimization(dtCrowdAgent** agents, const int nagents, const float dt)
+void dtCrowd::updateLodSchedule(const float dt)
 {
-	if (!nagents)
-		return;
-	
-	const float OPT_TIME_THR = 0.5f; // seconds
-	const int OPT_MAX_AGENTS = 1;
-	dtCrowdAgent* queue[OPT_MAX_AGENTS];
 	int nqueue = 0;
+	m_nupdateAgents = 0;
+	
+	for (int i = 0; i < m_nactiveAgents; ++i)
+	{
+		dtCrowdAgent* ag = m_activeAgents[i];
+		
+		if (ag->params.lod == DT_CROWDAGENT_LOD_FROZEN)
+		{
+			// Frozen agents are static obstacles for the others.
+			const int idx = getAgentIndex(ag);
+			dtVset(&m_agentVel[idx*3], 0,0,0);
+			dtVset(&m_agentDvel[idx*3], 0,0,0);
+			dtVset(&m_agentNvel[idx*3], 0,0,0);
+			continue;
+		}
+		
+		if (ag->params.lod == DT_CROWDAGENT_LOD_REDUCED)
+		{
+			ag->lodUpdate = false;
+			ag->lodTime += dt;
+			if (ag->lodTime >= m_lodInterval)
+				nqueue = addToQueue(ag, &dtCrowdAgent::lodTime, m_lodQueue, nqueue, m_lodBudget);
+		}
+		else
+		{
+			ag->lodUpdate = ag->params.lod == DT_CROWDAGENT_LOD_FULL;
+		}
+		
+		m_updateAgents[m_nupdateAgents++] = ag;
+	}
 	
+	for (int i = 0; i < nqueue; ++i)
+	{
+		dtCrowdAgent* ag = m_lodQueue[i];
+		ag->lodUpdate = true;
+		ag->lodTime = 0;
+	}
+}
+
+static bool needsPathTask(const dtCrowdAgent* ag, const int task)
+{
+	if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+		return false;
+	if (task == DT_CROWD_PATH_CHECK_VALIDITY)
+		return true;
+	if (ag->params.lod == DT_CROWDAGENT_LOD_PATH_FOLLOW)
+		return false;
+	if (task == DT_CROWD_PATH_OPTIMIZE_VIS)
+		return (ag->params.updateFlags & DT_CROWD_OPTIMIZE_VIS) != 0;
+	return (ag->params.updateFlags & DT_CROWD_OPTIMIZE_TOPO) != 0 &&
+		ag->targetState != DT_CROWDAGENT_TARGET_FLOW_FIELD;
+}
+
+static int getPathTaskCost(const dtCrowdAgent* ag, const int task, const int validityLookahead)
+{
+	const int npath = ag->corridor.getPathCount();
+	if (task == DT_CROWD_PATH_CHECK_VALIDITY)
+		return dtMin(npath, validityLookahead);
+	if (task == DT_CROWD_PATH_OPTIMIZE_VIS)
+		return dtMin(npath, MAX_OPTIMIZE_VIS_COST);
+	return OPTIMIZE_TOPO_COST;
+}
+
+void dtCrowd::updatePathSchedule(dtCrowdAgent** agents, const int nagents, const float dt)
+{
+	for (int i = 0; i < nagents; ++i)
+		agents[i]->pathTasks = 0;
+	
+	int carry = 0;
+	for (int task = 0; task < DT_CROWD_MAX_PATH_TASKS; ++task)
+	{
+		dtCrowdPathTaskStats& stats = m_pathTaskStats[task];
+		memset(&stats, 0, sizeof(stats));
+		
+		int budget = (int)(m_pathSchedule.budget * m_pathSchedule.budgetShare[task]) + carry;
+		const float minInterval = m_pathSchedule.minInterval[task];
+		const int start = nagents ? m_pathTaskCursor[task] % nagents : 0;
+		
+		for (int j = 0; j < nagents; ++j)
+		{
+			const int i = start+j < nagents ? start+j : start+j-nagents;
+			dtCrowdAgent* ag = agents[i];
+			if (m_agentState[getAgentIndex(ag)] != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			if (!needsPathTask(ag, task))
+				continue;
+			
+			ag->pathTaskTime[task] += dt;
+			if (ag->pathTaskTime[task] < minInterval)
+				continue;
+			
+			const int cost = getPathTaskCost(ag, task, m_pathSchedule.validityLookahead);
+			if (cost > budget && stats.numRun > 0)
+			{
+				stats.numDeferred++;
+				continue;
+			}
+			
+			ag->pathTasks |= (unsigned char)(1 << task);
+			stats.numRun++;
+			stats.cost += cost;
+			stats.maxWait = dtMax(stats.maxWait, ag->pathTaskTime[task]);
+			ag->pathTaskTime[task] = 0;
+			budget -= cost;
+			m_pathTaskCursor[task] = i+1;
+		}
+		
+		carry = dtMax(budget, 0);
+	}
+}
+
+void dtCrowd::updateTopologyOptimization(dtCrowdAgent** agents, const int nagents)
+{
 	for (int i = 0; i < nagents; ++i)
 	{
 		dtCrowdAgent* ag = agents[i];
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+		if ((ag->pathTasks & (1 << DT_CROWD_PATH_OPTIMIZE_TOPO)) == 0)
 			continue;
-		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+		if (m_agentState[getAgentIndex(ag)] != DT_CROWDAGENT_STATE_WALKING)
 			continue;
-		if ((ag->params.updateFlags & DT_CROWD_OPTIMIZE_TOPO) == 0)
+		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY ||
+			ag->targetState == DT_CROWDAGENT_TARGET_FLOW_FIELD)
 			continue;
-		ag->topologyOptTime += dt;
-		if (ag->topologyOptTime >= OPT_TIME_THR)
-			nqueue = addToOptQueue(ag, queue, nqueue, OPT_MAX_AGENTS);
-	}
-
-	for (int i = 0; i < nqueue; ++i)
-	{
-		dtCrowdAgent* ag = queue[i];
 		ag->corridor.optimizePathTopology(m_navquery, &m_filter);
-		ag->topologyOptTime = 0;
+		m_stats.numQueries++;
 	}
-
 }
 
-void dtCrowd::checkPathValidity(dtCrowdAgent** agents, const int nagents, const float dt)
+void dtCrowd::checkPathValidity(dtCrowdAgent** agents, const int nagents, const float dt, Worker& worker)
 {
-	static const int CHECK_LOOKAHEAD = 10;
+	dtNavMeshQuery* navquery = worker.navquery;
+	const int lookahead = m_pathSchedule.validityLookahead;
 	static const float TARGET_REPLAN_DELAY = 1.0; // seconds
 	
 	for (int i = 0; i < nagents; ++i)
 	{
 		dtCrowdAgent* ag = agents[i];
+		const int idx = getAgentIndex(ag);
+		float* npos = &m_agentPos[idx*3];
 		
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+		if (m_agentState[idx] != DT_CROWDAGENT_STATE_WALKING)
 			continue;
 
 		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
@@ -932,17 +2289,17 @@ void dtCrowd::checkPathValidity(dtCrowdAgent** agents, const int nagents, const
 		bool replan = false;
 
 		// First check that the current location is valid.
-		const int idx = getAgentIndex(ag);
 		float agentPos[3];
 		dtPolyRef agentRef = ag->corridor.getFirstPoly();
-		dtVcopy(agentPos, ag->npos);
-		if (!m_navquery->isValidPolyRef(agentRef, &m_filter))
+		dtVcopy(agentPos, npos);
+		if (!navquery->isValidPolyRef(agentRef, &m_filter))
 		{
 			// Current location is not valid, try to reposition.
 			// TODO: this can snap agents, how to handle that?
 			float nearest[3];
 			agentRef = 0;
-			m_navquery->findNearestPoly(ag->npos, m_ext, &m_filter, &agentRef, nearest);
+			navquery->findNearestPoly(npos, m_ext, &m_filter, &agentRef, nearest);
+			worker.queryCount++;
 			dtVcopy(agentPos, nearest);
 
 			if (!agentRef)
@@ -950,28 +2307,60 @@ void dtCrowd::checkPathValidity(dtCrowdAgent** agents, const int nagents, const
 				// Could not find location in navmesh, set state to invalid.
 				ag->corridor.reset(0, agentPos);
 				ag->boundary.reset();
-				ag->state = DT_CROWDAGENT_STATE_INVALID;
+				m_agentState[idx] = DT_CROWDAGENT_STATE_INVALID;
 				continue;
 			}
 
 			// Make sure the first polygon is valid, but leave other valid
 			// polygons in the path so that replanner can adjust the path better.
 			ag->corridor.fixPathStart(agentRef, agentPos);
-//			ag->corridor.trimInvalidPath(agentRef, agentPos, m_navquery, &m_filter);
+//			ag->corridor.trimInvalidPath(agentRef, agentPos, navquery, &m_filter);
 			ag->boundary.reset();
-			dtVcopy(ag->npos, agentPos);
+			dtVcopy(npos, agentPos);
 
 			replan = true;
 		}
+		
+		// The start of the corridor is only checked when the validity task is scheduled for the agent.
+		const bool checkCorridor = (ag->pathTasks & (1 << DT_CROWD_PATH_CHECK_VALIDITY)) != 0;
+		
+		// Refill the corridor from the flow field when the field has changed, the corridor has become
+		// invalid, or the end of the corridor is near and it is not the goal.
+		if (ag->targetState == DT_CROWDAGENT_TARGET_FLOW_FIELD)
+		{
+			const dtFlowField* field = ag->flowField;
+			if (replan || ag->flowFieldVersion != field->getVersion() ||
+				(checkCorridor && !ag->corridor.isValid(lookahead, navquery, &m_filter)) ||
+				(ag->corridor.getPathCount() < lookahead && ag->corridor.getLastPoly() != ag->targetRef))
+			{
+				dtPolyRef path[MAX_FLOW_FIELD_PATH];
+				float endPos[3];
+				const int npath = field->getPath(agentRef, path, endPos, MAX_FLOW_FIELD_PATH);
+				if (npath)
+				{
+					ag->corridor.setCorridor(endPos, path, npath);
+					ag->flowFieldVersion = field->getVersion();
+				}
+				else
+				{
+					// The agent is not reached by the field.
+					ag->corridor.reset(agentRef, agentPos);
+					ag->flowField = 0;
+					ag->targetState = DT_CROWDAGENT_TARGET_FAILED;
+				}
+			}
+			continue;
+		}
 
 		// Try to recover move request position.
 		if (ag->targetState != DT_CROWDAGENT_TARGET_NONE && ag->targetState != DT_CROWDAGENT_TARGET_FAILED)
 		{
-			if (!m_navquery->isValidPolyRef(ag->targetRef, &m_filter))
+			if (!navquery->isValidPolyRef(ag->targetRef, &m_filter))
 			{
 				// Current target is not valid, try to reposition.
 				float nearest[3];
-				m_navquery->findNearestPoly(ag->targetPos, m_ext, &m_filter, &ag->targetRef, nearest);
+				navquery->findNearestPoly(ag->targetPos, m_ext, &m_filter, &ag->targetRef, nearest);
+				worker.queryCount++;
 				dtVcopy(ag->targetPos, nearest);
 				replan = true;
 			}
@@ -984,10 +2373,10 @@ void dtCrowd::checkPathValidity(dtCrowdAgent** agents, const int nagents, const
 		}
 
 		// If nearby corridor is not valid, replan.
-		if (!ag->corridor.isValid(CHECK_LOOKAHEAD, m_navquery, &m_filter))
+		if (checkCorridor && !ag->corridor.isValid(lookahead, navquery, &m_filter))
 		{
 			// Fix current path.
-//			ag->corridor.trimInvalidPath(agentRef, agentPos, m_navquery, &m_filter);
+//			ag->corridor.trimInvalidPath(agentRef, agentPos, navquery, &m_filter);
 //			ag->boundary.reset();
 			replan = true;
 		}
@@ -996,7 +2385,7 @@ void dtCrowd::checkPathValidity(dtCrowdAgent** agents, const int nagents, const
 		if (ag->targetState == DT_CROWDAGENT_TARGET_VALID)
 		{
 			if (ag->targetReplanTime > TARGET_REPLAN_DELAY &&
-				ag->corridor.getPathCount() < CHECK_LOOKAHEAD &&
+				ag->corridor.getPathCount() < lookahead &&
 				ag->corridor.getLastPoly() != ag->targetRef)
 				replan = true;
 		}
@@ -1012,321 +2401,440 @@ void dtCrowd::checkPathValidity(dtCrowdAgent** agents, const int nagents, const
 	}
 }
 	
-void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
+void dtCrowd::runUpdateJob(void* data, const int jobIdx, const int workerIdx)
 {
-	m_velocitySampleCount = 0;
-	
-	const int debugIdx = debug ? debug->idx : -1;
+	const UpdateJob* job = (const UpdateJob*)data;
+	dtCrowd* crowd = job->crowd;
+	dtAssert(workerIdx >= 0 && workerIdx < crowd->m_nworkers);
 	
-	dtCrowdAgent** agents = m_activeAgents;
-	int nagents = getActiveAgents(agents, m_maxAgents);
-	
-	// Check that all agents still have valid paths.
-	checkPathValidity(agents, nagents, dt);
-	
-	// Update async move request and path finder.
-	updateMoveRequest(dt);
+	const int i0 = jobIdx*UPDATE_JOB_AGENTS;
+	const int i1 = dtMin(i0+UPDATE_JOB_AGENTS, job->nagents);
+	crowd->updatePhase(*job, i0, i1, crowd->m_workers[workerIdx]);
+}
 
-	// Optimize path topology.
-	updateTopologyOptimization(agents, nagents, dt);
+void dtCrowd::runUpdatePhase(UpdateJob& job, const int phase)
+{
+	job.phase = phase;
 	
-	// Register agents to proximity grid.
-	m_grid->clear();
-	for (int i = 0; i < nagents; ++i)
+	if (m_dispatcher && job.nagents > UPDATE_JOB_AGENTS)
 	{
-		dtCrowdAgent* ag = agents[i];
-		const float* p = ag->npos;
-		const float r = ag->params.radius;
-		m_grid->addItem((unsigned short)i, p[0]-r, p[2]-r, p[0]+r, p[2]+r);
+		const int njobs = (job.nagents + UPDATE_JOB_AGENTS-1) / UPDATE_JOB_AGENTS;
+		m_dispatcher->run(runUpdateJob, &job, njobs);
 	}
-	
-	// Get nearby navmesh segments and agents to collide with.
-	for (int i = 0; i < nagents; ++i)
+	else
 	{
-		dtCrowdAgent* ag = agents[i];
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-
-		// Update the collision boundary after certain distance has been passed or
-		// if it has become invalid.
-		const float updateThr = ag->params.collisionQueryRange*0.25f;
-		if (dtVdist2DSqr(ag->npos, ag->boundary.getCenter()) > dtSqr(updateThr) ||
-			!ag->boundary.isValid(m_navquery, &m_filter))
-		{
-			ag->boundary.update(ag->corridor.getFirstPoly(), ag->npos, ag->params.collisionQueryRange,
-								m_navquery, &m_filter);
-		}
-		// Query neighbour agents
-		ag->nneis = getNeighbours(ag->npos, ag->params.height, ag->params.collisionQueryRange,
-								  ag, ag->neis, DT_CROWDAGENT_MAX_NEIGHBOURS,
-								  agents, nagents, m_grid);
-		for (int j = 0; j < ag->nneis; j++)
-			ag->neis[j].idx = getAgentIndex(agents[ag->neis[j].idx]);
+		updatePhase(job, 0, job.nagents, m_workers[0]);
 	}
+}
+
+/// @par
+///
+/// Each phase only writes to the agents in the range [i0, i1) and only reads the results of earlier phases
+/// from the other agents, so the result does not depend on how the agents are split between the workers.
+void dtCrowd::updatePhase(const UpdateJob& job, const int i0, const int i1, Worker& worker)
+{
+	dtCrowdAgent** agents = job.agents;
+	const float dt = job.dt;
+	dtCrowdAgentDebugInfo* debug = job.debug;
+	const int debugIdx = debug ? debug->idx : -1;
+	dtNavMeshQuery* navquery = worker.navquery;
+	dtObstacleAvoidanceQuery* obstacleQuery = worker.obstacleQuery;
 	
-	// Find next corner to steer to.
-	for (int i = 0; i < nagents; ++i)
-	{
-		dtCrowdAgent* ag = agents[i];
-		
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
-			continue;
-		
-		// Find corners for steering
-		ag->ncorners = ag->corridor.findCorners(ag->cornerVerts, ag->cornerFlags, ag->cornerPolys,
-												DT_CROWDAGENT_MAX_CORNERS, m_navquery, &m_filter);
-		
-		// Check to see if the corner after the next corner is directly visible,
-		// and short cut to there.
-		if ((ag->params.updateFlags & DT_CROWD_OPTIMIZE_VIS) && ag->ncorners > 0)
-		{
-			const float* target = &ag->cornerVerts[dtMin(1,ag->ncorners-1)*3];
-			ag->corridor.optimizePathVisibility(target, ag->params.pathOptimizationRange, m_navquery, &m_filter);
-			
-			// Copy data for debug purposes.
-			if (debugIdx == i)
-			{
-				dtVcopy(debug->optStart, ag->corridor.getPos());
-				dtVcopy(debug->optEnd, target);
-			}
-		}
-		else
-		{
-			// Copy data for debug purposes.
-			if (debugIdx == i)
-			{
-				dtVset(debug->optStart, 0,0,0);
-				dtVset(debug->optEnd, 0,0,0);
-			}
-		}
-	}
+	// Collision resolution.
+	static const float COLLISION_RESOLVE_FACTOR = 0.7f;
 	
-	// Trigger off-mesh connections (depends on corners).
-	for (int i = 0; i < nagents; ++i)
+	switch (job.phase)
 	{
-		dtCrowdAgent* ag = agents[i];
-		
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
-			continue;
+	case PHASE_CHECK_PATH_VALIDITY:
 		
-		// Check 
-		const float triggerRadius = ag->params.radius*2.25f;
-		if (overOffmeshConnection(ag, triggerRadius))
+		// Check that all agents still have valid paths.
+		checkPathValidity(agents+i0, i1-i0, dt, worker);
+		break;
+		
+	case PHASE_NEIGHBOURS:
+		
+		// Get nearby navmesh segments and agents to collide with.
+		for (int i = i0; i < i1; ++i)
 		{
-			// Prepare to off-mesh connection.
-			const int idx = ag - m_agents;
-			dtCrowdAgentAnimation* anim = &m_agentAnims[idx];
-			
-			// Adjust the path over the off-mesh connection.
-			dtPolyRef refs[2];
-			if (ag->corridor.moveOverOffmeshConnection(ag->cornerPolys[ag->ncorners-1], refs,
-													   anim->startPos, anim->endPos, m_navquery))
+			dtCrowdAgent* ag = agents[i];
+			const int idx = getAgentIndex(ag);
+			if (m_agentState[idx] != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			if (ag->params.lod == DT_CROWDAGENT_LOD_PATH_FOLLOW)
 			{
-				dtVcopy(anim->initPos, ag->npos);
-				anim->polyRef = refs[1];
-				anim->active = 1;
-				anim->t = 0.0f;
-				anim->tmax = (dtVdist2D(anim->startPos, anim->endPos) / ag->params.maxSpeed) * 0.5f;
-				
-				ag->state = DT_CROWDAGENT_STATE_OFFMESH;
-				ag->ncorners = 0;
 				ag->nneis = 0;
 				continue;
 			}
-			else
+			const float* npos = &m_agentPos[idx*3];
+
+			// Update the collision boundary after certain distance has been passed or
+			// if it has become invalid.
+			const float updateThr = ag->params.collisionQueryRange*0.25f;
+			if (ag->lodUpdate &&
+				(dtVdist2DSqr(npos, ag->boundary.getCenter()) > dtSqr(updateThr) ||
+				 !ag->boundary.isValid(navquery, &m_filter)))
 			{
-				// Path validity check will ensure that bad/blocked connections will be replanned.
+				// The segments are collected in PHASE_BOUNDARY_SEGMENTS.
+				ag->boundary.updatePolys(ag->corridor.getFirstPoly(), npos, ag->params.collisionQueryRange,
+										 navquery, &m_filter);
+				worker.queryCount++;
 			}
+			// Query neighbour agents
+			const float neighbourRange = ag->params.neighbourQueryRange > 0.0f ?
+				ag->params.neighbourQueryRange : ag->params.collisionQueryRange;
+			const int maxNeighbours = ag->params.maxNeighbours > 0 ?
+				(int)ag->params.maxNeighbours : DT_CROWDAGENT_MAX_NEIGHBOURS;
+			ag->nneis = getNeighbours(npos, ag->params.height, neighbourRange,
+									  idx, ag->neis, maxNeighbours,
+									  m_agentChunks, m_agentPos, m_grid);
 		}
-	}
+		break;
 		
-	// Calculate steering.
-	for (int i = 0; i < nagents; ++i)
-	{
-		dtCrowdAgent* ag = agents[i];
-
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE)
-			continue;
+	case PHASE_BOUNDARY_SEGMENTS:
 		
-		float dvel[3] = {0,0,0};
-
-		if (ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+		// Collect the wall segments of the updated boundaries from the cache.
+		for (int i = i0; i < i1; ++i)
 		{
-			dtVcopy(dvel, ag->targetPos);
-			ag->desiredSpeed = dtVlen(ag->targetPos);
+			dtCrowdAgent* ag = agents[i];
+			if (!ag->boundary.isPending())
+				continue;
+			ag->boundary.updateSegments(ag->params.collisionQueryRange, &m_boundaryCache, navquery, &m_filter);
 		}
-		else
+		break;
+		
+	case PHASE_CORNERS:
+		
+		// Find next corner to steer to.
+		for (int i = i0; i < i1; ++i)
 		{
-			// Calculate steering direction.
-			if (ag->params.updateFlags & DT_CROWD_ANTICIPATE_TURNS)
-				calcSmoothSteerDirection(ag, dvel);
-			else
-				calcStraightSteerDirection(ag, dvel);
+			dtCrowdAgent* ag = agents[i];
+			const int idx = getAgentIndex(ag);
 			
-			// Calculate speed scale, which tells the agent to slowdown at the end of the path.
-			const float slowDownRadius = ag->params.radius*2;	// TODO: make less hacky.
-			const float speedScale = getDistanceToGoal(ag, slowDownRadius) / slowDownRadius;
-				
-			ag->desiredSpeed = ag->params.maxSpeed;
-			dtVscale(dvel, dvel, ag->desiredSpeed * speedScale);
-		}
-
-		// Separation
-		if (ag->params.updateFlags & DT_CROWD_SEPARATION)
-		{
-			const float separationDist = ag->params.collisionQueryRange; 
-			const float invSeparationDist = 1.0f / separationDist; 
-			const float separationWeight = ag->params.separationWeight;
+			if (m_agentState[idx] != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+				continue;
 			
-			float w = 0;
-			float disp[3] = {0,0,0};
+			// Find corners for steering
+			ag->ncorners = ag->corridor.findCorners(ag->cornerVerts, ag->cornerFlags, ag->cornerPolys,
+													DT_CROWDAGENT_MAX_CORNERS, navquery, &m_filter);
+			worker.queryCount++;
 			
-			for (int j = 0; j < ag->nneis; ++j)
+			// Check to see if the corner after the next corner is directly visible,
+			// and short cut to there.
+			if ((ag->pathTasks & (1 << DT_CROWD_PATH_OPTIMIZE_VIS)) && ag->ncorners > 0)
 			{
-				const dtCrowdAgent* nei = &m_agents[ag->neis[j].idx];
-				
-				float diff[3];
-				dtVsub(diff, ag->npos, nei->npos);
-				diff[1] = 0;
-				
-				const float distSqr = dtVlenSqr(diff);
-				if (distSqr < 0.00001f)
-					continue;
-				if (distSqr > dtSqr(separationDist))
-					continue;
-				const float dist = sqrtf(distSqr);
-				const float weight = separationWeight * (1.0f - dtSqr(dist*invSeparationDist));
+				const float* target = &ag->cornerVerts[dtMin(1,ag->ncorners-1)*3];
+				ag->corridor.optimizePathVisibility(target, ag->params.pathOptimizationRange, navquery, &m_filter);
+				worker.queryCount++;
 				
-				dtVmad(disp, disp, diff, weight/dist);
-				w += 1.0f;
+				// Copy data for debug purposes.
+				if (debugIdx == idx)
+				{
+					dtVcopy(debug->optStart, ag->corridor.getPos());
+					dtVcopy(debug->optEnd, target);
+				}
+			}
+			else
+			{
+				// Copy data for debug purposes.
+				if (debugIdx == idx)
+				{
+					dtVset(debug->optStart, 0,0,0);
+					dtVset(debug->optEnd, 0,0,0);
+				}
 			}
 			
-			if (w > 0.0001f)
+			// Trigger off-mesh connections (depends on corners).
+			const float triggerRadius = m_agentRadius[idx]*2.25f;
+			if (overOffmeshConnection(ag, &m_agentPos[idx*3], triggerRadius))
 			{
-				// Adjust desired velocity.
-				dtVmad(dvel, dvel, disp, 1.0f/w);
-				// Clamp desired velocity to desired speed.
-				const float speedSqr = dtVlenSqr(dvel);
-				const float desiredSqr = dtSqr(ag->desiredSpeed);
-				if (speedSqr > desiredSqr)
-					dtVscale(dvel, dvel, desiredSqr/speedSqr);
+				// Prepare to off-mesh connection.
+				dtCrowdAgentAnimation* anim = &m_agentAnims[idx];
+				
+				// Adjust the path over the off-mesh connection.
+				dtPolyRef refs[2];
+				if (ag->corridor.moveOverOffmeshConnection(ag->cornerPolys[ag->ncorners-1], refs,
+														   anim->startPos, anim->endPos, navquery))
+				{
+					dtVcopy(anim->initPos, &m_agentPos[idx*3]);
+					anim->polyRef = refs[1];
+					anim->active = 1;
+					anim->t = 0.0f;
+					anim->tmax = (dtVdist2D(anim->startPos, anim->endPos) / ag->params.maxSpeed) * 0.5f;
+					
+					m_agentState[idx] = DT_CROWDAGENT_STATE_OFFMESH;
+					ag->ncorners = 0;
+					ag->nneis = 0;
+					continue;
+				}
+				else
+				{
+					// Path validity check will ensure that bad/blocked connections will be replanned.
+				}
 			}
 		}
+		break;
 		
-		// Set the desired velocity.
-		dtVcopy(ag->dvel, dvel);
-	}
-	
-	// Velocity planning.	
-	for (int i = 0; i < nagents; ++i)
-	{
-		dtCrowdAgent* ag = agents[i];
-		
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
+	case PHASE_STEERING:
 		
-		if (ag->params.updateFlags & DT_CROWD_OBSTACLE_AVOIDANCE)
+		// Calculate steering.
+		for (int i = i0; i < i1; ++i)
 		{
-			m_obstacleQuery->reset();
+			dtCrowdAgent* ag = agents[i];
+			const int idx = getAgentIndex(ag);
+
+			if (m_agentState[idx] != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			if (ag->targetState == DT_CROWDAGENT_TARGET_NONE)
+				continue;
 			
-			// Add neighbours as obstacles.
-			for (int j = 0; j < ag->nneis; ++j)
+			const float* npos = &m_agentPos[idx*3];
+			float dvel[3] = {0,0,0};
+
+			if (ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
 			{
-				const dtCrowdAgent* nei = &m_agents[ag->neis[j].idx];
-				m_obstacleQuery->addCircle(nei->npos, nei->params.radius, nei->vel, nei->dvel);
+				dtVcopy(dvel, ag->targetPos);
+				ag->desiredSpeed = dtVlen(ag->targetPos);
 			}
-
-			// Append neighbour segments as obstacles.
-			for (int j = 0; j < ag->boundary.getSegmentCount(); ++j)
+			else
 			{
-				const float* s = ag->boundary.getSegment(j);
-				if (dtTriArea2D(ag->npos, s, s+3) < 0.0f)
-					continue;
-				m_obstacleQuery->addSegment(s, s+3);
+				// Calculate steering direction.
+				if (ag->params.updateFlags & DT_CROWD_ANTICIPATE_TURNS)
+					calcSmoothSteerDirection(ag, npos, dvel);
+				else
+					calcStraightSteerDirection(ag, npos, dvel);
+				
+				// Calculate speed scale, which tells the agent to slowdown at the end of the path.
+				const float slowDownRadius = m_agentRadius[idx]*2;	// TODO: make less hacky.
+				const float speedScale = getDistanceToGoal(ag, npos, slowDownRadius) / slowDownRadius;
+					
+				ag->desiredSpeed = ag->params.maxSpeed;
+				dtVscale(dvel, dvel, ag->desiredSpeed * speedScale);
 			}
 
-			dtObstacleAvoidanceDebugData* vod = 0;
-			if (debugIdx == i) 
-				vod = debug->vod;
+			// Separation
+			if (ag->params.updateFlags & DT_CROWD_SEPARATION)
+			{
+				const float separationDist = ag->params.collisionQueryRange; 
+				const float invSeparationDist = 1.0f / separationDist; 
+				const float separationWeight = ag->params.separationWeight;
+				
+				float w = 0;
+				float disp[3] = {0,0,0};
+				
+				for (int j = 0; j < ag->nneis; ++j)
+				{
+					const float* neiPos = &m_agentPos[ag->neis[j].idx*3];
+					
+					float diff[3];
+					dtVsub(diff, npos, neiPos);
+					diff[1] = 0;
+					
+					const float distSqr = dtVlenSqr(diff);
+					if (distSqr < 0.00001f)
+						continue;
+					if (distSqr > dtSqr(separationDist))
+						continue;
+					const float dist = sqrtf(distSqr);
+					const float weight = separationWeight * (1.0f - dtSqr(dist*invSeparationDist));
+					
+					dtVmad(disp, disp, diff, weight/dist);
+					w += 1.0f;
+				}
+				
+				if (w > 0.0001f)
+				{
+					// Adjust desired velocity.
+					dtVmad(dvel, dvel, disp, 1.0f/w);
+					// Clamp desired velocity to desired speed.
+					const float speedSqr = dtVlenSqr(dvel);
+					const float desiredSqr = dtSqr(ag->desiredSpeed);
+					if (speedSqr > desiredSqr)
+						dtVscale(dvel, dvel, desiredSqr/speedSqr);
+				}
+			}
+			
+			// Set the desired velocity.
+			dtVcopy(&m_agentDvel[idx*3], dvel);
+		}
+		break;
+		
+	case PHASE_VELOCITY_PLANNING:
+		
+		// Velocity planning.	
+		for (int i = i0; i < i1; ++i)
+		{
+			dtCrowdAgent* ag = agents[i];
+			const int idx = getAgentIndex(ag);
+			
+			if (m_agentState[idx] != DT_CROWDAGENT_STATE_WALKING)
+				continue;
 			
-			// Sample new safe velocity.
-			bool adaptive = true;
-			int ns = 0;
+			if ((ag->params.updateFlags & DT_CROWD_OBSTACLE_AVOIDANCE) &&
+				ag->params.lod != DT_CROWDAGENT_LOD_PATH_FOLLOW)
+			{
+				// Reduced detail agents keep their previous velocity until they are scheduled.
+				if (!ag->lodUpdate)
+					continue;
+				
+				const float* npos = &m_agentPos[idx*3];
+				
+				obstacleQuery->reset();
+				
+				// Add neighbours as obstacles.
+				for (int j = 0; j < ag->nneis; ++j)
+				{
+					const int nei = ag->neis[j].idx;
+					obstacleQuery->addCircle(&m_agentPos[nei*3], m_agentRadius[nei], &m_agentVel[nei*3], &m_agentDvel[nei*3]);
+				}
 
-			const dtObstacleAvoidanceParams* params = &m_obstacleQueryParams[ag->params.obstacleAvoidanceType];
+				// Append neighbour segments as obstacles.
+				for (int j = 0; j < ag->boundary.getSegmentCount(); ++j)
+				{
+					const float* s = ag->boundary.getSegment(j);
+					if (dtTriArea2D(npos, s, s+3) < 0.0f)
+						continue;
+					obstacleQuery->addSegment(s, s+3);
+				}
+
+				dtObstacleAvoidanceDebugData* vod = 0;
+				if (debugIdx == idx) 
+					vod = debug->vod;
 				
-			if (adaptive)
-			{
-				ns = m_obstacleQuery->sampleVelocityAdaptive(ag->npos, ag->params.radius, ag->desiredSpeed,
-															 ag->vel, ag->dvel, ag->nvel, params, vod);
+				// Sample new safe velocity.
+				bool adaptive = true;
+				int ns = 0;
+
+				const dtObstacleAvoidanceParams* params = &m_obstacleQueryParams[ag->params.obstacleAvoidanceType];
+					
+				if (params->method == DT_OBSTACLE_AVOIDANCE_ORCA)
+				{
+					ns = obstacleQuery->computeVelocityORCA(npos, m_agentRadius[idx], ag->desiredSpeed,
+															&m_agentVel[idx*3], &m_agentDvel[idx*3], &m_agentNvel[idx*3],
+															params, dt, vod);
+				}
+				else if (adaptive)
+				{
+					ns = obstacleQuery->sampleVelocityAdaptive(npos, m_agentRadius[idx], ag->desiredSpeed,
+															   &m_agentVel[idx*3], &m_agentDvel[idx*3], &m_agentNvel[idx*3],
+															   params, vod);
+				}
+				else
+				{
+					ns = obstacleQuery->sampleVelocityGrid(npos, m_agentRadius[idx], ag->desiredSpeed,
+														   &m_agentVel[idx*3], &m_agentDvel[idx*3], &m_agentNvel[idx*3],
+														   params, vod);
+				}
+				worker.velocitySampleCount += ns;
 			}
 			else
 			{
-				ns = m_obstacleQuery->sampleVelocityGrid(ag->npos, ag->params.radius, ag->desiredSpeed,
-														 ag->vel, ag->dvel, ag->nvel, params, vod);
+				// If not using velocity planning, new velocity is directly the desired velocity.
+				dtVcopy(&m_agentNvel[idx*3], &m_agentDvel[idx*3]);
 			}
-			m_velocitySampleCount += ns;
 		}
-		else
+		break;
+		
+	case PHASE_INTEGRATE:
+		
+		// Integrate.
+		for (int i = i0; i < i1; ++i)
 		{
-			// If not using velocity planning, new velocity is directly the desired velocity.
-			dtVcopy(ag->nvel, ag->dvel);
+			dtCrowdAgent* ag = agents[i];
+			const int idx = getAgentIndex(ag);
+			if (m_agentState[idx] != DT_CROWDAGENT_STATE_WALKING)
+				continue;
+			integrate(&m_agentPos[idx*3], &m_agentVel[idx*3], &m_agentNvel[idx*3], ag->params.maxAcceleration, dt);
 		}
-	}
-
-	// Integrate.
-	for (int i = 0; i < nagents; ++i)
-	{
-		dtCrowdAgent* ag = agents[i];
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-			continue;
-		integrate(ag, dt);
-	}
-	
-	// Handle collisions.
-	static const float COLLISION_RESOLVE_FACTOR = 0.7f;
-	
-	for (int iter = 0; iter < 4; ++iter)
-	{
-		for (int i = 0; i < nagents; ++i)
+		break;
+		
+	case PHASE_COLLISION_CONTACTS:
+		
+		// Find the neighbours close enough to collide during the iterations.
+		for (int i = i0; i < i1; ++i)
 		{
-			dtCrowdAgent* ag = agents[i];
+			const dtCrowdAgent* ag = agents[i];
 			const int idx0 = getAgentIndex(ag);
 			
-			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
-				continue;
-
-			dtVset(ag->disp, 0,0,0);
+			unsigned char contacts = 0;
+			dtVset(&m_agentDisp[idx0*3], 0,0,0);
+			
+			if (m_agentState[idx0] == DT_CROWDAGENT_STATE_WALKING)
+			{
+				const float* npos = &m_agentPos[idx0*3];
+				const float radius = m_agentRadius[idx0];
+				for (int j = 0; j < ag->nneis; ++j)
+				{
+					const int idx1 = ag->neis[j].idx;
+					float diff[3];
+					dtVsub(diff, npos, &m_agentPos[idx1*3]);
+					diff[1] = 0;
+					if (dtVlenSqr(diff) < dtSqr((radius + m_agentRadius[idx1]) * COLLISION_CONTACT_RANGE))
+						contacts |= (unsigned char)(1 << j);
+				}
+			}
+			
+			m_agentContacts[idx0] = contacts;
+			m_agentMoved[idx0] = -1;
+		}
+		break;
+		
+	case PHASE_COLLISION:
+		
+		// Handle collisions. The agents of a batch do not read each other's positions,
+		// so they are moved in place.
+		for (int i = i0; i < i1; ++i)
+		{
+			const dtCrowdAgent* ag = agents[i];
+			const int idx0 = getAgentIndex(ag);
+			const unsigned char contacts = m_agentContacts[idx0];
+			
+			// Skip the agent if neither it nor its contacts have moved since it was last resolved.
+			if (job.iteration > 0)
+			{
+				bool moved = m_agentMoved[idx0] >= job.iteration-1;
+				for (int j = 0; j < ag->nneis && !moved; ++j)
+				{
+					if (contacts & (1 << j))
+						moved = m_agentMoved[ag->neis[j].idx] >= job.iteration-1;
+				}
+				if (!moved)
+					continue;
+			}
+			
+			float* npos = &m_agentPos[idx0*3];
+			const float* dvel = &m_agentDvel[idx0*3];
+			const float radius = m_agentRadius[idx0];
+			float* disp = &m_agentDisp[idx0*3];
+			dtVset(disp, 0,0,0);
 			
 			float w = 0;
 
 			for (int j = 0; j < ag->nneis; ++j)
 			{
-				const dtCrowdAgent* nei = &m_agents[ag->neis[j].idx];
-				const int idx1 = getAgentIndex(nei);
+				if (!(contacts & (1 << j)))
+					continue;
+				
+				const int idx1 = ag->neis[j].idx;
+				const float neiRadius = m_agentRadius[idx1];
 
 				float diff[3];
-				dtVsub(diff, ag->npos, nei->npos);
+				dtVsub(diff, npos, &m_agentPos[idx1*3]);
 				diff[1] = 0;
 				
 				float dist = dtVlenSqr(diff);
-				if (dist > dtSqr(ag->params.radius + nei->params.radius))
+				if (dist > dtSqr(radius + neiRadius))
 					continue;
 				dist = sqrtf(dist);
-				float pen = (ag->params.radius + nei->params.radius) - dist;
+				float pen = (radius + neiRadius) - dist;
 				if (dist < 0.0001f)
 				{
 					// Agents on top of each other, try to choose diverging separation directions.
 					if (idx0 > idx1)
-						dtVset(diff, -ag->dvel[2],0,ag->dvel[0]);
+						dtVset(diff, -dvel[2],0,dvel[0]);
 					else
-						dtVset(diff, ag->dvel[2],0,-ag->dvel[0]);
+						dtVset(diff, dvel[2],0,-dvel[0]);
 					pen = 0.01f;
 				}
 				else
@@ -1334,7 +2842,7 @@ void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
 					pen = (1.0f/dist) * (pen*0.5f) * COLLISION_RESOLVE_FACTOR;
 				}
 				
-				dtVmad(ag->disp, ag->disp, diff, pen);			
+				dtVmad(disp, disp, diff, pen);			
 				
 				w += 1.0f;
 			}
@@ -1342,46 +2850,266 @@ void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
 			if (w > 0.0001f)
 			{
 				const float iw = 1.0f / w;
-				dtVscale(ag->disp, ag->disp, iw);
+				dtVscale(disp, disp, iw);
+				dtVadd(npos, npos, disp);
+				
+				if (dtVlenSqr(disp) > dtSqr(radius*COLLISION_TOLERANCE))
+				{
+					m_agentMoved[idx0] = job.iteration;
+					worker.unresolvedCount++;
+				}
 			}
 		}
+		break;
+		
+	case PHASE_MOVE:
 		
-		for (int i = 0; i < nagents; ++i)
+		for (int i = i0; i < i1; ++i)
 		{
 			dtCrowdAgent* ag = agents[i];
-			if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+			const int idx = getAgentIndex(ag);
+			if (m_agentState[idx] != DT_CROWDAGENT_STATE_WALKING)
 				continue;
 			
-			dtVadd(ag->npos, ag->npos, ag->disp);
+			float* npos = &m_agentPos[idx*3];
+			
+			// Move along navmesh.
+			ag->corridor.movePosition(npos, navquery, &m_filter);
+			worker.queryCount++;
+			// Get valid constrained position back.
+			dtVcopy(npos, ag->corridor.getPos());
+
+			// If not using path, truncate the corridor to just one poly.
+			if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+			{
+				ag->corridor.reset(ag->corridor.getFirstPoly(), npos);
+			}
+
 		}
+		break;
+	}
+}
+
+/// @par
+///
+/// The agents are put to batches greedily in update order, so that no agent shares a batch with a neighbour
+/// it may collide with or which may collide with it. The batches are resolved one after another and the
+/// agents of a batch in parallel, each agent seeing the positions of the batches before it.
+void dtCrowd::buildCollisionBatches(dtCrowdAgent** agents, const int nagents)
+{
+	static const int LAST_BATCH = DT_CROWD_MAX_COLLISION_BATCHES-1;
+	
+	int counts[DT_CROWD_MAX_COLLISION_BATCHES];
+	memset(counts, 0, sizeof(counts));
+	
+	for (int i = 0; i < nagents; ++i)
+	{
+		const int idx = getAgentIndex(agents[i]);
+		m_agentBatch[idx] = NO_COLLISION_BATCH;
+		m_agentBatchMask[idx] = 0;
 	}
 	
 	for (int i = 0; i < nagents; ++i)
 	{
-		dtCrowdAgent* ag = agents[i];
-		if (ag->state != DT_CROWDAGENT_STATE_WALKING)
+		const dtCrowdAgent* ag = agents[i];
+		const int idx = getAgentIndex(ag);
+		const unsigned char contacts = m_agentContacts[idx];
+		if (!contacts)
 			continue;
 		
-		// Move along navmesh.
-		ag->corridor.movePosition(ag->npos, m_navquery, &m_filter);
-		// Get valid constrained position back.
-		dtVcopy(ag->npos, ag->corridor.getPos());
-
-		// If not using path, truncate the corridor to just one poly.
-		if (ag->targetState == DT_CROWDAGENT_TARGET_NONE || ag->targetState == DT_CROWDAGENT_TARGET_VELOCITY)
+		// The neighbours not updated in this tick keep the batch of an earlier tick, which only narrows the choice.
+		unsigned int mask = m_agentBatchMask[idx];
+		for (int j = 0; j < ag->nneis; ++j)
+		{
+			if (!(contacts & (1 << j)))
+				continue;
+			const unsigned char neiBatch = m_agentBatch[ag->neis[j].idx];
+			if (neiBatch != NO_COLLISION_BATCH)
+				mask |= 1u << neiBatch;
+		}
+		
+		// The last batch takes the agents which do not fit elsewhere and is resolved serially.
+		int batch = 0;
+		while (batch < LAST_BATCH && (mask & (1u << batch)))
+			batch++;
+		
+		m_agentBatch[idx] = (unsigned char)batch;
+		counts[batch]++;
+		
+		for (int j = 0; j < ag->nneis; ++j)
 		{
-			ag->corridor.reset(ag->corridor.getFirstPoly(), ag->npos);
+			if (contacts & (1 << j))
+				m_agentBatchMask[ag->neis[j].idx] |= 1u << batch;
 		}
+	}
+	
+	// Sort the agents by batch, keeping the update order within a batch.
+	m_collisionBatches[0] = 0;
+	for (int i = 0; i < DT_CROWD_MAX_COLLISION_BATCHES; ++i)
+	{
+		m_collisionBatches[i+1] = m_collisionBatches[i] + counts[i];
+		counts[i] = m_collisionBatches[i];
+	}
+	for (int i = 0; i < nagents; ++i)
+	{
+		const unsigned char batch = m_agentBatch[getAgentIndex(agents[i])];
+		if (batch != NO_COLLISION_BATCH)
+			m_collisionAgents[counts[batch]++] = agents[i];
+	}
+}
 
+/// @par
+///
+/// Agents using #DT_CROWDAGENT_LOD_FROZEN are skipped, see #CrowdAgentLOD and #setLodSchedule() for the other levels of detail.
+///
+/// The per-agent phases of the update are run through the job dispatcher when one is set (See #setJobDispatcher()).
+/// Path requests, topology optimization and off-mesh animations are always processed on the calling thread.
+/// How often the paths of the agents are checked and optimized depends on the budget set with #setPathSchedule().
+///
+/// The counters of the update are available from #getStats() afterwards. The phases are only timed when a clock
+/// has been set with #setStatsClock().
+void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
+{
+	const unsigned int startTime = m_clock ? m_clock() : 0;
+	unsigned int time = startTime;
+	memset(&m_stats, 0, sizeof(m_stats));
+	
+	m_velocitySampleCount = 0;
+	for (int i = 0; i < m_nworkers; ++i)
+	{
+		m_workers[i].velocitySampleCount = 0;
+		m_workers[i].queryCount = 0;
+	}
+	
+	// The query objects of a pool are shared with crowds which may use another mode.
+	if (m_pool)
+	{
+		for (int i = 0; i < m_nworkers; ++i)
+			m_workers[i].obstacleQuery->setDeterministic(m_deterministic);
+	}
+	
+	// Select the agents to update in this tick.
+	updateLodSchedule(dt);
+	
+	dtCrowdAgent** agents = m_updateAgents;
+	const int nagents = m_nupdateAgents;
+	
+	UpdateJob job;
+	job.crowd = this;
+	job.phase = 0;
+	job.agents = agents;
+	job.nagents = nagents;
+	job.dt = dt;
+	job.debug = debug;
+	job.iteration = 0;
+	
+	// Pick the agents whose paths are checked and optimized within the budget.
+	updatePathSchedule(agents, nagents, dt);
+	
+	// Check that all agents still have valid paths.
+	runUpdatePhase(job, PHASE_CHECK_PATH_VALIDITY);
+	
+	// Update async move request and path finder.
+	updateMoveRequest(dt);
+
+	// Optimize path topology.
+	updateTopologyOptimization(agents, nagents);
+	m_stats.pathTime = lapTime(time);
+	
+	// Register agents to proximity grid, frozen agents included.
+	m_grid->clear();
+	for (int i = 0; i < m_nactiveAgents; ++i)
+	{
+		const int idx = getAgentIndex(m_activeAgents[i]);
+		const float* p = &m_agentPos[idx*3];
+		const float r = m_agentRadius[idx];
+		m_grid->addItem((unsigned short)idx, p[0]-r, p[2]-r, p[0]+r, p[2]+r);
+	}
+	m_grid->build();
+	
+	// Get nearby navmesh segments and agents to collide with.
+	runUpdatePhase(job, PHASE_NEIGHBOURS);
+	
+	// Extract the walls once for each polygon around the updated boundaries.
+	m_boundaryCache.clear();
+	for (int i = 0; i < nagents; ++i)
+	{
+		const dtLocalBoundary& boundary = agents[i]->boundary;
+		if (!boundary.isPending())
+			continue;
+		for (int j = 0; j < boundary.getPolyCount(); ++j)
+			m_boundaryCache.addPoly(boundary.getPoly(j));
+	}
+	m_boundaryCache.build(m_navquery, &m_filter);
+	runUpdatePhase(job, PHASE_BOUNDARY_SEGMENTS);
+	m_stats.boundaryTime = lapTime(time);
+	
+	// Find next corner to steer to and trigger off-mesh connections.
+	runUpdatePhase(job, PHASE_CORNERS);
+	
+	// Calculate steering.
+	runUpdatePhase(job, PHASE_STEERING);
+	m_stats.steeringTime = lapTime(time);
+	
+	// Velocity planning.
+	runUpdatePhase(job, PHASE_VELOCITY_PLANNING);
+	for (int i = 0; i < m_nworkers; ++i)
+		m_velocitySampleCount += m_workers[i].velocitySampleCount;
+	m_stats.avoidanceTime = lapTime(time);
+
+	// Integrate.
+	runUpdatePhase(job, PHASE_INTEGRATE);
+	
+	// Handle collisions.
+	runUpdatePhase(job, PHASE_COLLISION_CONTACTS);
+	buildCollisionBatches(agents, nagents);
+	
+	const int ncolliding = m_collisionBatches[DT_CROWD_MAX_COLLISION_BATCHES];
+	for (int iter = 0; iter < m_collisionIterations && ncolliding > 0; ++iter)
+	{
+		for (int i = 0; i < m_nworkers; ++i)
+			m_workers[i].unresolvedCount = 0;
+		job.iteration = iter;
+		
+		for (int batch = 0; batch < DT_CROWD_MAX_COLLISION_BATCHES; ++batch)
+		{
+			job.agents = m_collisionAgents + m_collisionBatches[batch];
+			job.nagents = m_collisionBatches[batch+1] - m_collisionBatches[batch];
+			if (!job.nagents)
+				continue;
+			
+			if (batch < DT_CROWD_MAX_COLLISION_BATCHES-1)
+			{
+				runUpdatePhase(job, PHASE_COLLISION);
+			}
+			else
+			{
+				job.phase = PHASE_COLLISION;
+				updatePhase(job, 0, job.nagents, m_workers[0]);
+			}
+		}
+		m_stats.numCollisionIterations++;
+		
+		int unresolved = 0;
+		for (int i = 0; i < m_nworkers; ++i)
+			unresolved += m_workers[i].unresolvedCount;
+		if (!unresolved)
+			break;
 	}
+	job.agents = agents;
+	job.nagents = nagents;
+	m_stats.collisionTime = lapTime(time);
+	
+	// Move along navmesh.
+	runUpdatePhase(job, PHASE_MOVE);
 	
 	// Update agents using off-mesh connection.
-	for (int i = 0; i < m_maxAgents; ++i)
+	for (int j = 0; j < nagents; ++j)
 	{
+		const int i = getAgentIndex(agents[j]);
 		dtCrowdAgentAnimation* anim = &m_agentAnims[i];
 		if (!anim->active)
 			continue;
-		dtCrowdAgent* ag = agents[i];
 
 		anim->t += dt;
 		if (anim->t > anim->tmax)
@@ -1389,7 +3117,7 @@ void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
 			// Reset animation
 			anim->active = 0;
 			// Prepare agent for walking.
-			ag->state = DT_CROWDAGENT_STATE_WALKING;
+			m_agentState[i] = DT_CROWDAGENT_STATE_WALKING;
 			continue;
 		}
 		
@@ -1399,19 +3127,40 @@ void dtCrowd::update(const float dt, dtCrowdAgentDebugInfo* debug)
 		if (anim->t < ta)
 		{
 			const float u = tween(anim->t, 0.0, ta);
-			dtVlerp(ag->npos, anim->initPos, anim->startPos, u);
+			dtVlerp(&m_agentPos[i*3], anim->initPos, anim->startPos, u);
 		}
 		else
 		{
 			const float u = tween(anim->t, ta, tb);
-			dtVlerp(ag->npos, anim->startPos, anim->endPos, u);
+			dtVlerp(&m_agentPos[i*3], anim->startPos, anim->endPos, u);
 		}
 			
 		// Update velocity.
-		dtVset(ag->vel, 0,0,0);
-		dtVset(ag->dvel, 0,0,0);
+		dtVset(&m_agentVel[i*3], 0,0,0);
+		dtVset(&m_agentDvel[i*3], 0,0,0);
 	}
 	
+	// Refresh the agent views.
+	for (int i = 0; i < m_nactiveAgents; ++i)
+		updateAgentView(getAgentIndex(m_activeAgents[i]));
+	
+	m_stats.moveTime = lapTime(time);
+	m_stats.totalTime = m_clock ? (int)(time - startTime) : 0;
+	m_stats.numAgents = nagents;
+	for (int i = 0; i < m_nworkers; ++i)
+		m_stats.numQueries += m_workers[i].queryCount;
+	m_stats.numVelocitySamples = m_velocitySampleCount;
+}
+
+/// Returns the time since @p time in microseconds and sets @p time to the current time.
+int dtCrowd::lapTime(unsigned int& time) const
+{
+	if (!m_clock)
+		return 0;
+	const unsigned int now = m_clock();
+	const int elapsed = (int)(now - time);
+	time = now;
+	return elapsed;
 }
 
 
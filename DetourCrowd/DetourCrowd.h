@@ -25,6 +25,7 @@
 #include "DetourPathCorridor.h"
 #include "DetourProximityGrid.h"
 #include "DetourPathQueue.h"
+#include "DetourFlowField.h"
 
 /// The maximum number of neighbors that a crowd agent can take into account
 /// for steering decisions.
@@ -45,6 +46,106 @@ static const int DT_CROWDAGENT_MAX_CORNERS = 4;
 ///		 dtCrowdAgentParams::obstacleAvoidanceType
 static const int DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS = 8;
 
+/// The number of agents allocated at a time is <tt>1 << DT_CROWD_AGENT_CHUNK_BITS</tt>.
+/// @ingroup crowd
+/// @see dtCrowd::addAgent()
+static const int DT_CROWD_AGENT_CHUNK_BITS = 6;
+
+/// The maximum number of agents a crowd can grow to. (The proximity grid uses 16 bit agent ids.)
+/// @ingroup crowd
+static const int DT_CROWD_MAX_AGENTS = 0x10000;
+
+/// The maximum number of batches the agents are split into to resolve their collisions.
+/// The agents of the last batch are resolved one at a time on the calling thread.
+/// @ingroup crowd
+/// @see dtCrowd::setCollisionIterations()
+static const int DT_CROWD_MAX_COLLISION_BATCHES = 32;
+
+/// A magic number used to detect the compatibility of crowd state data. (See: dtCrowd::storeState())
+/// @ingroup crowd
+static const int DT_CROWD_STATE_MAGIC = 'D'<<24 | 'C'<<16 | 'R'<<8 | 'S';
+
+/// A version number used to detect the compatibility of crowd state data. (See: dtCrowd::storeState())
+/// @ingroup crowd
+static const int DT_CROWD_STATE_VERSION = 2;
+
+/// The path maintenance tasks the crowd schedules for its agents within a budget.
+/// @ingroup crowd
+/// @see dtCrowdPathScheduleParams, dtCrowd::setPathSchedule()
+enum CrowdPathTask
+{
+	DT_CROWD_PATH_CHECK_VALIDITY = 0,	///< Check that the start of the corridor is still valid. (See: dtPathCorridor::isValid())
+	DT_CROWD_PATH_OPTIMIZE_VIS,			///< Shortcut the corridor towards a visible corner. (See: dtPathCorridor::optimizePathVisibility())
+	DT_CROWD_PATH_OPTIMIZE_TOPO,		///< Search the start of the corridor again. (See: dtPathCorridor::optimizePathTopology())
+};
+
+/// The number of path maintenance tasks. (See: #CrowdPathTask)
+/// @ingroup crowd
+static const int DT_CROWD_MAX_PATH_TASKS = 3;
+
+/// Configures the scheduling of the path maintenance tasks of the agents.
+///
+/// The cost of the tasks is measured in work units, one for each navigation mesh polygon
+/// a task's query is expected to visit.
+/// @ingroup crowd
+/// @see dtCrowd::setPathSchedule()
+struct dtCrowdPathScheduleParams
+{
+	/// The work units available to all tasks in one update. [Limit: >= 0]
+	int budget;
+	
+	/// The fraction of the budget reserved for each task. The part a task does not use
+	/// passes on to the next task. [(fraction) * #DT_CROWD_MAX_PATH_TASKS] [Limit: >= 0]
+	float budgetShare[DT_CROWD_MAX_PATH_TASKS];
+	
+	/// The minimum time between two runs of each task for one agent, in seconds.
+	/// [(time) * #DT_CROWD_MAX_PATH_TASKS] [Limit: >= 0]
+	float minInterval[DT_CROWD_MAX_PATH_TASKS];
+	
+	/// The number of corridor polygons checked by #DT_CROWD_PATH_CHECK_VALIDITY. A path is also
+	/// replanned when fewer polygons than this remain and the target has not been reached. [Limit: > 0]
+	int validityLookahead;
+};
+
+/// The scheduling statistics of a path maintenance task during the last update.
+/// @ingroup crowd
+/// @see dtCrowd::getPathTaskStats()
+struct dtCrowdPathTaskStats
+{
+	int numRun;			///< The number of agents the task was run for.
+	int numDeferred;	///< The number of agents due for the task which did not fit in the budget.
+	int cost;			///< The work units used by the task.
+	float maxWait;		///< The longest time an agent had waited for the task when it was run, in seconds.
+};
+
+/// Returns the current time in microseconds. Only the differences of the times are used, so the
+/// time may wrap around.
+/// @ingroup crowd
+/// @see dtCrowd::setStatsClock()
+typedef unsigned int (*dtCrowdClockFunc)();
+
+/// Statistics of the last #dtCrowd::update().
+/// The times are measured with the clock set by dtCrowd::setStatsClock(), and are zero without a clock.
+/// @ingroup crowd
+/// @see dtCrowd::getStats()
+struct dtCrowdStats
+{
+	int totalTime;				///< The time of the update, in microseconds.
+	int pathTime;				///< The time of the path validity checks, move requests, path queue and topology optimization.
+	int boundaryTime;			///< The time of the proximity grid, neighbour queries and local boundaries.
+	int steeringTime;			///< The time of the corners, visibility optimization and steering.
+	int avoidanceTime;			///< The time of the obstacle avoidance.
+	int collisionTime;			///< The time of the integration and collision handling.
+	int moveTime;				///< The time of the corridor moves and off-mesh connection animations.
+	
+	int numAgents;				///< The number of agents updated.
+	int numPathRequests;		///< The number of requests added to the path queue.
+	int numQueries;				///< The number of navigation mesh searches of the crowd, the path queue excluded.
+	int numNodes;				///< The number of nodes expanded by the path searches of the crowd and its path queue.
+	int numVelocitySamples;		///< The number of velocity samples of the obstacle avoidance.
+	int numCollisionIterations;	///< The number of collision iterations run before the collisions were resolved.
+};
+
 /// Provides neighbor data for agents managed by the crowd.
 /// @ingroup crowd
 /// @see dtCrowdAgent::neis, dtCrowd
@@ -63,6 +164,17 @@ enum CrowdAgentState
 	DT_CROWDAGENT_STATE_OFFMESH,		///< The agent is traversing an off-mesh connection.
 };
 
+/// The level of detail of the crowd update of an agent.
+/// @ingroup crowd
+/// @see dtCrowdAgentParams::lod, dtCrowd::setLodSchedule()
+enum CrowdAgentLOD
+{
+	DT_CROWDAGENT_LOD_FULL = 0,			///< The agent is fully updated every tick.
+	DT_CROWDAGENT_LOD_REDUCED,			///< The local boundary and obstacle avoidance are only updated when the agent is scheduled.
+	DT_CROWDAGENT_LOD_PATH_FOLLOW,		///< The agent follows its path without neighbours, obstacle avoidance or path optimization.
+	DT_CROWDAGENT_LOD_FROZEN,			///< The agent is not updated, it stays in place as an obstacle for the other agents.
+};
+
 /// Configuration parameters for a crowd agent.
 /// @ingroup crowd
 struct dtCrowdAgentParams
@@ -75,6 +187,9 @@ struct dtCrowdAgentParams
 	/// Defines how close a collision element must be before it is considered for steering behaviors. [Limits: > 0]
 	float collisionQueryRange;
 
+	/// How close another agent must be to be a neighbour, or 0 to use #collisionQueryRange. [Limit: >= 0]
+	float neighbourQueryRange;
+
 	float pathOptimizationRange;		///< The path visibility optimization range. [Limit: > 0]
 
 	/// How aggresive the agent manager should be at avoiding collisions with this agent. [Limit: >= 0]
@@ -87,6 +202,13 @@ struct dtCrowdAgentParams
 	/// [Limits: 0 <= value <= #DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS]
 	unsigned char obstacleAvoidanceType;	
 
+	/// The level of detail of the agent's update. (See: #CrowdAgentLOD)
+	unsigned char lod;
+
+	/// The maximum number of neighbours of the agent, or 0 for #DT_CROWDAGENT_MAX_NEIGHBOURS.
+	/// [Limits: 0 <= value <= #DT_CROWDAGENT_MAX_NEIGHBOURS]
+	unsigned char maxNeighbours;
+
 	/// User defined data attached to the agent.
 	void* userData;
 };
@@ -100,6 +222,7 @@ enum MoveRequestState
 	DT_CROWDAGENT_TARGET_WAITING_FOR_QUEUE,
 	DT_CROWDAGENT_TARGET_WAITING_FOR_PATH,
 	DT_CROWDAGENT_TARGET_VELOCITY,
+	DT_CROWDAGENT_TARGET_FLOW_FIELD,
 };
 
 /// Represents an agent managed by a #dtCrowd object.
@@ -109,6 +232,9 @@ struct dtCrowdAgent
 	/// 1 if the agent is active, or 0 if the agent is in an unused slot in the agent pool.
 	unsigned char active;
 
+	/// The index of the agent in the crowd. (See: dtCrowd::getAgent())
+	int idx;
+
 	/// The type of mesh polygon the agent is traversing. (See: #CrowdAgentState)
 	unsigned char state;
 
@@ -118,8 +244,17 @@ struct dtCrowdAgent
 	/// The local boundary data for the agent.
 	dtLocalBoundary boundary;
 	
-	/// Time since the agent's path corridor was optimized.
-	float topologyOptTime;
+	/// Time since each path maintenance task was run for the agent, in seconds. (See: #CrowdPathTask)
+	float pathTaskTime[DT_CROWD_MAX_PATH_TASKS];
+	
+	/// The path maintenance tasks scheduled for the agent in the current tick, one bit for each #CrowdPathTask.
+	unsigned char pathTasks;
+	
+	/// Time since the agent's last scheduled update. (See: #DT_CROWDAGENT_LOD_REDUCED)
+	float lodTime;
+	
+	/// True if the local boundary and obstacle avoidance of the agent are updated in the current tick.
+	bool lodUpdate;
 	
 	/// The known neighbors of the agent.
 	dtCrowdNeighbour neis[DT_CROWDAGENT_MAX_NEIGHBOURS];
@@ -157,6 +292,9 @@ struct dtCrowdAgent
 	dtPathQueueRef targetPathqRef;		///< Path finder ref.
 	bool targetReplan;					///< Flag indicating that the current path is being replanned.
 	float targetReplanTime;				/// <Time since the agent's target was replanned.
+	
+	const dtFlowField* flowField;		///< The flow field followed in case of DT_CROWDAGENT_TARGET_FLOW_FIELD.
+	unsigned int flowFieldVersion;		///< The version of the flow field the corridor was filled from.
 };
 
 struct dtCrowdAgentAnimation
@@ -186,22 +324,161 @@ struct dtCrowdAgentDebugInfo
 	dtObstacleAvoidanceDebugData* vod;
 };
 
+/// The query objects and the path queue shared by crowds on the same navigation mesh.
+/// @ingroup crowd
+/// @see dtCrowd::init()
+class dtCrowdQueryPool
+{
+	dtNavMesh* m_nav;
+	dtPathQueue m_pathq;
+	dtNavMeshQuery** m_navqueries;					///< One navigation mesh query for each worker. [Size: #m_nworkers]
+	dtObstacleAvoidanceQuery** m_obstacleQueries;	///< One obstacle avoidance query for each worker. [Size: #m_nworkers]
+	int m_nworkers;
+	
+	void purgeWorkers();
+	void purge();
+	
+public:
+	dtCrowdQueryPool();
+	~dtCrowdQueryPool();
+	
+	/// Initializes the pool.
+	///  @param[in]		nav				The navigation mesh the crowds use.
+	///  @param[in]		maxPathRequests	The maximum number of path requests of all crowds in the path queue. [Limit: > 0]
+	///  @param[in]		maxPathSearches	The number of path searches run at the same time. [Limit: > 0]
+	/// @return True if the initialization succeeded.
+	bool init(dtNavMesh* nav, const int maxPathRequests, const int maxPathSearches);
+	
+	/// Sets the dispatcher used to run the path searches in parallel, and allocates the query
+	/// objects for its workers. The crowds using the pool may use the same dispatcher.
+	///  @param[in]		dispatcher	The job dispatcher, or null to use one worker.
+	/// @return True if the query objects could be allocated.
+	bool setJobDispatcher(dtCrowdJobDispatcher* dispatcher);
+	
+	/// Updates the shared path queue. Call once per update of the crowds.
+	///  @param[in]		maxIters	The maximum number of pathfinder iterations used by each search.
+	void update(const int maxIters);
+	
+	/// The navigation mesh the crowds use.
+	dtNavMesh* getNavMesh() const { return m_nav; }
+	
+	/// The number of workers the pool has query objects for.
+	int getWorkerCount() const { return m_nworkers; }
+	
+	/// The navigation mesh query of a worker. [Limits: 0 <= @p worker < #getWorkerCount()]
+	dtNavMeshQuery* getNavMeshQuery(const int worker) const { return m_navqueries[worker]; }
+	
+	/// The obstacle avoidance query of a worker. [Limits: 0 <= @p worker < #getWorkerCount()]
+	dtObstacleAvoidanceQuery* getObstacleAvoidanceQuery(const int worker) const { return m_obstacleQueries[worker]; }
+	
+	/// Sets how close the path requests of agents between the same polygons must be to share a search.
+	/// The setting applies to the requests of all crowds using the pool.
+	///  @param[in]		dist		The distance between the start and end positions of the requests,
+	///  							or a negative value to search a path for every agent. [Default: -1]
+	void setPathShareDistance(const float dist) { m_pathq.setShareDistance(dist); }
+	
+	/// The distance within which the path requests of the crowds share a search.
+	float getPathShareDistance() const { return m_pathq.getShareDistance(); }
+	
+	/// The path queue shared by the crowds.
+	dtPathQueue* getPathQueue() { return &m_pathq; }
+};
+
+/// Allocates a crowd query pool object using the Detour allocator.
+/// @return A crowd query pool object that is ready for initialization, or null on failure.
+///  @ingroup crowd
+dtCrowdQueryPool* dtAllocCrowdQueryPool();
+
+/// Frees the specified crowd query pool object using the Detour allocator.
+///  @param[in]		ptr		A crowd query pool object allocated using #dtAllocCrowdQueryPool
+///  @ingroup crowd
+void dtFreeCrowdQueryPool(dtCrowdQueryPool* ptr);
+
 /// Provides local steering behaviors for a group of agents. 
 /// @ingroup crowd
 class dtCrowd
 {
+	/// The per-agent phases of #update() that can be dispatched to workers.
+	enum UpdatePhase
+	{
+		PHASE_CHECK_PATH_VALIDITY,
+		PHASE_NEIGHBOURS,
+		PHASE_BOUNDARY_SEGMENTS,
+		PHASE_CORNERS,
+		PHASE_STEERING,
+		PHASE_VELOCITY_PLANNING,
+		PHASE_INTEGRATE,
+		PHASE_COLLISION_CONTACTS,
+		PHASE_COLLISION,
+		PHASE_MOVE,
+	};
+
+	/// The query objects used by one worker.
+	struct Worker
+	{
+		dtNavMeshQuery* navquery;
+		dtObstacleAvoidanceQuery* obstacleQuery;
+		int velocitySampleCount;
+		int queryCount;
+		int unresolvedCount;		///< The number of agents moved more than the tolerance by the collision iteration.
+	};
+
+	/// The state shared by the jobs of an update phase.
+	struct UpdateJob
+	{
+		dtCrowd* crowd;
+		int phase;
+		dtCrowdAgent** agents;
+		int nagents;
+		float dt;
+		dtCrowdAgentDebugInfo* debug;
+		int iteration;				///< The current collision iteration.
+	};
+
 	int m_maxAgents;
-	dtCrowdAgent* m_agents;
-	dtCrowdAgent** m_activeAgents;
+	dtCrowdAgent** m_agentChunks;		///< The agents, allocated in chunks of <tt>1 << #DT_CROWD_AGENT_CHUNK_BITS</tt>. [Size: #m_nagentChunks]
+	int m_nagentChunks;
+	dtCrowdAgent** m_activeAgents;		///< The active agents, packed. [(#dtCrowdAgent *) * #m_nactiveAgents]
+	int m_nactiveAgents;
+	int* m_activeSlots;					///< The index of each agent in #m_activeAgents, or -1 if inactive. [Size: #m_maxAgents]
+	int* m_freeAgents;					///< Stack of the free agent indices. [Size: #m_maxAgents]
+	int m_nfreeAgents;
+	dtCrowdAgent** m_updateAgents;		///< The agents updated in the current tick. [(#dtCrowdAgent *) * #m_nupdateAgents]
+	int m_nupdateAgents;
+	dtCrowdAgent** m_lodQueue;			///< The reduced detail agents scheduled for update. [Size: #m_maxAgents]
+	float m_lodInterval;
+	int m_lodBudget;
+	dtCrowdPathScheduleParams m_pathSchedule;
+	dtCrowdPathTaskStats m_pathTaskStats[DT_CROWD_MAX_PATH_TASKS];
+	int m_pathTaskCursor[DT_CROWD_MAX_PATH_TASKS];	///< The position in #m_updateAgents where each task continues.
 	dtCrowdAgentAnimation* m_agentAnims;
+
+	// The fields of the agents that are streamed by the update passes, stored as structure of arrays
+	// and indexed by agent index. The same fields in #dtCrowdAgent are a view refreshed by updateAgentView().
+	float* m_agentPos;				///< The agent positions. [(x, y, z) * #m_maxAgents]
+	float* m_agentVel;				///< The actual agent velocities. [(x, y, z) * #m_maxAgents]
+	float* m_agentDvel;				///< The desired agent velocities. [(x, y, z) * #m_maxAgents]
+	float* m_agentNvel;				///< The new agent velocities. [(x, y, z) * #m_maxAgents]
+	float* m_agentDisp;				///< The collision displacements. [(x, y, z) * #m_maxAgents]
+	unsigned char* m_agentContacts;	///< The neighbours the agent may collide with. [(bit per #dtCrowdAgent::neis) * #m_maxAgents]
+	unsigned char* m_agentBatch;	///< The collision batch of the agent. [(batch) * #m_maxAgents]
+	unsigned int* m_agentBatchMask;	///< The batches the agent cannot join. [(bit per batch) * #m_maxAgents]
+	int* m_agentMoved;				///< The last collision iteration that moved the agent, or -1. [(iteration) * #m_maxAgents]
+	float* m_agentRadius;			///< The agent radii. [(radius) * #m_maxAgents]
+	unsigned char* m_agentState;	///< The agent states. (See: #CrowdAgentState) [(state) * #m_maxAgents]
 	
 	dtPathQueue m_pathq;
+	dtPathQueue* m_pathQueue;			///< The path queue in use, #m_pathq or the one of #m_pool.
+	int m_pathQueueQuota;				///< The maximum number of agents waiting for the path queue.
+	dtCrowdQueryPool* m_pool;			///< The pool of the query objects, or null if the crowd owns them.
 
 	dtObstacleAvoidanceParams m_obstacleQueryParams[DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS];
 	dtObstacleAvoidanceQuery* m_obstacleQuery;
 	
 	dtProximityGrid* m_grid;
 	
+	dtLocalBoundaryCache m_boundaryCache;	///< The wall segments shared by the boundaries updated in a tick.
+	
 	dtPolyRef* m_pathResult;
 	int m_maxPathResult;
 	
@@ -211,17 +488,50 @@ class dtCrowd
 	float m_maxAgentRadius;
 
 	int m_velocitySampleCount;
+	
+	dtCrowdAgent** m_collisionAgents;	///< The colliding agents sorted by batch. [Size: #m_maxAgents]
+	int m_collisionBatches[DT_CROWD_MAX_COLLISION_BATCHES+1];	///< The first agent of each batch in #m_collisionAgents.
+	int m_collisionIterations;
+	
+	dtCrowdStats m_stats;
+	dtCrowdClockFunc m_clock;
 
 	dtNavMeshQuery* m_navquery;
 
-	void updateTopologyOptimization(dtCrowdAgent** agents, const int nagents, const float dt);
+	dtCrowdJobDispatcher* m_dispatcher;
+	Worker* m_workers;
+	int m_nworkers;
+	
+	bool m_deterministic;
+
+	void updatePathSchedule(dtCrowdAgent** agents, const int nagents, const float dt);
+	void updateTopologyOptimization(dtCrowdAgent** agents, const int nagents);
 	void updateMoveRequest(const float dt);
-	void checkPathValidity(dtCrowdAgent** agents, const int nagents, const float dt);
+	void updateLodSchedule(const float dt);
+	void checkPathValidity(dtCrowdAgent** agents, const int nagents, const float dt, Worker& worker);
+	bool repairCorridor(dtCrowdAgent* ag, const dtTileRef* tiles, const int ntiles);
+	void buildCollisionBatches(dtCrowdAgent** agents, const int nagents);
+	int lapTime(unsigned int& time) const;
+
+	static void runUpdateJob(void* data, const int jobIdx, const int workerIdx);
+	void runUpdatePhase(UpdateJob& job, const int phase);
+	void updatePhase(const UpdateJob& job, const int i0, const int i1, Worker& worker);
+
+	inline int getAgentIndex(const dtCrowdAgent* agent) const  { return agent->idx; }
+	inline dtCrowdAgent* getAgentAt(const int idx) const
+	{
+		return &m_agentChunks[idx >> DT_CROWD_AGENT_CHUNK_BITS][idx & ((1 << DT_CROWD_AGENT_CHUNK_BITS) - 1)];
+	}
+	
+	bool growAgents(const int maxAgents);
 
-	inline int getAgentIndex(const dtCrowdAgent* agent) const  { return agent - m_agents; }
+	void updateAgentView(const int idx);
 
 	bool requestMoveTargetReplan(const int idx, dtPolyRef ref, const float* pos);
 
+	bool initCrowd(const int maxAgents, const float maxAgentRadius, dtNavMesh* nav, dtCrowdQueryPool* pool);
+	bool initWorkers(const int nworkers);
+	void purgeWorkers();
 	void purge();
 	
 public:
@@ -229,12 +539,19 @@ public:
 	~dtCrowd();
 	
 	/// Initializes the crowd.  
-	///  @param[in]		maxAgents		The maximum number of agents the crowd can manage. [Limit: >= 1]
+	///  @param[in]		maxAgents		The number of agents the crowd allocates up front. [Limit: >= 1]
 	///  @param[in]		maxAgentRadius	The maximum radius of any agent that will be added to the crowd. [Limit: > 0]
 	///  @param[in]		nav				The navigation mesh to use for planning.
 	/// @return True if the initialization succeeded.
 	bool init(const int maxAgents, const float maxAgentRadius, dtNavMesh* nav);
 	
+	/// Initializes the crowd to use the query objects and the path queue of a pool.
+	///  @param[in]		maxAgents		The number of agents the crowd allocates up front. [Limit: >= 1]
+	///  @param[in]		maxAgentRadius	The maximum radius of any agent that will be added to the crowd. [Limit: > 0]
+	///  @param[in]		pool			The pool to use. Must stay valid while the crowd uses it.
+	/// @return True if the initialization succeeded.
+	bool init(const int maxAgents, const float maxAgentRadius, dtCrowdQueryPool* pool);
+	
 	/// Sets the shared avoidance configuration for the specified index.
 	///  @param[in]		idx		The index. [Limits: 0 <= value < #DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS]
 	///  @param[in]		params	The new configuration.
@@ -251,10 +568,14 @@ public:
 	/// @return The requested agent.
 	const dtCrowdAgent* getAgent(const int idx);
 
-	/// The maximum number of agents that can be managed by the object.
-	/// @return The maximum number of agents.
+	/// The number of agents allocated by the object, active or not.
+	/// @return The number of allocated agents.
 	const int getAgentCount() const;
 	
+	/// The number of agents currently in use.
+	/// @return The number of active agents.
+	int getActiveAgentCount() const { return m_nactiveAgents; }
+	
 	/// Adds a new agent to the crowd.
 	///  @param[in]		pos		The requested position of the agent. [(x, y, z)]
 	///  @param[in]		params	The configutation of the agent.
@@ -282,11 +603,23 @@ public:
 	///  @param[in]		vel		The movement velocity. [(x, y, z)]
 	/// @return True if the request was successfully submitted.
 	bool requestMoveVelocity(const int idx, const float* vel);
+	
+	/// Makes the specified agent follow a flow field towards its goal.
+	///  @param[in]		idx		The agent index. [Limits: 0 <= value < #getAgentCount()]
+	///  @param[in]		field	The flow field to follow. Must stay valid while the agent follows it.
+	/// @return True if the request was successfully submitted.
+	bool requestMoveFlowField(const int idx, const dtFlowField* field);
 
 	/// Resets any request for the specified agent.
 	///  @param[in]		idx		The agent index. [Limits: 0 <= value < #getAgentCount()]
 	/// @return True if the request was successfully reseted.
 	bool resetMoveTarget(const int idx);
+	
+	/// Repairs the corridors of the agents which pass through rebuilt tiles of the navigation mesh.
+	///  @param[in]		tiles	The references the tiles had before they were rebuilt. [(tileRef) * @p ntiles]
+	///  @param[in]		ntiles	The number of tiles.
+	/// @return The number of corridors repaired.
+	int repairCorridors(const dtTileRef* tiles, const int ntiles);
 
 	/// Gets the active agents int the agent pool.
 	///  @param[out]	agents		An array of agent pointers. [(#dtCrowdAgent *) * maxAgents]
@@ -298,6 +631,94 @@ public:
 	///  @param[in]		dt		The time, in seconds, to update the simulation. [Limit: > 0]
 	///  @param[out]	debug	A debug object to load with debug information. [Opt]
 	void update(const float dt, dtCrowdAgentDebugInfo* debug);
+
+	/// Sets the dispatcher used to run the per-agent phases of #update() in parallel.
+	///  @param[in]		dispatcher	The job dispatcher, or null to run the update on the calling thread.
+	/// @return True if the query objects for the dispatcher's workers could be allocated.
+	bool setJobDispatcher(dtCrowdJobDispatcher* dispatcher);
+
+	/// Sets how often the agents using #DT_CROWDAGENT_LOD_REDUCED are updated.
+	///  @param[in]		interval	The time between the updates of an agent, in seconds. [Limit: >= 0]
+	///  @param[in]		maxAgents	The maximum number of agents updated per tick. [Limit: > 0]
+	void setLodSchedule(const float interval, const int maxAgents);
+	
+	/// The time between the updates of the reduced detail agents, in seconds.
+	float getLodInterval() const { return m_lodInterval; }
+	
+	/// The maximum number of reduced detail agents updated per tick.
+	int getLodBudget() const { return m_lodBudget; }
+	
+	/// Sets how the path maintenance tasks of the agents are scheduled.
+	///  @param[in]		params	The new configuration.
+	void setPathSchedule(const dtCrowdPathScheduleParams* params);
+	
+	/// Gets how the path maintenance tasks of the agents are scheduled.
+	/// @return The path schedule configuration.
+	const dtCrowdPathScheduleParams* getPathSchedule() const { return &m_pathSchedule; }
+	
+	/// Gets the scheduling statistics of a path maintenance task during the last update.
+	///  @param[in]		task	The task. (See: #CrowdPathTask)
+	/// @return The statistics of the task.
+	const dtCrowdPathTaskStats* getPathTaskStats(const int task) const { return &m_pathTaskStats[task]; }
+	
+	/// Sets whether the crowd update gives bitwise identical results on all platforms.
+	///  @param[in]		deterministic	True to enable the deterministic mode.
+	void setDeterministic(const bool deterministic);
+	
+	/// True if the crowd is in deterministic mode. (See: #setDeterministic())
+	bool isDeterministic() const { return m_deterministic; }
+	
+	/// Gets a hash of the simulation state of the agents, to check that two crowds are in sync.
+	/// @return The hash of the state of the active agents.
+	unsigned int getStateHash() const;
+	
+	/// Gets the size of the buffer required by #storeState() to store the crowd's current state.
+	/// @return The size of the buffer required to store the state.
+	int getStateSize() const;
+	
+	/// Stores the agents and the settings of the crowd in the specified buffer.
+	///  @param[out]	data			The buffer to store the crowd's state in.
+	///  @param[in]		maxDataSize		The size of the data buffer. [Limit: >= #getStateSize()]
+	/// @return The status flags for the operation.
+	dtStatus storeState(unsigned char* data, const int maxDataSize) const;
+	
+	/// Replaces the agents and the settings of the crowd with a stored state.
+	///  @param[in]		data			The state. (Obtained from #storeState().)
+	///  @param[in]		dataSize		The size of the state within the data buffer.
+	/// @return The status flags for the operation.
+	dtStatus restoreState(const unsigned char* data, const int dataSize);
+	
+	/// Sets how close the path requests of agents between the same polygons must be to share a search.
+	///  @param[in]		dist		The distance between the start and end positions of the requests,
+	///  							or a negative value to search a path for every agent.
+	/// @return False if the crowd uses the path queue of a pool.
+	bool setPathShareDistance(const float dist);
+	
+	/// The distance within which the path requests of agents share a search.
+	float getPathShareDistance() const { return m_pathQueue->getShareDistance(); }
+	
+	/// Sets how many agents of the crowd can wait for the path queue at the same time.
+	///  @param[in]		maxRequests		The maximum number of requests. [Limit: > 0]
+	void setPathQueueQuota(const int maxRequests);
+	
+	/// The maximum number of agents of the crowd waiting for the path queue at the same time.
+	int getPathQueueQuota() const { return m_pathQueueQuota; }
+	
+	/// Sets the maximum number of collision iterations of an update.
+	/// The iterations stop early when the collisions have been resolved.
+	///  @param[in]		maxIterations	The maximum number of iterations. [Limit: >= 0]
+	void setCollisionIterations(const int maxIterations);
+	
+	/// The maximum number of collision iterations of an update.
+	int getCollisionIterations() const { return m_collisionIterations; }
+	
+	/// Gets the query pool used by the crowd.
+	/// @return The query pool, or null if the crowd owns its query objects.
+	dtCrowdQueryPool* getQueryPool() const { return m_pool; }
+
+	/// Gets the job dispatcher used by the crowd.
+	/// @return The job dispatcher, or null if the update runs on the calling thread.
+	dtCrowdJobDispatcher* getJobDispatcher() const { return m_dispatcher; }
 	
 	/// Gets the filter used by the crowd.
 	/// @return The filter used by the crowd.
@@ -315,13 +736,25 @@ public:
 	/// @return The velocity sample count.
 	inline int getVelocitySampleCount() const { return m_velocitySampleCount; }
 	
+	/// Sets the clock used to time the phases of #update().
+	///  @param[in]		clock	The clock, or null to not measure the times.
+	void setStatsClock(dtCrowdClockFunc clock) { m_clock = clock; }
+	
+	/// Gets the statistics of the last update.
+	/// @return The statistics of the last update.
+	const dtCrowdStats* getStats() const { return &m_stats; }
+	
 	/// Gets the crowd's proximity grid.
 	/// @return The crowd's proximity grid.
 	const dtProximityGrid* getGrid() const { return m_grid; }
+	
+	/// Gets the wall segments extracted for the local boundaries during the last update.
+	/// @return The crowd's local boundary cache.
+	const dtLocalBoundaryCache* getBoundaryCache() const { return &m_boundaryCache; }
 
 	/// Gets the crowd's path request queue.
 	/// @return The crowd's path request queue.
-	const dtPathQueue* getPathQueue() const { return &m_pathq; }
+	const dtPathQueue* getPathQueue() const { return m_pathQueue; }
 
 	/// Gets the query object used by the crowd.
 	const dtNavMeshQuery* getNavMeshQuery() const { return m_navquery; }
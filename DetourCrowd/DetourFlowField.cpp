@@ -0,0 +1,577 @@
+﻿//
+// Copyright (c) 2009-2010 Mikko Mononen memon@inside.org
+//
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+
+#include <float.h>
+#include <string.h>
+#include <new>
+#include "DetourFlowField.h"
+#include "DetourNavMesh.h"
+#include "DetourNavMeshQuery.h"
+#include "DetourCommon.h"
+#include "DetourAlloc.h"
+#include "DetourAssert.h"
+
+/// The node count of the query used to find the goal polygon, which does not search.
+static const int GOAL_QUERY_NODES = 32;
+
+dtFlowField* dtAllocFlowField()
+{
+	void* mem = dtAlloc(sizeof(dtFlowField), DT_ALLOC_PERM);
+	if (!mem) return 0;
+	return new(mem) dtFlowField;
+}
+
+void dtFreeFlowField(dtFlowField* ptr)
+{
+	if (!ptr) return;
+	ptr->~dtFlowField();
+	dtFree(ptr);
+}
+
+
+inline unsigned int hashPolyRef(dtPolyRef a)
+{
+	a += ~(a<<15);
+	a ^=  (a>>10);
+	a +=  (a<<3);
+	a ^=  (a>>6);
+	a += ~(a<<11);
+	a ^=  (a>>16);
+	return (unsigned int)a;
+}
+
+// Returns the middle of the portal from polygon 'from' to polygon 'to',
+// fails if there is no link from 'from' to 'to'.
+static dtStatus getEdgeMidPoint(dtPolyRef from, const dtMeshTile* fromTile, const dtPoly* fromPoly,
+								dtPolyRef to, const dtMeshTile* toTile, const dtPoly* toPoly, float* mid)
+{
+	const dtLink* link = 0;
+	for (unsigned int i = fromPoly->firstLink; i != DT_NULL_LINK; i = fromTile->links[i].next)
+	{
+		if (fromTile->links[i].ref == to)
+		{
+			link = &fromTile->links[i];
+			break;
+		}
+	}
+	if (!link)
+		return DT_FAILURE | DT_INVALID_PARAM;
+	
+	// Off-mesh connections meet the ground at their end vertices.
+	if (fromPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+	{
+		dtVcopy(mid, &fromTile->verts[fromPoly->verts[link->edge]*3]);
+		return DT_SUCCESS;
+	}
+	if (toPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+	{
+		for (unsigned int i = toPoly->firstLink; i != DT_NULL_LINK; i = toTile->links[i].next)
+		{
+			if (toTile->links[i].ref == from)
+			{
+				dtVcopy(mid, &toTile->verts[toPoly->verts[toTile->links[i].edge]*3]);
+				return DT_SUCCESS;
+			}
+		}
+		return DT_FAILURE | DT_INVALID_PARAM;
+	}
+	
+	const float* va = &fromTile->verts[fromPoly->verts[link->edge]*3];
+	const float* vb = &fromTile->verts[fromPoly->verts[(link->edge+1) % (int)fromPoly->vertCount]*3];
+	float tmin = 0.0f, tmax = 1.0f;
+	
+	// At tile borders the portal is limited to the part shared with the neighbour.
+	if (link->side != 0xff && (link->bmin != 0 || link->bmax != 255))
+	{
+		const float s = 1.0f/255.0f;
+		tmin = link->bmin*s;
+		tmax = link->bmax*s;
+	}
+	dtVlerp(mid, va, vb, (tmin+tmax)*0.5f);
+	
+	return DT_SUCCESS;
+}
+
+
+dtFlowField::dtFlowField() :
+	m_nav(0),
+	m_navquery(0),
+	m_entries(0),
+	m_nentries(0),
+	m_maxEntries(0),
+	m_buckets(0),
+	m_bucketsSize(0),
+	m_heap(0),
+	m_nheap(0),
+	m_state(0),
+	m_goalRef(0),
+	m_version(1)
+{
+	dtVset(m_goalPos, 0,0,0);
+}
+
+dtFlowField::~dtFlowField()
+{
+	purge();
+}
+
+void dtFlowField::purge()
+{
+	dtFree(m_entries);
+	m_entries = 0;
+	m_maxEntries = 0;
+	dtFree(m_buckets);
+	m_buckets = 0;
+	m_bucketsSize = 0;
+	dtFree(m_heap);
+	m_heap = 0;
+	dtFree(m_state);
+	m_state = 0;
+	dtFreeNavMeshQuery(m_navquery);
+	m_navquery = 0;
+	m_nentries = 0;
+	m_nheap = 0;
+}
+
+bool dtFlowField::init(const dtNavMesh* nav, const int maxPolys)
+{
+	dtAssert(maxPolys > 0);
+	
+	purge();
+	
+	m_nav = nav;
+	
+	m_entries = (Entry*)dtAlloc(sizeof(Entry)*maxPolys, DT_ALLOC_PERM);
+	if (!m_entries)
+		return false;
+	m_maxEntries = maxPolys;
+	
+	m_bucketsSize = (int)dtNextPow2((unsigned int)dtMax(maxPolys/4, 1));
+	m_buckets = (int*)dtAlloc(sizeof(int)*m_bucketsSize, DT_ALLOC_PERM);
+	if (!m_buckets)
+		return false;
+	
+	m_heap = (int*)dtAlloc(sizeof(int)*maxPolys, DT_ALLOC_PERM);
+	if (!m_heap)
+		return false;
+	
+	m_state = (unsigned char*)dtAlloc(sizeof(unsigned char)*maxPolys, DT_ALLOC_PERM);
+	if (!m_state)
+		return false;
+	
+	// The query only looks up the goal polygon, it does not search.
+	m_navquery = dtAllocNavMeshQuery();
+	if (!m_navquery)
+		return false;
+	if (dtStatusFailed(m_navquery->init(nav, GOAL_QUERY_NODES)))
+		return false;
+	
+	clear();
+	m_goalRef = 0;
+	
+	return true;
+}
+
+void dtFlowField::clear()
+{
+	memset(m_buckets, 0xff, sizeof(int)*m_bucketsSize);
+	m_nentries = 0;
+	m_nheap = 0;
+}
+
+int dtFlowField::findEntry(dtPolyRef ref) const
+{
+	const int h = (int)(hashPolyRef(ref) & (m_bucketsSize-1));
+	for (int i = m_buckets[h]; i != -1; i = m_entries[i].next)
+	{
+		if (m_entries[i].ref == ref)
+			return i;
+	}
+	return -1;
+}
+
+int dtFlowField::addEntry(dtPolyRef ref)
+{
+	if (m_nentries >= m_maxEntries)
+		return -1;
+	
+	const int h = (int)(hashPolyRef(ref) & (m_bucketsSize-1));
+	const int idx = m_nentries++;
+	Entry& e = m_entries[idx];
+	e.ref = ref;
+	e.cost = FLT_MAX;
+	e.parent = -1;
+	e.heapIdx = -1;
+	e.next = m_buckets[h];
+	m_buckets[h] = idx;
+	
+	return idx;
+}
+
+void dtFlowField::rebuildHash()
+{
+	memset(m_buckets, 0xff, sizeof(int)*m_bucketsSize);
+	for (int i = 0; i < m_nentries; ++i)
+	{
+		const int h = (int)(hashPolyRef(m_entries[i].ref) & (m_bucketsSize-1));
+		m_entries[i].next = m_buckets[h];
+		m_buckets[h] = i;
+	}
+}
+
+void dtFlowField::heapBubbleUp(int i, const int idx)
+{
+	const float cost = m_entries[idx].cost;
+	int parent = (i-1)/2;
+	// note: (index > 0) means there is a parent
+	while ((i > 0) && (m_entries[m_heap[parent]].cost > cost))
+	{
+		m_heap[i] = m_heap[parent];
+		m_entries[m_heap[i]].heapIdx = i;
+		i = parent;
+		parent = (i-1)/2;
+	}
+	m_heap[i] = idx;
+	m_entries[idx].heapIdx = i;
+}
+
+void dtFlowField::heapTrickleDown(int i, const int idx)
+{
+	const float cost = m_entries[idx].cost;
+	int child = (i*2)+1;
+	while (child < m_nheap)
+	{
+		if (((child+1) < m_nheap) &&
+			(m_entries[m_heap[child]].cost > m_entries[m_heap[child+1]].cost))
+		{
+			child++;
+		}
+		if (m_entries[m_heap[child]].cost >= cost)
+			break;
+		m_heap[i] = m_heap[child];
+		m_entries[m_heap[i]].heapIdx = i;
+		i = child;
+		child = (i*2)+1;
+	}
+	m_heap[i] = idx;
+	m_entries[idx].heapIdx = i;
+}
+
+void dtFlowField::heapPush(const int idx)
+{
+	m_nheap++;
+	heapBubbleUp(m_nheap-1, idx);
+}
+
+int dtFlowField::heapPop()
+{
+	const int result = m_heap[0];
+	m_entries[result].heapIdx = -1;
+	m_nheap--;
+	if (m_nheap > 0)
+		heapTrickleDown(0, m_heap[m_nheap]);
+	return result;
+}
+
+bool dtFlowField::hasUnreachedNeighbour(const int idx) const
+{
+	const dtMeshTile* tile = 0;
+	const dtPoly* poly = 0;
+	m_nav->getTileAndPolyByRefUnsafe(m_entries[idx].ref, &tile, &poly);
+	
+	for (unsigned int i = poly->firstLink; i != DT_NULL_LINK; i = tile->links[i].next)
+	{
+		const dtPolyRef neiRef = tile->links[i].ref;
+		if (!neiRef || findEntry(neiRef) != -1)
+			continue;
+		const dtMeshTile* neiTile = 0;
+		const dtPoly* neiPoly = 0;
+		m_nav->getTileAndPolyByRefUnsafe(neiRef, &neiTile, &neiPoly);
+		if (m_filter.passFilter(neiRef, neiTile, neiPoly))
+			return true;
+	}
+	return false;
+}
+
+/// Runs the search until the open heap is empty.
+dtStatus dtFlowField::expand()
+{
+	dtStatus status = DT_SUCCESS;
+	
+	while (m_nheap)
+	{
+		const int cur = heapPop();
+		const dtPolyRef curRef = m_entries[cur].ref;
+		const dtMeshTile* curTile = 0;
+		const dtPoly* curPoly = 0;
+		m_nav->getTileAndPolyByRefUnsafe(curRef, &curTile, &curPoly);
+		
+		// The polygon the flow continues to from the current one.
+		const int parent = m_entries[cur].parent;
+		const dtPolyRef nextRef = parent != -1 ? m_entries[parent].ref : 0;
+		const dtMeshTile* nextTile = 0;
+		const dtPoly* nextPoly = 0;
+		if (nextRef)
+			m_nav->getTileAndPolyByRefUnsafe(nextRef, &nextTile, &nextPoly);
+		
+		for (unsigned int i = curPoly->firstLink; i != DT_NULL_LINK; i = curTile->links[i].next)
+		{
+			const dtPolyRef neiRef = curTile->links[i].ref;
+			if (!neiRef || neiRef == nextRef)
+				continue;
+			
+			const dtMeshTile* neiTile = 0;
+			const dtPoly* neiPoly = 0;
+			m_nav->getTileAndPolyByRefUnsafe(neiRef, &neiTile, &neiPoly);
+			if (!m_filter.passFilter(neiRef, neiTile, neiPoly))
+				continue;
+			
+			// The agents move from the neighbour into the current polygon,
+			// skip one-way links which lead the other way.
+			float mid[3];
+			if (dtStatusFailed(getEdgeMidPoint(neiRef, neiTile, neiPoly, curRef, curTile, curPoly, mid)))
+				continue;
+			
+			const float cost = m_entries[cur].cost +
+				m_filter.getCost(mid, m_entries[cur].pos,
+								 neiRef, neiTile, neiPoly,
+								 curRef, curTile, curPoly,
+								 nextRef, nextTile, nextPoly);
+			
+			int nei = findEntry(neiRef);
+			if (nei == -1)
+			{
+				nei = addEntry(neiRef);
+				if (nei == -1)
+				{
+					status |= DT_OUT_OF_NODES;
+					continue;
+				}
+			}
+			else if (cost >= m_entries[nei].cost)
+			{
+				continue;
+			}
+			
+			Entry& e = m_entries[nei];
+			e.cost = cost;
+			e.parent = cur;
+			dtVcopy(e.pos, mid);
+			if (e.heapIdx == -1)
+				heapPush(nei);
+			else
+				heapBubbleUp(e.heapIdx, nei);
+		}
+	}
+	
+	return status;
+}
+
+/// @par
+///
+/// The search visits every polygon connected to the goal which passes the filter, or until
+/// the field is full.
+dtStatus dtFlowField::build(dtPolyRef goalRef, const float* goalPos, const dtQueryFilter* filter)
+{
+	dtAssert(m_nav);
+	
+	m_filter = *filter;
+	m_goalRef = goalRef;
+	dtVcopy(m_goalPos, goalPos);
+	
+	clear();
+	m_version++;
+	if (!m_version)
+		m_version++;
+	
+	if (!goalRef || !m_nav->isValidPolyRef(goalRef))
+	{
+		m_goalRef = 0;
+		return DT_FAILURE | DT_INVALID_PARAM;
+	}
+	
+	const int goal = addEntry(goalRef);
+	m_entries[goal].cost = 0.0f;
+	dtVcopy(m_entries[goal].pos, goalPos);
+	heapPush(goal);
+	
+	return expand();
+}
+
+/// @par
+///
+/// The polygons in the changed tiles, and the polygons whose flow led through them, are removed
+/// from the field. The search is then continued from the remaining polygons which border an
+/// unreached polygon. Polygons which get a cheaper route through the changed tiles are updated too.
+dtStatus dtFlowField::updateTiles(const dtTileRef* tiles, const int ntiles)
+{
+	enum EntryState
+	{
+		ENTRY_UNKNOWN = 0,
+		ENTRY_KEEP,
+		ENTRY_REMOVE,
+	};
+	
+	if (!m_goalRef)
+		return DT_FAILURE;
+	
+	// The goal polygon is gone, e.g. its tile was rebuilt by the tile cache.
+	if (!m_nav->isValidPolyRef(m_goalRef))
+		return rebuildGoal();
+	
+	// Find the polygons which are gone or in a changed tile.
+	bool goalChanged = false;
+	for (int i = 0; i < m_nentries; ++i)
+	{
+		const dtPolyRef ref = m_entries[i].ref;
+		m_state[i] = ENTRY_UNKNOWN;
+		if (!m_nav->isValidPolyRef(ref))
+		{
+			m_state[i] = ENTRY_REMOVE;
+			continue;
+		}
+		const unsigned int it = m_nav->decodePolyIdTile(ref);
+		for (int j = 0; j < ntiles; ++j)
+		{
+			if (m_nav->decodePolyIdTile((dtPolyRef)tiles[j]) == it)
+			{
+				m_state[i] = ENTRY_REMOVE;
+				if (ref == m_goalRef)
+					goalChanged = true;
+				break;
+			}
+		}
+	}
+	
+	// Everything depends on the goal polygon, search again from scratch.
+	if (goalChanged)
+		return rebuildGoal();
+	
+	// A polygon is removed if its flow leads through a removed polygon.
+	// Follow the flow to the first polygon with a known state, using the heap as a stack.
+	for (int i = 0; i < m_nentries; ++i)
+	{
+		int nstack = 0;
+		int j = i;
+		while (j != -1 && m_state[j] == ENTRY_UNKNOWN)
+		{
+			m_heap[nstack++] = j;
+			j = m_entries[j].parent;
+		}
+		const unsigned char state = j == -1 ? (unsigned char)ENTRY_KEEP : m_state[j];
+		for (int k = 0; k < nstack; ++k)
+			m_state[m_heap[k]] = state;
+	}
+	
+	// Compact the kept polygons, using the heap to remap the parents.
+	int n = 0;
+	for (int i = 0; i < m_nentries; ++i)
+	{
+		if (m_state[i] == ENTRY_REMOVE)
+		{
+			m_heap[i] = -1;
+			continue;
+		}
+		m_heap[i] = n;
+		if (i != n)
+			m_entries[n] = m_entries[i];
+		n++;
+	}
+	m_nentries = n;
+	for (int i = 0; i < m_nentries; ++i)
+	{
+		Entry& e = m_entries[i];
+		if (e.parent != -1)
+			e.parent = m_heap[e.parent];
+		e.heapIdx = -1;
+	}
+	rebuildHash();
+	
+	// Continue the search from the border of the kept polygons.
+	m_nheap = 0;
+	for (int i = 0; i < m_nentries; ++i)
+	{
+		if (hasUnreachedNeighbour(i))
+			heapPush(i);
+	}
+	
+	m_version++;
+	if (!m_version)
+		m_version++;
+	
+	return expand();
+}
+
+/// Finds the polygon at the goal position again and builds the field from it.
+/// Clears the field if there is no polygon at the goal.
+dtStatus dtFlowField::rebuildGoal()
+{
+	const dtQueryFilter filter = m_filter;
+	const float goalPos[3] = { m_goalPos[0], m_goalPos[1], m_goalPos[2] };
+	
+	// Search as far as the crowd does around an agent of the tile.
+	dtPolyRef goalRef = 0;
+	int tx, ty;
+	m_nav->calcTileLoc(goalPos, &tx, &ty);
+	const dtMeshTile* tile = 0;
+	if (m_nav->getTilesAt(tx, ty, &tile, 1) && tile->header)
+	{
+		const float r = dtMax(tile->header->walkableRadius, tile->header->walkableClimb);
+		const float ext[3] = { r*2.0f, r*1.5f, r*2.0f };
+		float nearest[3];
+		m_navquery->findNearestPoly(goalPos, ext, &filter, &goalRef, nearest);
+	}
+	
+	// Fails and clears the field when no polygon was found.
+	return build(goalRef, goalPos, &filter);
+}
+
+dtPolyRef dtFlowField::getNextPoly(dtPolyRef ref) const
+{
+	const int idx = findEntry(ref);
+	if (idx == -1 || m_entries[idx].parent == -1)
+		return 0;
+	return m_entries[m_entries[idx].parent].ref;
+}
+
+float dtFlowField::getCost(dtPolyRef ref) const
+{
+	const int idx = findEntry(ref);
+	if (idx == -1)
+		return -1.0f;
+	return m_entries[idx].cost;
+}
+
+int dtFlowField::getPath(dtPolyRef startRef, dtPolyRef* path, float* endPos, const int maxPath) const
+{
+	int idx = findEntry(startRef);
+	if (idx == -1)
+		return 0;
+	
+	int n = 0;
+	int last = idx;
+	while (idx != -1 && n < maxPath)
+	{
+		path[n++] = m_entries[idx].ref;
+		last = idx;
+		idx = m_entries[idx].parent;
+	}
+	dtVcopy(endPos, m_entries[last].pos);
+	
+	return n;
+}
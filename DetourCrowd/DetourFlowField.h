@@ -0,0 +1,140 @@
+﻿//
+// Copyright (c) 2009-2010 Mikko Mononen memon@inside.org
+//
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+
+#ifndef DETOURFLOWFIELD_H
+#define DETOURFLOWFIELD_H
+
+#include "DetourNavMesh.h"
+#include "DetourNavMeshQuery.h"
+
+/// A polygon level flow field towards a single goal.
+///
+/// The field is built with a Dijkstra search outwards from the goal polygon, and stores for each
+/// reached polygon the next polygon towards the goal. Any number of agents can follow the field,
+/// so many agents moving to the same goal cost one search.
+/// @ingroup crowd
+/// @see dtCrowd::requestMoveFlowField()
+class dtFlowField
+{
+	struct Entry
+	{
+		dtPolyRef ref;
+		float pos[3];		///< The point where the flow leaves the polygon, or the goal.
+		float cost;			///< The cost from the polygon to the goal.
+		int parent;			///< The entry of the next polygon towards the goal, or -1 for the goal.
+		int next;			///< The next entry in the same hash bucket.
+		int heapIdx;		///< The position in the open heap, or -1.
+	};
+	
+	const dtNavMesh* m_nav;
+	dtNavMeshQuery* m_navquery;	///< Finds the goal polygon again when its tile is rebuilt.
+	dtQueryFilter m_filter;
+	
+	Entry* m_entries;
+	int m_nentries;
+	int m_maxEntries;
+	
+	int* m_buckets;
+	int m_bucketsSize;
+	
+	int* m_heap;
+	int m_nheap;
+	
+	unsigned char* m_state;		///< Scratch state of the entries used by #updateTiles().
+	
+	dtPolyRef m_goalRef;
+	float m_goalPos[3];
+	unsigned int m_version;
+	
+	void purge();
+	void clear();
+	int findEntry(dtPolyRef ref) const;
+	int addEntry(dtPolyRef ref);
+	void rebuildHash();
+	void heapPush(const int idx);
+	int heapPop();
+	void heapBubbleUp(int i, const int idx);
+	void heapTrickleDown(int i, const int idx);
+	bool hasUnreachedNeighbour(const int idx) const;
+	dtStatus expand();
+	dtStatus rebuildGoal();
+	
+public:
+	dtFlowField();
+	~dtFlowField();
+	
+	/// Initializes the flow field.
+	///  @param[in]		nav			The navigation mesh the field is built on.
+	///  @param[in]		maxPolys	The maximum number of polygons reached by the field. [Limit: > 0]
+	/// @return True if the field was successfully initialized.
+	bool init(const dtNavMesh* nav, const int maxPolys);
+	
+	/// Builds the field towards a goal.
+	///  @param[in]		goalRef		The reference of the goal polygon.
+	///  @param[in]		goalPos		The goal position. [(x, y, z)]
+	///  @param[in]		filter		The polygon filter to apply. The filter is copied.
+	/// @return The status flags for the build. #DT_OUT_OF_NODES is set if the field could not
+	/// reach all polygons connected to the goal.
+	dtStatus build(dtPolyRef goalRef, const float* goalPos, const dtQueryFilter* filter);
+	
+	/// Updates the field after tiles of the navigation mesh have been added, removed or rebuilt,
+	/// or the flags of their polygons have changed. Only the part of the field which led through
+	/// the changed tiles is searched again.
+	///  @param[in]		tiles		The references of the changed tiles. The polygons of removed
+	///  							tiles are found without being listed. [(tileRef) * ntiles]
+	///  @param[in]		ntiles		The number of tiles.
+	/// @return The status flags for the update. Fails if there is no polygon at the goal anymore.
+	dtStatus updateTiles(const dtTileRef* tiles, const int ntiles);
+	
+	/// Gets the next polygon towards the goal.
+	/// @return The next polygon, or zero if the polygon is the goal or it is not reached by the field.
+	dtPolyRef getNextPoly(dtPolyRef ref) const;
+	
+	/// Gets the cost from a polygon to the goal.
+	/// @return The cost, or a negative value if the polygon is not reached by the field.
+	float getCost(dtPolyRef ref) const;
+	
+	/// Follows the field from a polygon towards the goal.
+	///  @param[in]		startRef	The polygon to start from.
+	///  @param[out]	path		The polygons towards the goal, starting with @p startRef. [(polyRef) * return value]
+	///  @param[out]	endPos		The goal if the path reaches it, otherwise the point where the
+	///  							flow leaves the last polygon of the path. [(x, y, z)]
+	///  @param[in]		maxPath		The maximum number of polygons in the path. [Limit: > 0]
+	/// @return The number of polygons in the path, or zero if @p startRef is not reached by the field.
+	int getPath(dtPolyRef startRef, dtPolyRef* path, float* endPos, const int maxPath) const;
+	
+	/// The goal polygon of the field.
+	inline dtPolyRef getGoalRef() const { return m_goalRef; }
+	
+	/// The goal position of the field. [(x, y, z)]
+	inline const float* getGoalPos() const { return m_goalPos; }
+	
+	/// The filter used by the field.
+	inline const dtQueryFilter* getFilter() const { return &m_filter; }
+	
+	/// The number of polygons reached by the field.
+	inline int getPolyCount() const { return m_nentries; }
+	
+	/// Changes each time the field is built or updated. Never zero.
+	inline unsigned int getVersion() const { return m_version; }
+};
+
+dtFlowField* dtAllocFlowField();
+void dtFreeFlowField(dtFlowField* ptr);
+
+#endif // DETOURFLOWFIELD_H
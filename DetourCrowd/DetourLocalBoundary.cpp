@@ -21,12 +21,158 @@
 #include "DetourLocalBoundary.h"
 #include "DetourNavMeshQuery.h"
 #include "DetourCommon.h"
+#include "DetourAlloc.h"
 #include "DetourAssert.h"
 
 
+static const int MAX_SEGS_PER_POLY = DT_VERTS_PER_POLYGON*3;
+
+inline unsigned int hashPolyRef(dtPolyRef a)
+{
+	a += ~(a<<15);
+	a ^=  (a>>10);
+	a +=  (a<<3);
+	a ^=  (a>>6);
+	a += ~(a<<11);
+	a ^=  (a>>16);
+	return (unsigned int)a;
+}
+
+
+dtLocalBoundaryCache::dtLocalBoundaryCache() :
+	m_entries(0),
+	m_nentries(0),
+	m_maxEntries(0),
+	m_buckets(0),
+	m_bucketsSize(0),
+	m_segs(0),
+	m_nsegs(0),
+	m_maxSegs(0)
+{
+}
+
+dtLocalBoundaryCache::~dtLocalBoundaryCache()
+{
+	purge();
+}
+
+void dtLocalBoundaryCache::purge()
+{
+	dtFree(m_entries);
+	m_entries = 0;
+	m_maxEntries = 0;
+	dtFree(m_buckets);
+	m_buckets = 0;
+	m_bucketsSize = 0;
+	dtFree(m_segs);
+	m_segs = 0;
+	m_maxSegs = 0;
+}
+
+bool dtLocalBoundaryCache::init(const int maxPolys, const int maxSegments)
+{
+	dtAssert(maxPolys > 0);
+	
+	const int bucketsSize = (int)dtNextPow2((unsigned int)maxPolys);
+	Entry* entries = (Entry*)dtAlloc(sizeof(Entry)*maxPolys, DT_ALLOC_PERM);
+	int* buckets = (int*)dtAlloc(sizeof(int)*bucketsSize, DT_ALLOC_PERM);
+	float* segs = (float*)dtAlloc(sizeof(float)*6*dtMax(maxSegments, 1), DT_ALLOC_PERM);
+	if (!entries || !buckets || !segs)
+	{
+		dtFree(entries);
+		dtFree(buckets);
+		dtFree(segs);
+		return false;
+	}
+	
+	purge();
+	
+	m_entries = entries;
+	m_maxEntries = maxPolys;
+	m_buckets = buckets;
+	m_bucketsSize = bucketsSize;
+	m_segs = segs;
+	m_maxSegs = maxSegments;
+	
+	clear();
+	
+	return true;
+}
+
+void dtLocalBoundaryCache::clear()
+{
+	memset(m_buckets, 0xff, sizeof(int)*m_bucketsSize);
+	m_nentries = 0;
+	m_nsegs = 0;
+}
+
+bool dtLocalBoundaryCache::addPoly(dtPolyRef ref)
+{
+	const int h = (int)(hashPolyRef(ref) & (m_bucketsSize-1));
+	for (int i = m_buckets[h]; i != -1; i = m_entries[i].next)
+	{
+		if (m_entries[i].ref == ref)
+			return true;
+	}
+	
+	if (m_nentries >= m_maxEntries)
+		return false;
+	
+	Entry& e = m_entries[m_nentries];
+	e.ref = ref;
+	e.firstSeg = 0;
+	e.nsegs = -1;
+	e.next = m_buckets[h];
+	m_buckets[h] = m_nentries;
+	m_nentries++;
+	
+	return true;
+}
+
+void dtLocalBoundaryCache::build(const dtNavMeshQuery* navquery, const dtQueryFilter* filter)
+{
+	m_nsegs = 0;
+	for (int i = 0; i < m_nentries; ++i)
+	{
+		Entry& e = m_entries[i];
+		e.firstSeg = m_nsegs;
+		e.nsegs = -1;
+		
+		// Polygons which do not fit are left for the boundaries to query.
+		const int maxSegs = dtMin(m_maxSegs - m_nsegs, MAX_SEGS_PER_POLY);
+		float segs[MAX_SEGS_PER_POLY*6];
+		int nsegs = 0;
+		const dtStatus status = navquery->getPolyWallSegments(e.ref, filter, segs, 0, &nsegs, MAX_SEGS_PER_POLY);
+		if (dtStatusFailed(status) || nsegs > maxSegs)
+			continue;
+		
+		memcpy(&m_segs[m_nsegs*6], segs, sizeof(float)*6*nsegs);
+		e.nsegs = nsegs;
+		m_nsegs += nsegs;
+	}
+}
+
+const float* dtLocalBoundaryCache::getPolySegments(dtPolyRef ref, int* nsegs) const
+{
+	const int h = (int)(hashPolyRef(ref) & (m_bucketsSize-1));
+	for (int i = m_buckets[h]; i != -1; i = m_entries[i].next)
+	{
+		const Entry& e = m_entries[i];
+		if (e.ref != ref)
+			continue;
+		if (e.nsegs < 0)
+			return 0;
+		*nsegs = e.nsegs;
+		return &m_segs[e.firstSeg*6];
+	}
+	return 0;
+}
+
+
 dtLocalBoundary::dtLocalBoundary() :
 	m_nsegs(0),
-	m_npolys(0)
+	m_npolys(0),
+	m_pending(false)
 {
 	dtVset(m_center, FLT_MAX,FLT_MAX,FLT_MAX);
 }
@@ -40,6 +186,7 @@ void dtLocalBoundary::reset()
 	dtVset(m_center, FLT_MAX,FLT_MAX,FLT_MAX);
 	m_npolys = 0;
 	m_nsegs = 0;
+	m_pending = false;
 }
 
 void dtLocalBoundary::addSegment(const float dist, const float* s)
@@ -84,13 +231,20 @@ void dtLocalBoundary::addSegment(const float dist, const float* s)
 void dtLocalBoundary::update(dtPolyRef ref, const float* pos, const float collisionQueryRange,
 							 dtNavMeshQuery* navquery, const dtQueryFilter* filter)
 {
-	static const int MAX_SEGS_PER_POLY = DT_VERTS_PER_POLYGON*3;
+	updatePolys(ref, pos, collisionQueryRange, navquery, filter);
+	updateSegments(collisionQueryRange, 0, navquery, filter);
+}
+
+void dtLocalBoundary::updatePolys(dtPolyRef ref, const float* pos, const float collisionQueryRange,
+								  dtNavMeshQuery* navquery, const dtQueryFilter* filter)
+{
+	m_nsegs = 0;
 	
 	if (!ref)
 	{
 		dtVset(m_center, FLT_MAX,FLT_MAX,FLT_MAX);
-		m_nsegs = 0;
 		m_npolys = 0;
+		m_pending = false;
 		return;
 	}
 	
@@ -99,20 +253,34 @@ void dtLocalBoundary::update(dtPolyRef ref, const float* pos, const float collis
 	// First query non-overlapping polygons.
 	navquery->findLocalNeighbourhood(ref, pos, collisionQueryRange,
 									 filter, m_polys, 0, &m_npolys, MAX_LOCAL_POLYS);
+	m_pending = true;
+}
+
+void dtLocalBoundary::updateSegments(const float collisionQueryRange, const dtLocalBoundaryCache* cache,
+									 dtNavMeshQuery* navquery, const dtQueryFilter* filter)
+{
+	if (!m_pending)
+		return;
+	m_pending = false;
 	
 	// Secondly, store all polygon edges.
 	m_nsegs = 0;
-	float segs[MAX_SEGS_PER_POLY*6];
-	int nsegs = 0;
+	float querySegs[MAX_SEGS_PER_POLY*6];
 	for (int j = 0; j < m_npolys; ++j)
 	{
-		navquery->getPolyWallSegments(m_polys[j], filter, segs, 0, &nsegs, MAX_SEGS_PER_POLY);
+		int nsegs = 0;
+		const float* segs = cache ? cache->getPolySegments(m_polys[j], &nsegs) : 0;
+		if (!segs)
+		{
+			navquery->getPolyWallSegments(m_polys[j], filter, querySegs, 0, &nsegs, MAX_SEGS_PER_POLY);
+			segs = querySegs;
+		}
 		for (int k = 0; k < nsegs; ++k)
 		{
 			const float* s = &segs[k*6];
 			// Skip too distant segments.
 			float tseg;
-			const float distSqr = dtDistancePtSegSqr2D(pos, s, s+3, tseg);
+			const float distSqr = dtDistancePtSegSqr2D(m_center, s, s+3, tseg);
 			if (distSqr > dtSqr(collisionQueryRange))
 				continue;
 			addSegment(distSqr, s);
@@ -22,6 +22,64 @@
 #include "DetourNavMeshQuery.h"
 
 
+/// The wall segments of the polygons around a group of agents, extracted once per update
+/// and shared by the local boundaries of the agents.
+class dtLocalBoundaryCache
+{
+	struct Entry
+	{
+		dtPolyRef ref;
+		int firstSeg;		///< The first segment of the polygon in #m_segs.
+		int nsegs;			///< The number of segments, or -1 if they did not fit in the cache.
+		int next;
+	};
+	
+	Entry* m_entries;
+	int m_nentries;
+	int m_maxEntries;
+	
+	int* m_buckets;
+	int m_bucketsSize;
+	
+	float* m_segs;
+	int m_nsegs;
+	int m_maxSegs;
+	
+	void purge();
+	
+public:
+	dtLocalBoundaryCache();
+	~dtLocalBoundaryCache();
+	
+	/// Initializes the cache.
+	///  @param[in]		maxPolys		The maximum number of polygons in the cache.
+	///  @param[in]		maxSegments		The maximum number of wall segments in the cache.
+	/// @return True if the cache was successfully initialized, the cache is unchanged otherwise.
+	bool init(const int maxPolys, const int maxSegments);
+	
+	/// Removes all polygons from the cache.
+	void clear();
+	
+	/// Adds a polygon to the cache, unless it is already there.
+	/// @return False if the cache is full.
+	bool addPoly(dtPolyRef ref);
+	
+	/// Extracts the wall segments of the polygons added since the last #clear().
+	void build(const dtNavMeshQuery* navquery, const dtQueryFilter* filter);
+	
+	/// Gets the wall segments of a polygon.
+	///  @param[in]		ref			The polygon reference.
+	///  @param[out]	nsegs		The number of segments.
+	/// @return The segments [(ax, ay, az, bx, by, bz) * nsegs], or null if the polygon is not in the cache.
+	const float* getPolySegments(dtPolyRef ref, int* nsegs) const;
+	
+	/// The number of polygons in the cache.
+	inline int getPolyCount() const { return m_nentries; }
+	
+	/// The number of wall segments in the cache.
+	inline int getSegmentCount() const { return m_nsegs; }
+};
+
 class dtLocalBoundary
 {
 	static const int MAX_LOCAL_SEGS = 8;
@@ -39,6 +97,8 @@ class dtLocalBoundary
 	
 	dtPolyRef m_polys[MAX_LOCAL_POLYS];
 	int m_npolys;
+	
+	bool m_pending;
 
 	void addSegment(const float dist, const float* seg);
 	
@@ -51,9 +111,25 @@ public:
 	void update(dtPolyRef ref, const float* pos, const float collisionQueryRange,
 				dtNavMeshQuery* navquery, const dtQueryFilter* filter);
 	
+	/// Finds the polygons of the boundary, the first half of #update().
+	/// The boundary has no segments until #updateSegments() is called.
+	void updatePolys(dtPolyRef ref, const float* pos, const float collisionQueryRange,
+					 dtNavMeshQuery* navquery, const dtQueryFilter* filter);
+	
+	/// Collects the wall segments of the polygons found by #updatePolys(), the second half of #update().
+	///  @param[in]		collisionQueryRange		The range used with #updatePolys().
+	///  @param[in]		cache		The segment cache to read, or null. The polygons which are not in
+	///  							the cache are queried from @p navquery.
+	void updateSegments(const float collisionQueryRange, const dtLocalBoundaryCache* cache,
+						dtNavMeshQuery* navquery, const dtQueryFilter* filter);
+	
 	bool isValid(dtNavMeshQuery* navquery, const dtQueryFilter* filter);
 	
 	inline const float* getCenter() const { return m_center; }
+	/// True if #updatePolys() has been called but #updateSegments() has not.
+	inline bool isPending() const { return m_pending; }
+	inline int getPolyCount() const { return m_npolys; }
+	inline dtPolyRef getPoly(int i) const { return m_polys[i]; }
 	inline int getSegmentCount() const { return m_nsegs; }
 	inline const float* getSegment(int i) const { return m_segs[i].s; }
 };
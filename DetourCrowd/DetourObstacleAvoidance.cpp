@@ -25,8 +25,63 @@
 #include <float.h>
 #include <new>
 
+// Define DT_NO_SIMD to disable the SSE code paths.
+#if !defined(DT_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#	define DT_OBSTACLE_SSE 1
+#	include <xmmintrin.h>
+#endif
+
 static const float DT_PI = 3.14159265f;
 
+/// Max number of candidate velocities evaluated in one batch.
+static const int MAX_SAMPLE_BATCH = 256;
+
+// Terms of the sample tests which only depend on the obstacle, stored one array per term.
+enum CircleTerm
+{
+	CIR_SX,		// Obstacle position relative to the agent.
+	CIR_SZ,
+	CIR_C,		// Squared distance minus squared radius sum.
+	CIR_VX,		// Obstacle velocity.
+	CIR_VZ,
+	CIR_DPX,	// Direction to the obstacle.
+	CIR_DPZ,
+	CIR_NPX,	// Preferred side normal.
+	CIR_NPZ,
+	CIR_TERMS
+};
+
+enum SegmentTerm
+{
+	SEG_DX,		// Segment direction.
+	SEG_DZ,
+	SEG_WX,		// Agent position relative to the segment start.
+	SEG_WZ,
+	SEG_T,		// Perp product of direction and relative position.
+	SEG_NX,		// Segment normal, used when touching the segment.
+	SEG_NZ,
+	SEG_TERMS
+};
+
+/// Calculates the sine and cosine of an angle using only basic float arithmetic, so that the
+/// result does not depend on the math library of the platform. Accurate to about 1e-6.
+static void reproducibleSinCos(const float a, float* s, float* c)
+{
+	// Reduce to [-pi/4, pi/4] around the nearest multiple of pi/2.
+	const int q = (int)floorf(a * (2.0f/DT_PI) + 0.5f);
+	const float x = a - (float)q * (DT_PI*0.5f);
+	const float x2 = x*x;
+	const float sx = x * (1.0f + x2*(-1.0f/6.0f + x2*(1.0f/120.0f + x2*(-1.0f/5040.0f))));
+	const float cx = 1.0f + x2*(-0.5f + x2*(1.0f/24.0f + x2*(-1.0f/720.0f + x2*(1.0f/40320.0f))));
+	switch (q & 3)
+	{
+	case 0: *s = sx; *c = cx; break;
+	case 1: *s = cx; *c = -sx; break;
+	case 2: *s = -sx; *c = -cx; break;
+	default: *s = -cx; *c = sx; break;
+	}
+}
+
 static int sweepCircleCircle(const float* c0, const float r0, const float* v,
 							 const float* c1, const float r1,
 							 float& tmin, float& tmax)
@@ -50,6 +105,193 @@ static int sweepCircleCircle(const float* c0, const float r0, const float* v,
 	return 1;
 }
 
+/// A half-plane constraint of the ORCA solver, the velocities on the left of the line are permitted.
+/// The 2D vectors are (x, z) pairs.
+struct dtOrcaLine
+{
+	float point[2];
+	float dir[2];
+};
+
+static const float ORCA_EPS = 0.00001f;
+
+inline float orcaDet(const float* a, const float* b) { return a[0]*b[1] - a[1]*b[0]; }
+inline float orcaDot(const float* a, const float* b) { return a[0]*b[0] + a[1]*b[1]; }
+
+inline void orcaNormalize(float* v)
+{
+	const float d = dtSqrt(orcaDot(v,v));
+	if (d > 0.0f)
+	{
+		v[0] /= d;
+		v[1] /= d;
+	}
+}
+
+// Finds the point closest to the optimization velocity on line 'lineNo' which satisfies
+// the lines before it and lies within the max speed circle.
+static bool orcaLinearProgram1(const dtOrcaLine* lines, const int lineNo, const float radius,
+							   const float* optVel, const bool dirOpt, float* result)
+{
+	const dtOrcaLine& line = lines[lineNo];
+	const float dot = orcaDot(line.point, line.dir);
+	const float disc = dtSqr(dot) + dtSqr(radius) - orcaDot(line.point, line.point);
+	
+	// Max speed circle fully invalidates the line.
+	if (disc < 0.0f)
+		return false;
+	
+	const float sqrtDisc = dtSqrt(disc);
+	float tLeft = -dot - sqrtDisc;
+	float tRight = -dot + sqrtDisc;
+	
+	for (int i = 0; i < lineNo; ++i)
+	{
+		const float d[2] = { line.point[0] - lines[i].point[0], line.point[1] - lines[i].point[1] };
+		const float denom = orcaDet(line.dir, lines[i].dir);
+		const float numer = orcaDet(lines[i].dir, d);
+		
+		if (dtAbs(denom) <= ORCA_EPS)
+		{
+			// The lines are parallel.
+			if (numer < 0.0f)
+				return false;
+			continue;
+		}
+		
+		const float t = numer / denom;
+		if (denom >= 0.0f)
+			tRight = dtMin(tRight, t);
+		else
+			tLeft = dtMax(tLeft, t);
+		
+		if (tLeft > tRight)
+			return false;
+	}
+	
+	float t;
+	if (dirOpt)
+	{
+		// Optimize direction.
+		t = orcaDot(optVel, line.dir) > 0.0f ? tRight : tLeft;
+	}
+	else
+	{
+		// Optimize closest point.
+		const float d[2] = { optVel[0] - line.point[0], optVel[1] - line.point[1] };
+		t = dtClamp(orcaDot(line.dir, d), tLeft, tRight);
+	}
+	result[0] = line.point[0] + t*line.dir[0];
+	result[1] = line.point[1] + t*line.dir[1];
+	
+	return true;
+}
+
+// Finds the velocity closest to the optimization velocity, or furthest in its direction, which
+// satisfies all lines. Returns the index of the line which could not be satisfied, or nlines on success.
+static int orcaLinearProgram2(const dtOrcaLine* lines, const int nlines, const float radius,
+							  const float* optVel, const bool dirOpt, float* result)
+{
+	if (dirOpt)
+	{
+		// The optimization velocity is of unit length in this case.
+		result[0] = optVel[0]*radius;
+		result[1] = optVel[1]*radius;
+	}
+	else if (orcaDot(optVel, optVel) > dtSqr(radius))
+	{
+		const float s = radius / dtSqrt(orcaDot(optVel, optVel));
+		result[0] = optVel[0]*s;
+		result[1] = optVel[1]*s;
+	}
+	else
+	{
+		result[0] = optVel[0];
+		result[1] = optVel[1];
+	}
+	
+	for (int i = 0; i < nlines; ++i)
+	{
+		const float d[2] = { lines[i].point[0] - result[0], lines[i].point[1] - result[1] };
+		if (orcaDet(lines[i].dir, d) > 0.0f)
+		{
+			// The result does not satisfy the constraint, compute new optimal result.
+			const float prev[2] = { result[0], result[1] };
+			if (!orcaLinearProgram1(lines, i, radius, optVel, dirOpt, result))
+			{
+				result[0] = prev[0];
+				result[1] = prev[1];
+				return i;
+			}
+		}
+	}
+	
+	return nlines;
+}
+
+// Called when the constraints cannot all be satisfied. Finds the velocity which minimizes the
+// maximum penetration of the agent constraints, the first 'nobst' obstacle constraints are kept hard.
+static void orcaLinearProgram3(const dtOrcaLine* lines, const int nlines, const int nobst, const int beginLine,
+							   const float radius, dtOrcaLine* projLines, float* result)
+{
+	float dist = 0.0f;
+	
+	for (int i = beginLine; i < nlines; ++i)
+	{
+		const float d[2] = { lines[i].point[0] - result[0], lines[i].point[1] - result[1] };
+		if (orcaDet(lines[i].dir, d) <= dist)
+			continue;
+		
+		// The result does not satisfy the constraint of line i.
+		memcpy(projLines, lines, sizeof(dtOrcaLine)*nobst);
+		int nproj = nobst;
+		
+		for (int j = nobst; j < i; ++j)
+		{
+			dtOrcaLine line;
+			const float det = orcaDet(lines[i].dir, lines[j].dir);
+			
+			if (dtAbs(det) <= ORCA_EPS)
+			{
+				// Line i and line j are parallel.
+				if (orcaDot(lines[i].dir, lines[j].dir) > 0.0f)
+				{
+					// Line i and line j point in the same direction.
+					continue;
+				}
+				// Line i and line j point in opposite direction.
+				line.point[0] = 0.5f * (lines[i].point[0] + lines[j].point[0]);
+				line.point[1] = 0.5f * (lines[i].point[1] + lines[j].point[1]);
+			}
+			else
+			{
+				const float dij[2] = { lines[i].point[0] - lines[j].point[0], lines[i].point[1] - lines[j].point[1] };
+				const float t = orcaDet(lines[j].dir, dij) / det;
+				line.point[0] = lines[i].point[0] + t*lines[i].dir[0];
+				line.point[1] = lines[i].point[1] + t*lines[i].dir[1];
+			}
+			
+			line.dir[0] = lines[j].dir[0] - lines[i].dir[0];
+			line.dir[1] = lines[j].dir[1] - lines[i].dir[1];
+			orcaNormalize(line.dir);
+			projLines[nproj++] = line;
+		}
+		
+		const float prev[2] = { result[0], result[1] };
+		const float optDir[2] = { -lines[i].dir[1], lines[i].dir[0] };
+		if (orcaLinearProgram2(projLines, nproj, radius, optDir, true, result) < nproj)
+		{
+			// This should in principle not happen, the result is already in the feasible region
+			// of this linear program. If it fails, it is due to small floating point error, keep the current result.
+			result[0] = prev[0];
+			result[1] = prev[1];
+		}
+		
+		const float dr[2] = { lines[i].point[0] - result[0], lines[i].point[1] - result[1] };
+		dist = orcaDet(lines[i].dir, dr);
+	}
+}
+
 static int isectRaySeg(const float* ap, const float* u,
 					   const float* bp, const float* bq,
 					   float& t)
@@ -212,7 +454,12 @@ dtObstacleAvoidanceQuery::dtObstacleAvoidanceQuery() :
 	m_ncircles(0),
 	m_maxSegments(0),
 	m_segments(0),
-	m_nsegments(0)
+	m_nsegments(0),
+	m_circleData(0),
+	m_segmentData(0),
+	m_orcaLines(0),
+	m_orcaProjLines(0),
+	m_deterministic(false)
 {
 }
 
@@ -220,6 +467,10 @@ dtObstacleAvoidanceQuery::~dtObstacleAvoidanceQuery()
 {
 	dtFree(m_circles);
 	dtFree(m_segments);
+	dtFree(m_circleData);
+	dtFree(m_segmentData);
+	dtFree(m_orcaLines);
+	dtFree(m_orcaProjLines);
 }
 
 bool dtObstacleAvoidanceQuery::init(const int maxCircles, const int maxSegments)
@@ -238,6 +489,21 @@ bool dtObstacleAvoidanceQuery::init(const int maxCircles, const int maxSegments)
 		return false;
 	memset(m_segments, 0, sizeof(dtObstacleSegment)*m_maxSegments);
 	
+	m_circleData = (float*)dtAlloc(sizeof(float)*CIR_TERMS*dtMax(m_maxCircles,1), DT_ALLOC_PERM);
+	if (!m_circleData)
+		return false;
+	m_segmentData = (float*)dtAlloc(sizeof(float)*SEG_TERMS*dtMax(m_maxSegments,1), DT_ALLOC_PERM);
+	if (!m_segmentData)
+		return false;
+	
+	const int maxLines = dtMax(m_maxCircles + m_maxSegments, 1);
+	m_orcaLines = (dtOrcaLine*)dtAlloc(sizeof(dtOrcaLine)*maxLines, DT_ALLOC_PERM);
+	if (!m_orcaLines)
+		return false;
+	m_orcaProjLines = (dtOrcaLine*)dtAlloc(sizeof(dtOrcaLine)*maxLines, DT_ALLOC_PERM);
+	if (!m_orcaProjLines)
+		return false;
+	
 	return true;
 }
 
@@ -262,7 +528,7 @@ void dtObstacleAvoidanceQuery::addCircle(const float* pos, const float rad,
 
 void dtObstacleAvoidanceQuery::addSegment(const float* p, const float* q)
 {
-	if (m_nsegments > m_maxSegments)
+	if (m_nsegments >= m_maxSegments)
 		return;
 	
 	dtObstacleSegment* seg = &m_segments[m_nsegments++];
@@ -270,7 +536,7 @@ void dtObstacleAvoidanceQuery::addSegment(const float* p, const float* q)
 	dtVcopy(seg->q, q);
 }
 
-void dtObstacleAvoidanceQuery::prepare(const float* pos, const float* dvel)
+void dtObstacleAvoidanceQuery::prepare(const float* pos, const float rad, const float* dvel)
 {
 	// Prepare obstacles
 	for (int i = 0; i < m_ncircles; ++i)
@@ -309,6 +575,43 @@ void dtObstacleAvoidanceQuery::prepare(const float* pos, const float* dvel)
 		float t;
 		seg->touch = dtDistancePtSegSqr2D(pos, seg->p, seg->q, t) < dtSqr(r);
 	}	
+	
+	// Store the terms of the sample tests which do not depend on the candidate velocity.
+	for (int i = 0; i < m_ncircles; ++i)
+	{
+		const dtObstacleCircle* cir = &m_circles[i];
+		float* d = m_circleData;
+		const int n = m_maxCircles;
+		float s[3];
+		dtVsub(s, cir->p, pos);
+		const float r = rad + cir->rad;
+		d[CIR_SX*n+i] = s[0];
+		d[CIR_SZ*n+i] = s[2];
+		d[CIR_C*n+i] = dtVdot2D(s,s) - r*r;
+		d[CIR_VX*n+i] = cir->vel[0];
+		d[CIR_VZ*n+i] = cir->vel[2];
+		d[CIR_DPX*n+i] = cir->dp[0];
+		d[CIR_DPZ*n+i] = cir->dp[2];
+		d[CIR_NPX*n+i] = cir->np[0];
+		d[CIR_NPZ*n+i] = cir->np[2];
+	}
+	
+	for (int i = 0; i < m_nsegments; ++i)
+	{
+		const dtObstacleSegment* seg = &m_segments[i];
+		float* d = m_segmentData;
+		const int n = m_maxSegments;
+		float v[3], w[3];
+		dtVsub(v, seg->q, seg->p);
+		dtVsub(w, pos, seg->p);
+		d[SEG_DX*n+i] = v[0];
+		d[SEG_DZ*n+i] = v[2];
+		d[SEG_WX*n+i] = w[0];
+		d[SEG_WZ*n+i] = w[2];
+		d[SEG_T*n+i] = dtVperp2D(v,w);
+		d[SEG_NX*n+i] = -v[2];
+		d[SEG_NZ*n+i] = v[0];
+	}
 }
 
 float dtObstacleAvoidanceQuery::processSample(const float* vcand, const float cs,
@@ -404,12 +707,180 @@ float dtObstacleAvoidanceQuery::processSample(const float* vcand, const float cs
 	return penalty;
 }
 
+#ifdef DT_OBSTACLE_SSE
+inline __m128 dtSelect4(const __m128 mask, const __m128 a, const __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+/// Calculates the penalties of @p n candidate velocities, see processSample().
+/// With SSE four candidates are tested at a time against the obstacle terms stored by prepare(),
+/// the operations are the same as in processSample() so the penalties are identical.
+void dtObstacleAvoidanceQuery::processSamples(const float* vx, const float* vz, const int n, const float cs,
+											  const float* pos, const float rad,
+											  const float* vel, const float* dvel, float* penalties,
+											  dtObstacleAvoidanceDebugData* debug)
+{
+#ifdef DT_OBSTACLE_SSE
+	(void)pos;
+	(void)rad;
+	
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 eps = _mm_set1_ps(0.0001f);
+	const __m128 parEps = _mm_set1_ps(1e-6f);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	
+	const float* cd = m_circleData;
+	const int nc = m_maxCircles;
+	const float* sd = m_segmentData;
+	const int ns = m_maxSegments;
+	
+	for (int i = 0; i < n; i += 4)
+	{
+		// Pad the last batch by repeating the last candidate.
+		float bx[4], bz[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			const int k = dtMin(i+j, n-1);
+			bx[j] = vx[k];
+			bz[j] = vz[k];
+		}
+		const __m128 cx = _mm_loadu_ps(bx);
+		const __m128 cz = _mm_loadu_ps(bz);
+		
+		// Find min time of impact and exit amongst all obstacles.
+		__m128 tmin = _mm_set1_ps(m_params.horizTime);
+		__m128 side = zero;
+		
+		const __m128 rvx = _mm_sub_ps(_mm_mul_ps(cx, two), _mm_set1_ps(vel[0]));
+		const __m128 rvz = _mm_sub_ps(_mm_mul_ps(cz, two), _mm_set1_ps(vel[2]));
+		
+		for (int j = 0; j < m_ncircles; ++j)
+		{
+			// RVO
+			const __m128 vabx = _mm_sub_ps(rvx, _mm_set1_ps(cd[CIR_VX*nc+j]));
+			const __m128 vabz = _mm_sub_ps(rvz, _mm_set1_ps(cd[CIR_VZ*nc+j]));
+			
+			// Side
+			const __m128 sdp = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(cd[CIR_DPX*nc+j]), vabx),
+																 _mm_mul_ps(_mm_set1_ps(cd[CIR_DPZ*nc+j]), vabz)), half), half);
+			const __m128 snp = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(cd[CIR_NPX*nc+j]), vabx),
+													 _mm_mul_ps(_mm_set1_ps(cd[CIR_NPZ*nc+j]), vabz)), two);
+			side = _mm_add_ps(side, _mm_max_ps(_mm_min_ps(_mm_min_ps(sdp, snp), one), zero));
+			
+			// Sweep circle against circle.
+			const __m128 a = _mm_add_ps(_mm_mul_ps(vabx, vabx), _mm_mul_ps(vabz, vabz));
+			const __m128 b = _mm_add_ps(_mm_mul_ps(vabx, _mm_set1_ps(cd[CIR_SX*nc+j])),
+										_mm_mul_ps(vabz, _mm_set1_ps(cd[CIR_SZ*nc+j])));
+			const __m128 d = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, _mm_set1_ps(cd[CIR_C*nc+j])));
+			const __m128 hit = _mm_and_ps(_mm_cmpge_ps(a, eps), _mm_cmpge_ps(d, zero));
+			const __m128 ia = _mm_div_ps(one, a);
+			const __m128 rd = _mm_sqrt_ps(d);
+			__m128 htmin = _mm_mul_ps(_mm_sub_ps(b, rd), ia);
+			const __m128 htmax = _mm_mul_ps(_mm_add_ps(b, rd), ia);
+			
+			// Handle overlapping obstacles, avoid more when overlapped.
+			const __m128 overlap = _mm_and_ps(_mm_cmplt_ps(htmin, zero), _mm_cmpgt_ps(htmax, zero));
+			htmin = dtSelect4(overlap, _mm_mul_ps(_mm_xor_ps(htmin, signMask), half), htmin);
+			
+			// The closest obstacle is somewhere ahead of us, keep track of nearest obstacle.
+			const __m128 closer = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(htmin, zero), _mm_cmplt_ps(htmin, tmin)));
+			tmin = dtSelect4(closer, htmin, tmin);
+		}
+		
+		for (int j = 0; j < m_nsegments; ++j)
+		{
+			__m128 htmin, hit;
+			if (m_segments[j].touch)
+			{
+				// Special case when the agent is very close to the segment.
+				// If the velocity is pointing towards the segment, no collision, else immediate collision.
+				const __m128 dn = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(sd[SEG_NX*ns+j]), cx),
+											 _mm_mul_ps(_mm_set1_ps(sd[SEG_NZ*ns+j]), cz));
+				hit = _mm_cmpge_ps(dn, zero);
+				htmin = zero;
+			}
+			else
+			{
+				// Intersect ray against segment.
+				const __m128 d = _mm_sub_ps(_mm_mul_ps(cz, _mm_set1_ps(sd[SEG_DX*ns+j])),
+											_mm_mul_ps(cx, _mm_set1_ps(sd[SEG_DZ*ns+j])));
+				const __m128 id = _mm_div_ps(one, d);
+				const __m128 t = _mm_mul_ps(_mm_set1_ps(sd[SEG_T*ns+j]), id);
+				const __m128 s = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(cz, _mm_set1_ps(sd[SEG_WX*ns+j])),
+													   _mm_mul_ps(cx, _mm_set1_ps(sd[SEG_WZ*ns+j]))), id);
+				hit = _mm_cmpge_ps(_mm_andnot_ps(signMask, d), parEps);
+				hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmple_ps(t, one)));
+				hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(s, zero), _mm_cmple_ps(s, one)));
+				htmin = t;
+			}
+			
+			// Avoid less when facing walls.
+			htmin = _mm_mul_ps(htmin, two);
+			
+			// The closest obstacle is somewhere ahead of us, keep track of nearest obstacle.
+			tmin = dtSelect4(_mm_and_ps(hit, _mm_cmplt_ps(htmin, tmin)), htmin, tmin);
+		}
+		
+		// Normalize side bias, to prevent it dominating too much.
+		if (m_ncircles)
+			side = _mm_div_ps(side, _mm_set1_ps((float)m_ncircles));
+		
+		const __m128 ddx = _mm_sub_ps(_mm_set1_ps(dvel[0]), cx);
+		const __m128 ddz = _mm_sub_ps(_mm_set1_ps(dvel[2]), cz);
+		const __m128 dcx = _mm_sub_ps(_mm_set1_ps(vel[0]), cx);
+		const __m128 dcz = _mm_sub_ps(_mm_set1_ps(vel[2]), cz);
+		const __m128 invVmax = _mm_set1_ps(m_invVmax);
+		
+		const __m128 vpen = _mm_mul_ps(_mm_set1_ps(m_params.weightDesVel),
+									   _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ddx, ddx), _mm_mul_ps(ddz, ddz))), invVmax));
+		const __m128 vcpen = _mm_mul_ps(_mm_set1_ps(m_params.weightCurVel),
+										_mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dcx, dcx), _mm_mul_ps(dcz, dcz))), invVmax));
+		const __m128 spen = _mm_mul_ps(_mm_set1_ps(m_params.weightSide), side);
+		const __m128 tpen = _mm_mul_ps(_mm_set1_ps(m_params.weightToi),
+									   _mm_div_ps(one, _mm_add_ps(_mm_set1_ps(0.1f), _mm_mul_ps(tmin, _mm_set1_ps(m_invHorizTime)))));
+		const __m128 penalty = _mm_add_ps(_mm_add_ps(_mm_add_ps(vpen, vcpen), spen), tpen);
+		
+		float pen[4];
+		_mm_storeu_ps(pen, penalty);
+		const int nb = dtMin(4, n-i);
+		for (int j = 0; j < nb; ++j)
+			penalties[i+j] = pen[j];
+		
+		// Store different penalties for debug viewing
+		if (debug)
+		{
+			float vp[4], vcp[4], sp[4], tp[4];
+			_mm_storeu_ps(vp, vpen);
+			_mm_storeu_ps(vcp, vcpen);
+			_mm_storeu_ps(sp, spen);
+			_mm_storeu_ps(tp, tpen);
+			for (int j = 0; j < nb; ++j)
+			{
+				const float vcand[3] = { bx[j], 0, bz[j] };
+				debug->addSample(vcand, cs, pen[j], vp[j], vcp[j], sp[j], tp[j]);
+			}
+		}
+	}
+#else
+	for (int i = 0; i < n; ++i)
+	{
+		const float vcand[3] = { vx[i], 0, vz[i] };
+		penalties[i] = processSample(vcand, cs, pos,rad,vel,dvel, debug);
+	}
+#endif
+}
+
 int dtObstacleAvoidanceQuery::sampleVelocityGrid(const float* pos, const float rad, const float vmax,
 												 const float* vel, const float* dvel, float* nvel,
 												 const dtObstacleAvoidanceParams* params,
 												 dtObstacleAvoidanceDebugData* debug)
 {
-	prepare(pos, dvel);
+	prepare(pos, rad, dvel);
 	
 	memcpy(&m_params, params, sizeof(dtObstacleAvoidanceParams));
 	m_invHorizTime = 1.0f / m_params.horizTime;
@@ -428,9 +899,13 @@ int dtObstacleAvoidanceQuery::sampleVelocityGrid(const float* pos, const float r
 		
 	float minPenalty = FLT_MAX;
 	int ns = 0;
-		
+	
+	// The candidates are evaluated one grid row at a time.
+	float cx[MAX_SAMPLE_BATCH], cz[MAX_SAMPLE_BATCH], pen[MAX_SAMPLE_BATCH];
+	
 	for (int y = 0; y < m_params.gridSize; ++y)
 	{
+		int ncand = 0;
 		for (int x = 0; x < m_params.gridSize; ++x)
 		{
 			float vcand[3];
@@ -440,12 +915,20 @@ int dtObstacleAvoidanceQuery::sampleVelocityGrid(const float* pos, const float r
 			
 			if (dtSqr(vcand[0])+dtSqr(vcand[2]) > dtSqr(vmax+cs/2)) continue;
 			
-			const float penalty = processSample(vcand, cs, pos,rad,vel,dvel, debug);
+			cx[ncand] = vcand[0];
+			cz[ncand] = vcand[2];
+			ncand++;
+		}
+		
+		processSamples(cx, cz, ncand, cs, pos,rad,vel,dvel, pen, debug);
+		
+		for (int i = 0; i < ncand; ++i)
+		{
 			ns++;
-			if (penalty < minPenalty)
+			if (pen[i] < minPenalty)
 			{
-				minPenalty = penalty;
-				dtVcopy(nvel, vcand);
+				minPenalty = pen[i];
+				dtVset(nvel, cx[i], 0, cz[i]);
 			}
 		}
 	}
@@ -459,7 +942,7 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 													 const dtObstacleAvoidanceParams* params,
 													 dtObstacleAvoidanceDebugData* debug)
 {
-	prepare(pos, dvel);
+	prepare(pos, rad, dvel);
 	
 	memcpy(&m_params, params, sizeof(dtObstacleAvoidanceParams));
 	m_invHorizTime = 1.0f / m_params.horizTime;
@@ -482,23 +965,49 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 	const int nd = dtClamp(ndivs, 1, DT_MAX_PATTERN_DIVS);
 	const int nr = dtClamp(nrings, 1, DT_MAX_PATTERN_RINGS);
 	const float da = (1.0f/nd) * DT_PI*2;
-	const float dang = atan2f(dvel[2], dvel[0]);
 	
 	// Always add sample at zero
 	pat[npat*2+0] = 0;
 	pat[npat*2+1] = 0;
 	npat++;
 	
-	for (int j = 0; j < nr; ++j)
+	if (m_deterministic)
+	{
+		// Rotate the pattern by the direction of the desired velocity instead of its angle.
+		float dx = 1.0f, dz = 0.0f;
+		const float dlen = dtSqrt(dtSqr(dvel[0]) + dtSqr(dvel[2]));
+		if (dlen > 0.0f)
+		{
+			dx = dvel[0] / dlen;
+			dz = dvel[2] / dlen;
+		}
+		for (int j = 0; j < nr; ++j)
+		{
+			const float r = (float)(nr-j)/(float)nr;
+			for (int i = 0; i < nd; ++i)
+			{
+				float s, c;
+				reproducibleSinCos((j&1)*0.5f*da + i*da, &s, &c);
+				pat[npat*2+0] = (dx*c - dz*s)*r;
+				pat[npat*2+1] = (dz*c + dx*s)*r;
+				npat++;
+			}
+		}
+	}
+	else
 	{
-		const float r = (float)(nr-j)/(float)nr;
-		float a = dang + (j&1)*0.5f*da;
-		for (int i = 0; i < nd; ++i)
+		const float dang = atan2f(dvel[2], dvel[0]);
+		for (int j = 0; j < nr; ++j)
 		{
-			pat[npat*2+0] = cosf(a)*r;
-			pat[npat*2+1] = sinf(a)*r;
-			npat++;
-			a += da;
+			const float r = (float)(nr-j)/(float)nr;
+			float a = dang + (j&1)*0.5f*da;
+			for (int i = 0; i < nd; ++i)
+			{
+				pat[npat*2+0] = cosf(a)*r;
+				pat[npat*2+1] = sinf(a)*r;
+				npat++;
+				a += da;
+			}
 		}
 	}
 
@@ -507,6 +1016,8 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 	float res[3];
 	dtVset(res, dvel[0] * m_params.velBias, 0, dvel[2] * m_params.velBias);
 	int ns = 0;
+	
+	float cx[MAX_SAMPLE_BATCH], cz[MAX_SAMPLE_BATCH], pen[MAX_SAMPLE_BATCH];
 
 	for (int k = 0; k < depth; ++k)
 	{
@@ -514,6 +1025,7 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 		float bvel[3];
 		dtVset(bvel, 0,0,0);
 		
+		int ncand = 0;
 		for (int i = 0; i < npat; ++i)
 		{
 			float vcand[3];
@@ -523,12 +1035,20 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 			
 			if (dtSqr(vcand[0])+dtSqr(vcand[2]) > dtSqr(vmax+0.001f)) continue;
 			
-			const float penalty = processSample(vcand,cr/10, pos,rad,vel,dvel, debug);
+			cx[ncand] = vcand[0];
+			cz[ncand] = vcand[2];
+			ncand++;
+		}
+		
+		processSamples(cx, cz, ncand, cr/10, pos,rad,vel,dvel, pen, debug);
+		
+		for (int i = 0; i < ncand; ++i)
+		{
 			ns++;
-			if (penalty < minPenalty)
+			if (pen[i] < minPenalty)
 			{
-				minPenalty = penalty;
-				dtVcopy(bvel, vcand);
+				minPenalty = pen[i];
+				dtVset(bvel, cx[i], 0, cz[i]);
 			}
 		}
 
@@ -542,3 +1062,302 @@ int dtObstacleAvoidanceQuery::sampleVelocityAdaptive(const float* pos, const flo
 	return ns;
 }
 
+/// @par
+///
+/// The segments are treated as two sided walls, the circles as agents with the velocity @p vel of the obstacle.
+/// When the constraints can not all be satisfied, the segment constraints are kept and the velocity
+/// which least violates the circle constraints is returned.
+int dtObstacleAvoidanceQuery::computeVelocityORCA(const float* pos, const float rad, const float vmax,
+												  const float* vel, const float* dvel, float* nvel,
+												  const dtObstacleAvoidanceParams* params, const float dt,
+												  dtObstacleAvoidanceDebugData* debug)
+{
+	if (debug)
+		debug->reset();
+	
+	const float invHorizTime = 1.0f / params->horizTime;
+	const float radSqr = dtSqr(rad);
+	const float v[2] = { vel[0], vel[2] };
+	
+	dtOrcaLine* lines = m_orcaLines;
+	int nlines = 0;
+	
+	// Create obstacle constraints from the segments.
+	for (int i = 0; i < m_nsegments; ++i)
+	{
+		const dtObstacleSegment* seg = &m_segments[i];
+		float p1[2] = { seg->p[0], seg->p[2] };
+		float p2[2] = { seg->q[0], seg->q[2] };
+		float rel1[2] = { p1[0] - pos[0], p1[1] - pos[2] };
+		float rel2[2] = { p2[0] - pos[0], p2[1] - pos[2] };
+		
+		// Orient the segment so that the agent is on its outer side.
+		const float side = orcaDet(rel1, rel2);
+		if (side == 0.0f)
+			continue;
+		if (side > 0.0f)
+		{
+			dtSwap(p1[0], p2[0]); dtSwap(p1[1], p2[1]);
+			dtSwap(rel1[0], rel2[0]); dtSwap(rel1[1], rel2[1]);
+		}
+		
+		// Skip if the obstacle is already covered by the previous obstacle constraints.
+		bool covered = false;
+		for (int j = 0; j < nlines; ++j)
+		{
+			const float d1[2] = { invHorizTime*rel1[0] - lines[j].point[0], invHorizTime*rel1[1] - lines[j].point[1] };
+			const float d2[2] = { invHorizTime*rel2[0] - lines[j].point[0], invHorizTime*rel2[1] - lines[j].point[1] };
+			if (orcaDet(d1, lines[j].dir) - invHorizTime*rad >= -ORCA_EPS &&
+				orcaDet(d2, lines[j].dir) - invHorizTime*rad >= -ORCA_EPS)
+			{
+				covered = true;
+				break;
+			}
+		}
+		if (covered)
+			continue;
+		
+		const float distSqr1 = orcaDot(rel1, rel1);
+		const float distSqr2 = orcaDot(rel2, rel2);
+		float u[2] = { p2[0] - p1[0], p2[1] - p1[1] };
+		const float segLenSqr = orcaDot(u, u);
+		if (segLenSqr < ORCA_EPS)
+			continue;
+		const float s = -orcaDot(rel1, u) / segLenSqr;
+		const float dl[2] = { -rel1[0] - s*u[0], -rel1[1] - s*u[1] };
+		const float distSqrLine = orcaDot(dl, dl);
+		orcaNormalize(u);
+		
+		dtOrcaLine& line = lines[nlines];
+		
+		if (s < 0.0f && distSqr1 <= radSqr)
+		{
+			// Collision with the first end point.
+			line.point[0] = 0.0f;
+			line.point[1] = 0.0f;
+			line.dir[0] = -rel1[1];
+			line.dir[1] = rel1[0];
+			orcaNormalize(line.dir);
+			nlines++;
+			continue;
+		}
+		if (s > 1.0f && distSqr2 <= radSqr)
+		{
+			// Collision with the second end point.
+			if (orcaDet(rel2, u) <= 0.0f)
+			{
+				line.point[0] = 0.0f;
+				line.point[1] = 0.0f;
+				line.dir[0] = -rel2[1];
+				line.dir[1] = rel2[0];
+				orcaNormalize(line.dir);
+				nlines++;
+			}
+			continue;
+		}
+		if (s >= 0.0f && s < 1.0f && distSqrLine <= radSqr)
+		{
+			// Collision with the segment.
+			line.point[0] = 0.0f;
+			line.point[1] = 0.0f;
+			line.dir[0] = -u[0];
+			line.dir[1] = -u[1];
+			nlines++;
+			continue;
+		}
+		
+		// No collision, compute the legs. When the segment is seen obliquely only one end point defines both legs.
+		const bool onlyFirst = s < 0.0f && distSqrLine <= radSqr;
+		const bool onlySecond = s > 1.0f && distSqrLine <= radSqr;
+		const float* c1 = onlySecond ? rel2 : rel1;
+		const float* c2 = onlyFirst ? rel1 : rel2;
+		const float cd1 = onlySecond ? distSqr2 : distSqr1;
+		const float cd2 = onlyFirst ? distSqr1 : distSqr2;
+		
+		const float leg1 = dtSqrt(cd1 - radSqr);
+		float leftLeg[2] = { (c1[0]*leg1 - c1[1]*rad) / cd1, (c1[0]*rad + c1[1]*leg1) / cd1 };
+		const float leg2 = dtSqrt(cd2 - radSqr);
+		float rightLeg[2] = { (c2[0]*leg2 + c2[1]*rad) / cd2, (-c2[0]*rad + c2[1]*leg2) / cd2 };
+		
+		// Legs pointing into the segment are replaced by the segment direction and do not create constraints.
+		// Past the left end point the segment continues along u, past the right end point back along -u.
+		const float leftNeiDir[2] = { onlySecond ? -u[0] : u[0], onlySecond ? -u[1] : u[1] };
+		const float rightNeiDir[2] = { onlyFirst ? u[0] : -u[0], onlyFirst ? u[1] : -u[1] };
+		bool leftForeign = false, rightForeign = false;
+		if (orcaDet(leftLeg, leftNeiDir) >= 0.0f)
+		{
+			leftLeg[0] = leftNeiDir[0];
+			leftLeg[1] = leftNeiDir[1];
+			leftForeign = true;
+		}
+		if (orcaDet(rightLeg, rightNeiDir) <= 0.0f)
+		{
+			rightLeg[0] = rightNeiDir[0];
+			rightLeg[1] = rightNeiDir[1];
+			rightForeign = true;
+		}
+		
+		// Compute the cut-off centers.
+		const float leftCut[2] = { invHorizTime*c1[0], invHorizTime*c1[1] };
+		const float rightCut[2] = { invHorizTime*c2[0], invHorizTime*c2[1] };
+		const float cutVec[2] = { rightCut[0] - leftCut[0], rightCut[1] - leftCut[1] };
+		const bool samePoint = onlyFirst || onlySecond;
+		
+		const float vl[2] = { v[0] - leftCut[0], v[1] - leftCut[1] };
+		const float vr[2] = { v[0] - rightCut[0], v[1] - rightCut[1] };
+		const float t = samePoint ? 0.5f : orcaDot(vl, cutVec) / orcaDot(cutVec, cutVec);
+		const float tLeft = orcaDot(vl, leftLeg);
+		const float tRight = orcaDot(vr, rightLeg);
+		
+		if ((t < 0.0f && tLeft < 0.0f) || (samePoint && tLeft < 0.0f && tRight < 0.0f))
+		{
+			// Project on the left cut-off circle.
+			float w[2] = { vl[0], vl[1] };
+			orcaNormalize(w);
+			line.dir[0] = w[1];
+			line.dir[1] = -w[0];
+			line.point[0] = leftCut[0] + rad*invHorizTime*w[0];
+			line.point[1] = leftCut[1] + rad*invHorizTime*w[1];
+			nlines++;
+			continue;
+		}
+		if (t > 1.0f && tRight < 0.0f)
+		{
+			// Project on the right cut-off circle.
+			float w[2] = { vr[0], vr[1] };
+			orcaNormalize(w);
+			line.dir[0] = w[1];
+			line.dir[1] = -w[0];
+			line.point[0] = rightCut[0] + rad*invHorizTime*w[0];
+			line.point[1] = rightCut[1] + rad*invHorizTime*w[1];
+			nlines++;
+			continue;
+		}
+		
+		// Project on the left leg, right leg, or cut-off line, whichever is closest to the velocity.
+		float distSqrCut = FLT_MAX, distSqrLeft = FLT_MAX, distSqrRight = FLT_MAX;
+		if (t >= 0.0f && t <= 1.0f && !samePoint)
+		{
+			const float d[2] = { vl[0] - t*cutVec[0], vl[1] - t*cutVec[1] };
+			distSqrCut = orcaDot(d, d);
+		}
+		if (tLeft >= 0.0f)
+		{
+			const float d[2] = { vl[0] - tLeft*leftLeg[0], vl[1] - tLeft*leftLeg[1] };
+			distSqrLeft = orcaDot(d, d);
+		}
+		if (tRight >= 0.0f)
+		{
+			const float d[2] = { vr[0] - tRight*rightLeg[0], vr[1] - tRight*rightLeg[1] };
+			distSqrRight = orcaDot(d, d);
+		}
+		
+		const float* base = leftCut;
+		if (distSqrCut <= distSqrLeft && distSqrCut <= distSqrRight)
+		{
+			line.dir[0] = -u[0];
+			line.dir[1] = -u[1];
+		}
+		else if (distSqrLeft <= distSqrRight)
+		{
+			if (leftForeign)
+				continue;
+			line.dir[0] = leftLeg[0];
+			line.dir[1] = leftLeg[1];
+		}
+		else
+		{
+			if (rightForeign)
+				continue;
+			line.dir[0] = -rightLeg[0];
+			line.dir[1] = -rightLeg[1];
+			base = rightCut;
+		}
+		line.point[0] = base[0] + rad*invHorizTime*-line.dir[1];
+		line.point[1] = base[1] + rad*invHorizTime*line.dir[0];
+		nlines++;
+	}
+	
+	const int nobst = nlines;
+	
+	// Create reciprocal constraints from the circles.
+	for (int i = 0; i < m_ncircles; ++i)
+	{
+		const dtObstacleCircle* cir = &m_circles[i];
+		const float relPos[2] = { cir->p[0] - pos[0], cir->p[2] - pos[2] };
+		const float relVel[2] = { v[0] - cir->vel[0], v[1] - cir->vel[2] };
+		const float distSqr = orcaDot(relPos, relPos);
+		const float r = rad + cir->rad;
+		const float rSqr = dtSqr(r);
+		
+		dtOrcaLine& line = lines[nlines];
+		float du[2];
+		
+		if (distSqr > rSqr)
+		{
+			// No collision. Vector from the cut-off center to the relative velocity.
+			const float w[2] = { relVel[0] - invHorizTime*relPos[0], relVel[1] - invHorizTime*relPos[1] };
+			const float wLenSqr = orcaDot(w, w);
+			const float dot1 = orcaDot(w, relPos);
+			
+			if (dot1 < 0.0f && dtSqr(dot1) > rSqr * wLenSqr)
+			{
+				// Project on the cut-off circle.
+				const float wLen = dtSqrt(wLenSqr);
+				const float uw[2] = { w[0] / wLen, w[1] / wLen };
+				line.dir[0] = uw[1];
+				line.dir[1] = -uw[0];
+				du[0] = (r*invHorizTime - wLen) * uw[0];
+				du[1] = (r*invHorizTime - wLen) * uw[1];
+			}
+			else
+			{
+				// Project on the legs.
+				const float leg = dtSqrt(distSqr - rSqr);
+				if (orcaDet(relPos, w) > 0.0f)
+				{
+					line.dir[0] = (relPos[0]*leg - relPos[1]*r) / distSqr;
+					line.dir[1] = (relPos[0]*r + relPos[1]*leg) / distSqr;
+				}
+				else
+				{
+					line.dir[0] = -(relPos[0]*leg + relPos[1]*r) / distSqr;
+					line.dir[1] = -(-relPos[0]*r + relPos[1]*leg) / distSqr;
+				}
+				const float dot2 = orcaDot(relVel, line.dir);
+				du[0] = dot2*line.dir[0] - relVel[0];
+				du[1] = dot2*line.dir[1] - relVel[1];
+			}
+		}
+		else
+		{
+			// Collision. Project on the cut-off circle of the time step.
+			const float invDt = 1.0f / dt;
+			const float w[2] = { relVel[0] - invDt*relPos[0], relVel[1] - invDt*relPos[1] };
+			const float wLen = dtSqrt(orcaDot(w, w));
+			if (wLen < ORCA_EPS)
+				continue;
+			const float uw[2] = { w[0] / wLen, w[1] / wLen };
+			line.dir[0] = uw[1];
+			line.dir[1] = -uw[0];
+			du[0] = (r*invDt - wLen) * uw[0];
+			du[1] = (r*invDt - wLen) * uw[1];
+		}
+		
+		// Both agents take half of the responsibility of avoiding the collision.
+		line.point[0] = v[0] + 0.5f*du[0];
+		line.point[1] = v[1] + 0.5f*du[1];
+		nlines++;
+	}
+	
+	const float pref[2] = { dvel[0], dvel[2] };
+	float res[2];
+	const int fail = orcaLinearProgram2(lines, nlines, vmax, pref, false, res);
+	if (fail < nlines)
+		orcaLinearProgram3(lines, nlines, nobst, fail, vmax, m_orcaProjLines, res);
+	
+	dtVset(nvel, res[0], 0.0f, res[1]);
+	
+	return nlines;
+}
+
@@ -76,6 +76,13 @@ void dtFreeObstacleAvoidanceDebugData(dtObstacleAvoidanceDebugData* ptr);
 static const int DT_MAX_PATTERN_DIVS = 32;	///< Max numver of adaptive divs.
 static const int DT_MAX_PATTERN_RINGS = 4;	///< Max number of adaptive rings.
 
+/// The methods used to find the new velocity of an agent. (See: dtObstacleAvoidanceParams::method)
+enum dtObstacleAvoidanceMethod
+{
+	DT_OBSTACLE_AVOIDANCE_SAMPLED = 0,	///< Score sampled candidate velocities. (See: dtObstacleAvoidanceQuery::sampleVelocityAdaptive())
+	DT_OBSTACLE_AVOIDANCE_ORCA = 1,		///< Solve the ORCA constraints with linear programming. (See: dtObstacleAvoidanceQuery::computeVelocityORCA())
+};
+
 struct dtObstacleAvoidanceParams
 {
 	float velBias;
@@ -88,8 +95,11 @@ struct dtObstacleAvoidanceParams
 	unsigned char adaptiveDivs;	///< adaptive
 	unsigned char adaptiveRings;	///< adaptive
 	unsigned char adaptiveDepth;	///< adaptive
+	unsigned char method;	///< The avoidance method. (See: #dtObstacleAvoidanceMethod)
 };
 
+struct dtOrcaLine;
+
 class dtObstacleAvoidanceQuery
 {
 public:
@@ -114,6 +124,33 @@ public:
 							   const float* vel, const float* dvel, float* nvel,
 							   const dtObstacleAvoidanceParams* params, 
 							   dtObstacleAvoidanceDebugData* debug = 0);
+
+	/// Finds the velocity closest to the desired velocity that satisfies the optimal reciprocal
+	/// collision avoidance (ORCA) constraints of the obstacles, see van den Berg et al. "Reciprocal n-body Collision Avoidance".
+	/// The circles share the avoidance effort with the agent, the segments are static. Only
+	/// params->horizTime is used.
+	///  @param[in]		pos		The position of the agent. [(x, y, z)]
+	///  @param[in]		rad		The radius of the agent.
+	///  @param[in]		vmax	The maximum speed of the agent.
+	///  @param[in]		vel		The current velocity of the agent. [(x, y, z)]
+	///  @param[in]		dvel	The desired velocity of the agent. [(x, y, z)]
+	///  @param[out]	nvel	The new velocity of the agent. [(x, y, z)]
+	///  @param[in]		params	The avoidance parameters.
+	///  @param[in]		dt		The time step, used to resolve already overlapping obstacles. [Limit: > 0]
+	///  @param[in]		debug	Debug data, only reset by this method. [Opt]
+	/// @return The number of constraints.
+	int computeVelocityORCA(const float* pos, const float rad, const float vmax,
+							const float* vel, const float* dvel, float* nvel,
+							const dtObstacleAvoidanceParams* params, const float dt,
+							dtObstacleAvoidanceDebugData* debug = 0);
+	
+	/// Sets whether the query avoids the math library functions which may round differently
+	/// between platforms, so that the same inputs give bitwise identical results.
+	///  @param[in]		deterministic	True to use the reproducible math.
+	void setDeterministic(const bool deterministic) { m_deterministic = deterministic; }
+	
+	/// True if the query uses reproducible math. (See: #setDeterministic())
+	inline bool isDeterministic() const { return m_deterministic; }
 	
 	inline int getObstacleCircleCount() const { return m_ncircles; }
 	const dtObstacleCircle* getObstacleCircle(const int i) { return &m_circles[i]; }
@@ -123,13 +160,18 @@ public:
 
 private:
 
-	void prepare(const float* pos, const float* dvel);
+	void prepare(const float* pos, const float rad, const float* dvel);
 
 	float processSample(const float* vcand, const float cs,
 						const float* pos, const float rad,
 						const float* vel, const float* dvel,
 						dtObstacleAvoidanceDebugData* debug);
 
+	void processSamples(const float* vx, const float* vz, const int n, const float cs,
+						const float* pos, const float rad,
+						const float* vel, const float* dvel, float* penalties,
+						dtObstacleAvoidanceDebugData* debug);
+
 	dtObstacleCircle* insertCircle(const float dist);
 	dtObstacleSegment* insertSegment(const float dist);
 
@@ -145,6 +187,14 @@ private:
 	int m_maxSegments;
 	dtObstacleSegment* m_segments;
 	int m_nsegments;
+
+	float* m_circleData;	///< Per circle terms of the sample tests, one array per term. Built by prepare().
+	float* m_segmentData;	///< Per segment terms of the sample tests, one array per term. Built by prepare().
+
+	dtOrcaLine* m_orcaLines;		///< The ORCA constraints. [Size: #m_maxCircles + #m_maxSegments]
+	dtOrcaLine* m_orcaProjLines;	///< Scratch constraints for the 3D linear program. [Size: #m_maxCircles + #m_maxSegments]
+	
+	bool m_deterministic;
 };
 
 dtObstacleAvoidanceQuery* dtAllocObstacleAvoidanceQuery();
@@ -197,9 +197,13 @@ may be needed.  E.g. If you move the target, check #getLastPoly() to see if it i
 
 */
 
+/// The smallest path buffer the corridor allocates.
+static const int MIN_PATH_CAPACITY = 8;
+
 dtPathCorridor::dtPathCorridor() :
 	m_path(0),
 	m_npath(0),
+	m_capacity(0),
 	m_maxPath(0)
 {
 }
@@ -211,27 +215,65 @@ dtPathCorridor::~dtPathCorridor()
 
 /// @par
 ///
+/// The path buffer is allocated by the first path put to the corridor and grows in powers of two,
+/// so a corridor of a short path does not use a buffer of @p maxPath polygons.
+///
 /// @warning Cannot be called more than once.
 bool dtPathCorridor::init(const int maxPath)
 {
 	dtAssert(!m_path);
-	m_path = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef)*maxPath, DT_ALLOC_PERM);
-	if (!m_path)
-		return false;
 	m_npath = 0;
+	m_capacity = 0;
 	m_maxPath = maxPath;
 	return true;
 }
 
+/// @par
+///
+/// The buffer is allocated again when a new path is put to the corridor.
+void dtPathCorridor::release()
+{
+	dtFree(m_path);
+	m_path = 0;
+	m_npath = 0;
+	m_capacity = 0;
+}
+
+/// Grows the path buffer to hold @p npath polygons, or as many as the maximum path size allows.
+/// Returns false if the buffer can not hold @p npath polygons.
+bool dtPathCorridor::reserve(const int npath)
+{
+	if (npath <= m_capacity)
+		return true;
+	
+	const int capacity = dtMin((int)dtNextPow2((unsigned int)dtMax(npath, MIN_PATH_CAPACITY)), m_maxPath);
+	if (capacity <= m_capacity)
+		return false;
+	
+	dtPolyRef* path = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef)*capacity, DT_ALLOC_PERM);
+	if (!path)
+		return false;
+	if (m_npath)
+		memcpy(path, m_path, sizeof(dtPolyRef)*m_npath);
+	dtFree(m_path);
+	m_path = path;
+	m_capacity = capacity;
+	
+	return npath <= m_capacity;
+}
+
 /// @par
 ///
 /// Essentially, the corridor is set of one polygon in size with the target
 /// equal to the position.
 void dtPathCorridor::reset(dtPolyRef ref, const float* pos)
 {
-	dtAssert(m_path);
+	dtAssert(m_maxPath);
 	dtVcopy(m_pos, pos);
 	dtVcopy(m_target, pos);
+	m_npath = 0;
+	if (!reserve(1))
+		return;
 	m_path[0] = ref;
 	m_npath = 1;
 }
@@ -336,7 +378,8 @@ void dtPathCorridor::optimizePathVisibility(const float* next, const float pathO
 	navquery->raycast(m_path[0], m_pos, goal, filter, &t, norm, res, &nres, MAX_RES);
 	if (nres > 1 && t > 0.99f)
 	{
-		m_npath = dtMergeCorridorStartShortcut(m_path, m_npath, m_maxPath, res, nres);
+		reserve(m_npath + nres);
+		m_npath = dtMergeCorridorStartShortcut(m_path, m_npath, m_capacity, res, nres);
 	}
 }
 
@@ -370,7 +413,8 @@ bool dtPathCorridor::optimizePathTopology(dtNavMeshQuery* navquery, const dtQuer
 	
 	if (dtStatusSucceed(status) && nres > 0)
 	{
-		m_npath = dtMergeCorridorStartShortcut(m_path, m_npath, m_maxPath, res, nres);
+		reserve(m_npath + nres);
+		m_npath = dtMergeCorridorStartShortcut(m_path, m_npath, m_capacity, res, nres);
 		return true;
 	}
 	
@@ -448,7 +492,8 @@ void dtPathCorridor::movePosition(const float* npos, dtNavMeshQuery* navquery, c
 	int nvisited = 0;
 	navquery->moveAlongSurface(m_path[0], m_pos, npos, filter,
 							   result, visited, &nvisited, MAX_VISITED);
-	m_npath = dtMergeCorridorStartMoved(m_path, m_npath, m_maxPath, visited, nvisited);
+	reserve(m_npath + nvisited);
+	m_npath = dtMergeCorridorStartMoved(m_path, m_npath, m_capacity, visited, nvisited);
 	
 	// Adjust the position to stay on top of the navmesh.
 	float h = m_pos[1];
@@ -482,7 +527,8 @@ void dtPathCorridor::moveTargetPosition(const float* npos, dtNavMeshQuery* navqu
 	int nvisited = 0;
 	navquery->moveAlongSurface(m_path[m_npath-1], m_target, npos, filter,
 							   result, visited, &nvisited, MAX_VISITED);
-	m_npath = dtMergeCorridorEndMoved(m_path, m_npath, m_maxPath, visited, nvisited);
+	reserve(m_npath + nvisited);
+	m_npath = dtMergeCorridorEndMoved(m_path, m_npath, m_capacity, visited, nvisited);
 	
 	// TODO: should we do that?
 	// Adjust the position to stay on top of the navmesh.
@@ -498,16 +544,17 @@ void dtPathCorridor::moveTargetPosition(const float* npos, dtNavMeshQuery* navqu
 /// The current corridor position is expected to be within the first polygon in the path. The target 
 /// is expected to be in the last polygon. 
 /// 
-/// @warning The size of the path must not exceed the size of corridor's path buffer set during #init().
+/// @warning The size of the path must not exceed the maximum path size set during #init().
 void dtPathCorridor::setCorridor(const float* target, const dtPolyRef* path, const int npath)
 {
-	dtAssert(m_path);
+	dtAssert(m_maxPath);
 	dtAssert(npath > 0);
 	dtAssert(npath < m_maxPath);
 	
 	dtVcopy(m_target, target);
-	memcpy(m_path, path, sizeof(dtPolyRef)*npath);
-	m_npath = npath;
+	reserve(npath);
+	m_npath = dtMin(npath, m_capacity);
+	memcpy(m_path, path, sizeof(dtPolyRef)*m_npath);
 }
 
 bool dtPathCorridor::fixPathStart(dtPolyRef safeRef, const float* safePos)
@@ -515,7 +562,7 @@ bool dtPathCorridor::fixPathStart(dtPolyRef safeRef, const float* safePos)
 	dtAssert(m_path);
 
 	dtVcopy(m_pos, safePos);
-	if (m_npath < 3 && m_npath > 0)
+	if (m_npath < 3 && m_npath > 0 && reserve(3))
 	{
 		m_path[2] = m_path[m_npath-1];
 		m_path[0] = safeRef;
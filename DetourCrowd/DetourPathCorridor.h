@@ -30,17 +30,23 @@ class dtPathCorridor
 	
 	dtPolyRef* m_path;
 	int m_npath;
+	int m_capacity;		///< The size of the path buffer.
 	int m_maxPath;
 	
+	bool reserve(const int npath);
+	
 public:
 	dtPathCorridor();
 	~dtPathCorridor();
 	
-	/// Allocates the corridor's path buffer. 
+	/// Sets the maximum size of the corridor's path buffer. The buffer grows with the path.
 	///  @param[in]		maxPath		The maximum path size the corridor can handle.
 	/// @return True if the initialization succeeded.
 	bool init(const int maxPath);
 	
+	/// Frees the corridor's path buffer and empties the path.
+	void release();
+	
 	/// Resets the path corridor to the specified position.
 	///  @param[in]		ref		The polygon reference containing the position.
 	///  @param[in]		pos		The new position in the corridor. [(x, y, z)]
@@ -25,13 +25,19 @@
 
 
 dtPathQueue::dtPathQueue() :
+	m_queue(0),
+	m_maxQueue(0),
+	m_slots(0),
+	m_nslots(0),
+	m_pending(0),
 	m_nextHandle(1),
 	m_maxPathSize(0),
-	m_queueHead(0),
-	m_navquery(0)
+	m_shareDist(-1.0f),
+	m_tick(0),
+	m_updateIters(0),
+	m_dispatcher(0)
 {
-	for (int i = 0; i < MAX_QUEUE; ++i)
-		m_queue[i].path = 0;
+	resetStats();
 }
 
 dtPathQueue::~dtPathQueue()
@@ -41,104 +47,246 @@ dtPathQueue::~dtPathQueue()
 
 void dtPathQueue::purge()
 {
-	dtFreeNavMeshQuery(m_navquery);
-	m_navquery = 0;
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	for (int i = 0; i < m_nslots; ++i)
 	{
-		dtFree(m_queue[i].path);
-		m_queue[i].path = 0;
+		dtFreeNavMeshQuery(m_slots[i].navquery);
+		dtFree(m_slots[i].jobs);
 	}
+	dtFree(m_slots);
+	m_slots = 0;
+	m_nslots = 0;
+	for (int i = 0; i < m_maxQueue; ++i)
+		dtFree(m_queue[i].path);
+	dtFree(m_queue);
+	m_queue = 0;
+	m_maxQueue = 0;
+	dtFree(m_pending);
+	m_pending = 0;
 }
 
-bool dtPathQueue::init(const int maxPathSize, const int maxSearchNodeCount, dtNavMesh* nav)
+bool dtPathQueue::init(const int maxPathSize, const int maxSearchNodeCount, dtNavMesh* nav,
+					   const int maxRequests, const int maxSearches)
 {
 	purge();
-
-	m_navquery = dtAllocNavMeshQuery();
-	if (!m_navquery)
+	
+	m_queue = (PathQuery*)dtAlloc(sizeof(PathQuery)*maxRequests, DT_ALLOC_PERM);
+	if (!m_queue)
 		return false;
-	if (dtStatusFailed(m_navquery->init(nav, maxSearchNodeCount)))
+	m_maxQueue = maxRequests;
+	for (int i = 0; i < m_maxQueue; ++i)
+		m_queue[i].path = 0;
+	
+	m_pending = (int*)dtAlloc(sizeof(int)*m_maxQueue, DT_ALLOC_PERM);
+	if (!m_pending)
+		return false;
+	
+	m_slots = (SearchSlot*)dtAlloc(sizeof(SearchSlot)*maxSearches, DT_ALLOC_PERM);
+	if (!m_slots)
 		return false;
+	m_nslots = maxSearches;
+	for (int i = 0; i < m_nslots; ++i)
+	{
+		m_slots[i].navquery = 0;
+		m_slots[i].jobs = 0;
+	}
+	for (int i = 0; i < m_nslots; ++i)
+	{
+		SearchSlot& slot = m_slots[i];
+		slot.navquery = dtAllocNavMeshQuery();
+		if (!slot.navquery)
+			return false;
+		if (dtStatusFailed(slot.navquery->init(nav, maxSearchNodeCount)))
+			return false;
+		slot.jobs = (int*)dtAlloc(sizeof(int)*m_maxQueue, DT_ALLOC_PERM);
+		if (!slot.jobs)
+			return false;
+		slot.active = -1;
+		slot.njobs = 0;
+		slot.iters = 0;
+	}
 	
 	m_maxPathSize = maxPathSize;
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	for (int i = 0; i < m_maxQueue; ++i)
 	{
 		m_queue[i].ref = DT_PATHQ_INVALID;
+		m_queue[i].status = 0;
 		m_queue[i].path = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef)*m_maxPathSize, DT_ALLOC_PERM);
 		if (!m_queue[i].path)
 			return false;
 	}
 	
-	m_queueHead = 0;
+	m_tick = 0;
+	resetStats();
 	
 	return true;
 }
 
-void dtPathQueue::update(const int maxIters)
+void dtPathQueue::resetStats()
 {
-	static const int MAX_KEEP_ALIVE = 2; // in update ticks.
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void dtPathQueue::updateSlotJob(void* data, const int jobIdx, const int /*workerIdx*/)
+{
+	((dtPathQueue*)data)->updateSlot(jobIdx);
+}
 
-	// Update path request until there is nothing to update
-	// or upto maxIters pathfinder iterations has been consumed.
-	int iterCount = maxIters;
+/// Runs the requests assigned to a slot in order until the iteration budget is used.
+/// A search which does not finish stays bound to the slot, as its state lives in the slot's query.
+void dtPathQueue::updateSlot(const int slotIdx)
+{
+	SearchSlot& slot = m_slots[slotIdx];
+	dtNavMeshQuery* navquery = slot.navquery;
+	int iterCount = m_updateIters;
 	
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	slot.active = -1;
+	slot.iters = 0;
+	
+	for (int i = 0; i < slot.njobs && iterCount > 0; ++i)
 	{
-		PathQuery& q = m_queue[m_queueHead % MAX_QUEUE];
+		PathQuery& q = m_queue[slot.jobs[i]];
 		
-		// Skip inactive requests.
-		if (q.ref == DT_PATHQ_INVALID)
+		// Handle query start.
+		if (q.status == 0)
 		{
-			m_queueHead++;
-			continue;
+			q.status = navquery->initSlicedFindPath(q.startRef, q.endRef, q.startPos, q.endPos, q.filter);
+		}
+		// Handle query in progress.
+		if (dtStatusInProgress(q.status))
+		{
+			int iters = 0;
+			q.status = navquery->updateSlicedFindPath(iterCount, &iters);
+			iterCount -= iters;
+			slot.iters += iters;
+		}
+		if (dtStatusSucceed(q.status))
+		{
+			q.status = navquery->finalizeSlicedFindPath(q.path, &q.npath, m_maxPathSize);
 		}
 		
-		// Handle completed request.
+		if (dtStatusInProgress(q.status))
+			slot.active = slot.jobs[i];
+		else
+			q.doneTick = m_tick;
+	}
+}
+
+/// @par
+///
+/// The pending requests are started in order of their priority plus the number of updates they
+/// have waited, and spread over the search slots. Each slot runs its searches one after another
+/// using at most @p maxIters iterations, so the slots may be run in parallel by the job dispatcher.
+/// The results do not depend on the dispatcher or its number of workers.
+void dtPathQueue::update(const int maxIters)
+{
+	static const int MAX_KEEP_ALIVE = 2; // in update ticks.
+	
+	m_tick++;
+	
+	// Expire results which have not been read in few frames, and collect pending requests.
+	int npending = 0;
+	for (int i = 0; i < m_maxQueue; ++i)
+	{
+		PathQuery& q = m_queue[i];
+		if (q.ref == DT_PATHQ_INVALID)
+			continue;
+		
 		if (dtStatusSucceed(q.status) || dtStatusFailed(q.status))
 		{
-			// If the path result has not been read in few frames, free the slot.
 			q.keepAlive++;
 			if (q.keepAlive > MAX_KEEP_ALIVE)
 			{
 				q.ref = DT_PATHQ_INVALID;
 				q.status = 0;
 			}
-			
-			m_queueHead++;
 			continue;
 		}
 		
-		// Handle query start.
 		if (q.status == 0)
 		{
-			q.status = m_navquery->initSlicedFindPath(q.startRef, q.endRef, q.startPos, q.endPos, q.filter);
-		}		
-		// Handle query in progress.
-		if (dtStatusInProgress(q.status))
-		{
-			int iters = 0;
-			q.status = m_navquery->updateSlicedFindPath(iterCount, &iters);
-			iterCount -= iters;
-		}
-		if (dtStatusSucceed(q.status))
-		{
-			q.status = m_navquery->finalizeSlicedFindPath(q.path, &q.npath, m_maxPathSize);
+			// Insert by greatest score, the oldest request first on ties.
+			const float score = q.priority + (float)(m_tick - q.requestTick);
+			int j = npending;
+			while (j > 0)
+			{
+				const PathQuery& p = m_queue[m_pending[j-1]];
+				const float pscore = p.priority + (float)(m_tick - p.requestTick);
+				if (pscore > score || (pscore == score && p.ref <= q.ref))
+					break;
+				m_pending[j] = m_pending[j-1];
+				j--;
+			}
+			m_pending[j] = i;
+			npending++;
 		}
-
-		if (iterCount <= 0)
-			break;
-
-		m_queueHead++;
+	}
+	
+	// Continue the searches in progress, then deal the pending requests to the slots.
+	for (int i = 0; i < m_nslots; ++i)
+	{
+		SearchSlot& slot = m_slots[i];
+		slot.njobs = 0;
+		if (slot.active != -1 && m_queue[slot.active].ref != DT_PATHQ_INVALID &&
+			dtStatusInProgress(m_queue[slot.active].status))
+			slot.jobs[slot.njobs++] = slot.active;
+	}
+	for (int i = 0; i < npending; ++i)
+	{
+		SearchSlot& slot = m_slots[i % m_nslots];
+		slot.jobs[slot.njobs++] = m_pending[i];
+	}
+	
+	m_updateIters = maxIters;
+	if (m_dispatcher && m_nslots > 1)
+		m_dispatcher->run(updateSlotJob, this, m_nslots);
+	else
+		for (int i = 0; i < m_nslots; ++i)
+			updateSlot(i);
+	
+	// Gather statistics.
+	for (int i = 0; i < m_nslots; ++i)
+		m_stats.numIters += m_slots[i].iters;
+	for (int i = 0; i < m_maxQueue; ++i)
+	{
+		const PathQuery& q = m_queue[i];
+		if (q.ref == DT_PATHQ_INVALID || q.status == 0 || dtStatusInProgress(q.status) || q.doneTick != m_tick)
+			continue;
+		const int latency = (int)(m_tick - q.requestTick);
+		m_stats.numCompleted++;
+		m_stats.totalLatency += latency;
+		m_stats.maxLatency = dtMax(m_stats.maxLatency, latency);
 	}
 }
 
 dtPathQueueRef dtPathQueue::request(dtPolyRef startRef, dtPolyRef endRef,
 									const float* startPos, const float* endPos,
-									const dtQueryFilter* filter)
+									const dtQueryFilter* filter, const float priority)
 {
+	// Join an identical request, unless it has failed already.
+	if (m_shareDist >= 0.0f)
+	{
+		const float shareDistSqr = dtSqr(m_shareDist);
+		for (int i = 0; i < m_maxQueue; ++i)
+		{
+			PathQuery& q = m_queue[i];
+			if (q.ref == DT_PATHQ_INVALID || dtStatusFailed(q.status))
+				continue;
+			if (q.startRef != startRef || q.endRef != endRef || q.filter != filter)
+				continue;
+			if (dtVdistSqr(q.startPos, startPos) > shareDistSqr || dtVdistSqr(q.endPos, endPos) > shareDistSqr)
+				continue;
+			q.nusers++;
+			q.keepAlive = 0;
+			q.priority = dtMax(q.priority, priority);
+			m_stats.numRequests++;
+			m_stats.numShared++;
+			return q.ref;
+		}
+	}
+	
 	// Find empty slot
 	int slot = -1;
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	for (int i = 0; i < m_maxQueue; ++i)
 	{
 		if (m_queue[i].ref == DT_PATHQ_INVALID)
 		{
@@ -148,7 +296,10 @@ dtPathQueueRef dtPathQueue::request(dtPolyRef startRef, dtPolyRef endRef,
 	}
 	// Could not find slot.
 	if (slot == -1)
+	{
+		m_stats.numRejected++;
 		return DT_PATHQ_INVALID;
+	}
 	
 	dtPathQueueRef ref = m_nextHandle++;
 	if (m_nextHandle == DT_PATHQ_INVALID) m_nextHandle++;
@@ -164,13 +315,19 @@ dtPathQueueRef dtPathQueue::request(dtPolyRef startRef, dtPolyRef endRef,
 	q.npath = 0;
 	q.filter = filter;
 	q.keepAlive = 0;
+	q.nusers = 1;
+	q.priority = dtMax(priority, 0.0f);
+	q.requestTick = m_tick;
+	q.doneTick = 0;
+	
+	m_stats.numRequests++;
 	
 	return ref;
 }
 
 dtStatus dtPathQueue::getRequestStatus(dtPathQueueRef ref) const
 {
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	for (int i = 0; i < m_maxQueue; ++i)
 	{
 		if (m_queue[i].ref == ref)
 			return m_queue[i].status;
@@ -180,14 +337,17 @@ dtStatus dtPathQueue::getRequestStatus(dtPathQueueRef ref) const
 
 dtStatus dtPathQueue::getPathResult(dtPathQueueRef ref, dtPolyRef* path, int* pathSize, const int maxPath)
 {
-	for (int i = 0; i < MAX_QUEUE; ++i)
+	for (int i = 0; i < m_maxQueue; ++i)
 	{
 		if (m_queue[i].ref == ref)
 		{
 			PathQuery& q = m_queue[i];
-			// Free request for reuse.
-			q.ref = DT_PATHQ_INVALID;
-			q.status = 0;
+			// Free request for reuse once all requesters have read it.
+			if (--q.nusers <= 0)
+			{
+				q.ref = DT_PATHQ_INVALID;
+				q.status = 0;
+			}
 			// Copy path
 			int n = dtMin(q.npath, maxPath);
 			memcpy(path, q.path, sizeof(dtPolyRef)*n);
@@ -197,3 +357,22 @@ dtStatus dtPathQueue::getPathResult(dtPathQueueRef ref, dtPolyRef* path, int* pa
 	}
 	return DT_FAILURE;
 }
+
+void dtPathQueue::cancelRequests(const dtQueryFilter* filter)
+{
+	for (int i = 0; i < m_maxQueue; ++i)
+	{
+		PathQuery& q = m_queue[i];
+		if (q.ref == DT_PATHQ_INVALID || q.filter != filter)
+			continue;
+		q.ref = DT_PATHQ_INVALID;
+		q.status = 0;
+		q.filter = 0;
+	}
+	// A search in progress keeps the filter in the slot's query, start the slot over.
+	for (int i = 0; i < m_nslots; ++i)
+	{
+		if (m_slots[i].active != -1 && m_queue[m_slots[i].active].ref == DT_PATHQ_INVALID)
+			m_slots[i].active = -1;
+	}
+}
@@ -26,6 +26,44 @@ static const unsigned int DT_PATHQ_INVALID = 0;
 
 typedef unsigned int dtPathQueueRef;
 
+/// A job run by a #dtCrowdJobDispatcher.
+///  @param[in]		data		The data passed to dtCrowdJobDispatcher::run().
+///  @param[in]		jobIdx		The index of the job. [Limits: 0 <= value < njobs]
+///  @param[in]		workerIdx	The index of the worker running the job.
+///  							[Limits: 0 <= value < dtCrowdJobDispatcher::getWorkerCount()]
+/// @ingroup crowd
+typedef void (*dtCrowdJobFunc)(void* data, const int jobIdx, const int workerIdx);
+
+/// Runs the per-agent phases of #dtCrowd::update() and the path searches of #dtPathQueue::update(),
+/// usually on a pool of worker threads.
+/// @ingroup crowd
+/// @see dtCrowd::setJobDispatcher(), dtPathQueue::setJobDispatcher()
+struct dtCrowdJobDispatcher
+{
+	/// The number of workers that may run jobs at the same time. [Limit: >= 1]
+	virtual int getWorkerCount() const = 0;
+
+	/// Runs @p func once for every job index in [0, @p njobs) and returns when all jobs have completed.
+	/// A worker index must not be used by two jobs at the same time.
+	///  @param[in]		func		The job to run.
+	///  @param[in]		data		The data to pass to @p func.
+	///  @param[in]		njobs		The number of jobs.
+	virtual void run(dtCrowdJobFunc func, void* data, const int njobs) = 0;
+};
+
+/// Statistics of a #dtPathQueue, accumulated since the queue was initialized or the
+/// statistics were reset. The latencies are measured in calls to dtPathQueue::update().
+struct dtPathQueueStats
+{
+	int numRequests;			///< The number of accepted requests.
+	int numShared;				///< The number of requests which joined an identical request. (Included in #numRequests)
+	int numRejected;			///< The number of requests rejected because the queue was full.
+	int numCompleted;			///< The number of requests that have finished, with or without a path.
+	int numIters;				///< The number of pathfinder iterations used.
+	int totalLatency;			///< The sum of the latencies of the finished requests.
+	int maxLatency;				///< The greatest latency of a finished request.
+};
+
 class dtPathQueue
 {
 	struct PathQuery
@@ -40,35 +78,111 @@ class dtPathQueue
 		/// State.
 		dtStatus status;
 		int keepAlive;
-		const dtQueryFilter* filter; ///< TODO: This is potentially dangerous!
+		int nusers;					///< The number of requesters which have not read the result.
+		float priority;
+		unsigned int requestTick;	///< The update tick when the request was made.
+		unsigned int doneTick;		///< The update tick when the search finished.
+		const dtQueryFilter* filter; ///< The filter of the requester, see #cancelRequests().
 	};
 	
-	static const int MAX_QUEUE = 8;
-	PathQuery m_queue[MAX_QUEUE];
+	/// A path search slot, each with its own query.
+	struct SearchSlot
+	{
+		dtNavMeshQuery* navquery;
+		int active;					///< The index of the request being searched, or -1.
+		int* jobs;					///< The requests to process during the update.
+		int njobs;
+		int iters;					///< The pathfinder iterations used during the update.
+	};
+	
+	PathQuery* m_queue;
+	int m_maxQueue;
+	SearchSlot* m_slots;
+	int m_nslots;
+	int* m_pending;
 	dtPathQueueRef m_nextHandle;
 	int m_maxPathSize;
-	int m_queueHead;
-	dtNavMeshQuery* m_navquery;
+	float m_shareDist;
+	unsigned int m_tick;
+	int m_updateIters;
+	dtCrowdJobDispatcher* m_dispatcher;
+	dtPathQueueStats m_stats;
 	
 	void purge();
+	void updateSlot(const int slotIdx);
+	static void updateSlotJob(void* data, const int jobIdx, const int workerIdx);
 	
 public:
 	dtPathQueue();
 	~dtPathQueue();
 	
-	bool init(const int maxPathSize, const int maxSearchNodeCount, dtNavMesh* nav);
+	/// Initializes the queue.
+	///  @param[in]		maxPathSize			The maximum number of polygons in a path result.
+	///  @param[in]		maxSearchNodeCount	The maximum number of search nodes of each search.
+	///  @param[in]		nav					The navigation mesh to search.
+	///  @param[in]		maxRequests			The maximum number of requests in the queue. [Limit: > 0]
+	///  @param[in]		maxSearches			The number of searches run at the same time, each with
+	///  									its own query. [Limit: > 0]
+	/// @return True if the queue was successfully initialized.
+	bool init(const int maxPathSize, const int maxSearchNodeCount, dtNavMesh* nav,
+			  const int maxRequests = 8, const int maxSearches = 1);
+	
+	/// Sets the dispatcher used to run the searches in parallel.
+	///  @param[in]		dispatcher	The job dispatcher, or null to search on the calling thread.
+	void setJobDispatcher(dtCrowdJobDispatcher* dispatcher) { m_dispatcher = dispatcher; }
+	
+	/// Sets how far apart the start and end positions of two requests between the same polygons
+	/// can be for the requests to share one search.
+	///  @param[in]		dist		The distance, or a negative value to never share searches. [Default: -1]
+	void setShareDistance(const float dist) { m_shareDist = dist; }
 	
+	/// The distance within which requests share one search.
+	inline float getShareDistance() const { return m_shareDist; }
+	
+	/// Updates the searches.
+	///  @param[in]		maxIters	The maximum number of pathfinder iterations used by each search slot.
 	void update(const int maxIters);
 	
+	/// Requests a path.
+	///  @param[in]		startRef	The reference of the start polygon.
+	///  @param[in]		endRef		The reference of the end polygon.
+	///  @param[in]		startPos	The start position. [(x, y, z)]
+	///  @param[in]		endPos		The end position. [(x, y, z)]
+	///  @param[in]		filter		The polygon filter to apply to the query. Must stay valid until
+	///  							the result has been read, or the request is removed by #cancelRequests().
+	///  @param[in]		priority	The urgency of the request, in update ticks of waiting. [Limit: >= 0]
+	/// @return The request reference, or #DT_PATHQ_INVALID if the queue is full.
+	///
+	/// If a request with the same polygons and filter is still searching, or its result has not
+	/// been read yet, the new request joins it and the same reference is returned. The result
+	/// must then be read once for every time the reference was returned.
 	dtPathQueueRef request(dtPolyRef startRef, dtPolyRef endRef,
 						   const float* startPos, const float* endPos, 
-						   const dtQueryFilter* filter);
+						   const dtQueryFilter* filter, const float priority = 0.0f);
 	
 	dtStatus getRequestStatus(dtPathQueueRef ref) const;
 	
 	dtStatus getPathResult(dtPathQueueRef ref, dtPolyRef* path, int* pathSize, const int maxPath);
 	
-	inline const dtNavMeshQuery* getNavQuery() const { return m_navquery; }
+	/// Removes all requests using a filter, whether they are still searching or their result
+	/// has not been read yet. Must be called before the filter is destroyed.
+	///  @param[in]		filter		The filter passed to #request().
+	void cancelRequests(const dtQueryFilter* filter);
+	
+	/// The query of the first search slot.
+	inline const dtNavMeshQuery* getNavQuery() const { return m_nslots ? m_slots[0].navquery : 0; }
+	
+	/// The maximum number of requests in the queue.
+	inline int getMaxRequests() const { return m_maxQueue; }
+	
+	/// The number of searches run at the same time.
+	inline int getSearchCount() const { return m_nslots; }
+	
+	/// The statistics of the queue.
+	inline const dtPathQueueStats* getStats() const { return &m_stats; }
+	
+	/// Clears the statistics of the queue.
+	void resetStats();
 
 };
 
@@ -49,39 +49,43 @@ inline int hashPos2(int x, int y, int n)
 dtProximityGrid::dtProximityGrid() :
 	m_maxItems(0),
 	m_cellSize(0),
-	m_pool(0),
-	m_poolHead(0),
-	m_poolSize(0),
-	m_buckets(0),
-	m_bucketsSize(0)
+	m_items(0),
+	m_cells(0),
+	m_nitems(0),
+	m_bucketStart(0),
+	m_bucketsSize(0),
+	m_maxExtent(0)
 {
 }
 
 dtProximityGrid::~dtProximityGrid()
 {
-	dtFree(m_buckets);
-	dtFree(m_pool);
+	dtFree(m_bucketStart);
+	dtFree(m_cells);
+	dtFree(m_items);
 }
 
-bool dtProximityGrid::init(const int poolSize, const float cellSize)
+bool dtProximityGrid::init(const int maxItems, const float cellSize)
 {
-	dtAssert(poolSize > 0);
+	dtAssert(maxItems > 0);
 	dtAssert(cellSize > 0.0f);
 	
 	m_cellSize = cellSize;
 	m_invCellSize = 1.0f / m_cellSize;
 	
-	// Allocate hashs buckets
-	m_bucketsSize = dtNextPow2(poolSize);
-	m_buckets = (unsigned short*)dtAlloc(sizeof(unsigned short)*m_bucketsSize, DT_ALLOC_PERM);
-	if (!m_buckets)
+	// Allocate hash buckets
+	m_bucketsSize = dtNextPow2(maxItems);
+	m_bucketStart = (int*)dtAlloc(sizeof(int)*(m_bucketsSize+1), DT_ALLOC_PERM);
+	if (!m_bucketStart)
 		return false;
 	
-	// Allocate pool of items.
-	m_poolSize = poolSize;
-	m_poolHead = 0;
-	m_pool = (Item*)dtAlloc(sizeof(Item)*m_poolSize, DT_ALLOC_PERM);
-	if (!m_pool)
+	// Allocate items.
+	m_maxItems = maxItems;
+	m_items = (Item*)dtAlloc(sizeof(Item)*m_maxItems, DT_ALLOC_PERM);
+	if (!m_items)
+		return false;
+	m_cells = (Item*)dtAlloc(sizeof(Item)*m_maxItems, DT_ALLOC_PERM);
+	if (!m_cells)
 		return false;
 	
 	clear();
@@ -91,8 +95,9 @@ bool dtProximityGrid::init(const int poolSize, const float cellSize)
 
 void dtProximityGrid::clear()
 {
-	memset(m_buckets, 0xff, sizeof(unsigned short)*m_bucketsSize);
-	m_poolHead = 0;
+	memset(m_bucketStart, 0, sizeof(int)*(m_bucketsSize+1));
+	m_nitems = 0;
+	m_maxExtent = 0;
 	m_bounds[0] = 0xffff;
 	m_bounds[1] = 0xffff;
 	m_bounds[2] = -0xffff;
@@ -103,33 +108,45 @@ void dtProximityGrid::addItem(const unsigned short id,
 							  const float minx, const float miny,
 							  const float maxx, const float maxy)
 {
-	const int iminx = (int)floorf(minx * m_invCellSize);
-	const int iminy = (int)floorf(miny * m_invCellSize);
-	const int imaxx = (int)floorf(maxx * m_invCellSize);
-	const int imaxy = (int)floorf(maxy * m_invCellSize);
+	if (m_nitems >= m_maxItems)
+		return;
 	
-	m_bounds[0] = dtMin(m_bounds[0], iminx);
-	m_bounds[1] = dtMin(m_bounds[1], iminy);
-	m_bounds[2] = dtMax(m_bounds[2], imaxx);
-	m_bounds[3] = dtMax(m_bounds[3], imaxy);
+	Item& item = m_items[m_nitems++];
+	item.id = id;
+	item.px = (minx+maxx)*0.5f;
+	item.py = (miny+maxy)*0.5f;
+	const int x = (int)floorf(item.px * m_invCellSize);
+	const int y = (int)floorf(item.py * m_invCellSize);
+	item.x = (short)x;
+	item.y = (short)y;
 	
-	for (int y = iminy; y <= imaxy; ++y)
+	m_maxExtent = dtMax(m_maxExtent, dtMax(maxx-minx, maxy-miny)*0.5f);
+	
+	m_bounds[0] = dtMin(m_bounds[0], x);
+	m_bounds[1] = dtMin(m_bounds[1], y);
+	m_bounds[2] = dtMax(m_bounds[2], x);
+	m_bounds[3] = dtMax(m_bounds[3], y);
+}
+
+void dtProximityGrid::build()
+{
+	// Count the items per bucket.
+	memset(m_bucketStart, 0, sizeof(int)*(m_bucketsSize+1));
+	for (int i = 0; i < m_nitems; ++i)
+		m_bucketStart[hashPos2(m_items[i].x, m_items[i].y, m_bucketsSize)]++;
+	
+	// Turn the counts into the end of each bucket.
+	for (int i = 1; i < m_bucketsSize; ++i)
+		m_bucketStart[i] += m_bucketStart[i-1];
+	m_bucketStart[m_bucketsSize] = m_nitems;
+	
+	// Place the items backwards, which leaves the start of each bucket in the counters
+	// and keeps the items of a bucket in the order they were added.
+	for (int i = m_nitems-1; i >= 0; --i)
 	{
-		for (int x = iminx; x <= imaxx; ++x)
-		{
-			if (m_poolHead < m_poolSize)
-			{
-				const int h = hashPos2(x, y, m_bucketsSize);
-				const unsigned short idx = (unsigned short)m_poolHead;
-				m_poolHead++;
-				Item& item = m_pool[idx];
-				item.x = (short)x;
-				item.y = (short)y;
-				item.id = id;
-				item.next = m_buckets[h];
-				m_buckets[h] = idx;
-			}
-		}
+		const Item& item = m_items[i];
+		const int h = hashPos2(item.x, item.y, m_bucketsSize);
+		m_cells[--m_bucketStart[h]] = item;
 	}
 }
 
@@ -137,10 +154,11 @@ int dtProximityGrid::queryItems(const float minx, const float miny,
 								const float maxx, const float maxy,
 								unsigned short* ids, const int maxIds) const
 {
-	const int iminx = (int)floorf(minx * m_invCellSize);
-	const int iminy = (int)floorf(miny * m_invCellSize);
-	const int imaxx = (int)floorf(maxx * m_invCellSize);
-	const int imaxy = (int)floorf(maxy * m_invCellSize);
+	// The items are stored at their center, look as far as the largest item reaches.
+	const int iminx = (int)floorf((minx - m_maxExtent) * m_invCellSize);
+	const int iminy = (int)floorf((miny - m_maxExtent) * m_invCellSize);
+	const int imaxx = (int)floorf((maxx + m_maxExtent) * m_invCellSize);
+	const int imaxy = (int)floorf((maxy + m_maxExtent) * m_invCellSize);
 	
 	int n = 0;
 	
@@ -149,28 +167,105 @@ int dtProximityGrid::queryItems(const float minx, const float miny,
 		for (int x = iminx; x <= imaxx; ++x)
 		{
 			const int h = hashPos2(x, y, m_bucketsSize);
-			unsigned short idx = m_buckets[h];
-			while (idx != 0xffff)
+			const int end = m_bucketStart[h+1];
+			for (int i = m_bucketStart[h]; i < end; ++i)
+			{
+				const Item& item = m_cells[i];
+				if ((int)item.x != x || (int)item.y != y)
+					continue;
+				if (n >= maxIds)
+					return n;
+				ids[n++] = item.id;
+			}
+		}
+	}
+	
+	return n;
+}
+
+int dtProximityGrid::addNearestItems(const int cx, const int cy, const float x, const float y, const float rangeSqr,
+									 dtProximityItemFilter filter, void* filterData,
+									 unsigned short* ids, float* distSqr, int n, const int maxIds) const
+{
+	const int h = hashPos2(cx, cy, m_bucketsSize);
+	const int end = m_bucketStart[h+1];
+	for (int i = m_bucketStart[h]; i < end; ++i)
+	{
+		const Item& item = m_cells[i];
+		if ((int)item.x != cx || (int)item.y != cy)
+			continue;
+		
+		const float d = dtSqr(item.px - x) + dtSqr(item.py - y);
+		if (d > rangeSqr)
+			continue;
+		if (n >= maxIds && d >= distSqr[n-1])
+			continue;
+		if (filter && !filter(filterData, item.id))
+			continue;
+		
+		// Insert by distance, after the items at the same distance.
+		int j = dtMin(n, maxIds-1);
+		while (j > 0 && distSqr[j-1] > d)
+		{
+			ids[j] = ids[j-1];
+			distSqr[j] = distSqr[j-1];
+			j--;
+		}
+		ids[j] = item.id;
+		distSqr[j] = d;
+		n = dtMin(n+1, maxIds);
+	}
+	return n;
+}
+
+/// @par
+///
+/// The cells are visited in rings around the cell of the query point. The search stops after
+/// a ring when @p maxIds items are found and the farthest of them is nearer than any cell
+/// outside the ring, so in a dense grid only the cells next to the query point are visited.
+/// The filter is only called for the items which would be returned at the time they are found.
+int dtProximityGrid::queryNearestItems(const float x, const float y, const float range,
+									   unsigned short* ids, float* distSqr, const int maxIds,
+									   dtProximityItemFilter filter, void* filterData) const
+{
+	if (maxIds <= 0)
+		return 0;
+	
+	const int iminx = (int)floorf((x - range) * m_invCellSize);
+	const int iminy = (int)floorf((y - range) * m_invCellSize);
+	const int imaxx = (int)floorf((x + range) * m_invCellSize);
+	const int imaxy = (int)floorf((y + range) * m_invCellSize);
+	const int qx = (int)floorf(x * m_invCellSize);
+	const int qy = (int)floorf(y * m_invCellSize);
+	const int maxRing = dtMax(dtMax(qx - iminx, imaxx - qx), dtMax(qy - iminy, imaxy - qy));
+	const float rangeSqr = dtSqr(range);
+	
+	int n = 0;
+	
+	for (int r = 0; r <= maxRing; ++r)
+	{
+		const int y0 = dtMax(qy - r, iminy);
+		const int y1 = dtMin(qy + r, imaxy);
+		for (int cy = y0; cy <= y1; ++cy)
+		{
+			// The top and bottom rows of the ring are full, the other rows have a cell at each end.
+			const int step = (cy == qy - r || cy == qy + r) ? 1 : 2*r;
+			for (int cx = qx - r; cx <= qx + r; cx += step)
 			{
-				Item& item = m_pool[idx];
-				if ((int)item.x == x && (int)item.y == y)
-				{
-					// Check if the id exists already.
-					const unsigned short* end = ids + n;
-					unsigned short* i = ids;
-					while (i != end && *i != item.id)
-						++i;
-					// Item not found, add it.
-					if (i == end)
-					{
-						if (n >= maxIds)
-							return n;
-						ids[n++] = item.id;
-					}
-				}
-				idx = item.next;
+				if (cx < iminx || cx > imaxx)
+					continue;
+				n = addNearestItems(cx, cy, x, y, rangeSqr, filter, filterData, ids, distSqr, n, maxIds);
 			}
 		}
+		
+		if (n >= maxIds)
+		{
+			// The distance to the nearest cell outside the ring.
+			const float dx = dtMin(x - (qx - r)*m_cellSize, (qx + r + 1)*m_cellSize - x);
+			const float dy = dtMin(y - (qy - r)*m_cellSize, (qy + r + 1)*m_cellSize - y);
+			if (dtSqr(dtMin(dx, dy)) >= distSqr[n-1])
+				break;
+		}
 	}
 	
 	return n;
@@ -181,13 +276,12 @@ int dtProximityGrid::getItemCountAt(const int x, const int y) const
 	int n = 0;
 	
 	const int h = hashPos2(x, y, m_bucketsSize);
-	unsigned short idx = m_buckets[h];
-	while (idx != 0xffff)
+	const int end = m_bucketStart[h+1];
+	for (int i = m_bucketStart[h]; i < end; ++i)
 	{
-		Item& item = m_pool[idx];
+		const Item& item = m_cells[i];
 		if ((int)item.x == x && (int)item.y == y)
 			n++;
-		idx = item.next;
 	}
 	
 	return n;
@@ -19,6 +19,16 @@
 #ifndef DETOURPROXIMITYGRID_H
 #define DETOURPROXIMITYGRID_H
 
+/// Decides if an item can be returned by dtProximityGrid::queryNearestItems().
+///  @param[in]		data	The user data passed to the query.
+///  @param[in]		id		The id of the item.
+/// @return True if the item can be returned.
+typedef bool (*dtProximityItemFilter)(void* data, const unsigned short id);
+
+/// A uniform grid of items, rebuilt each frame.
+///
+/// Each item is stored in the cell of its center. #build() sorts the items by the hash of their
+/// cell with a counting sort, so the items of a cell are contiguous and no item is returned twice.
 class dtProximityGrid
 {
 	int m_maxItems;
@@ -29,17 +39,22 @@ class dtProximityGrid
 	{
 		unsigned short id;
 		short x,y;
-		unsigned short next;
+		float px,py;
 	};
-	Item* m_pool;
-	int m_poolHead;
-	int m_poolSize;
+	Item* m_items;			///< The items in the order they were added.
+	Item* m_cells;			///< The items sorted by cell hash.
+	int m_nitems;
 	
-	unsigned short* m_buckets;
+	int* m_bucketStart;		///< The first item of each cell hash in #m_cells. [Size: #m_bucketsSize + 1]
 	int m_bucketsSize;
 	
+	float m_maxExtent;		///< The greatest half size of an added item.
 	int m_bounds[4];
 	
+	int addNearestItems(const int cx, const int cy, const float x, const float y, const float rangeSqr,
+						dtProximityItemFilter filter, void* filterData,
+						unsigned short* ids, float* distSqr, int n, const int maxIds) const;
+	
 public:
 	dtProximityGrid();
 	~dtProximityGrid();
@@ -48,14 +63,33 @@ public:
 	
 	void clear();
 	
+	/// Adds an item to the grid. The item is not found by the queries before #build() is called.
 	void addItem(const unsigned short id,
 				 const float minx, const float miny,
 				 const float maxx, const float maxy);
 	
+	/// Sorts the added items into their cells.
+	void build();
+	
+	/// Finds the items whose cells may overlap the query rectangle, each item once.
 	int queryItems(const float minx, const float miny,
 				   const float maxx, const float maxy,
 				   unsigned short* ids, const int maxIds) const;
 	
+	/// Finds the @p maxIds items nearest to the query point whose centers are within @p range, nearest first.
+	///  @param[in]		x			The x-coordinate of the query point.
+	///  @param[in]		y			The y-coordinate of the query point.
+	///  @param[in]		range		The query radius.
+	///  @param[out]	ids			The nearest items. [(id) * return value]
+	///  @param[out]	distSqr		The squared distances of the items. [(dist) * return value]
+	///  @param[in]		maxIds		The maximum number of items to return.
+	///  @param[in]		filter		The filter of the items, or null to accept all items.
+	///  @param[in]		filterData	The user data passed to @p filter.
+	/// @return The number of items returned.
+	int queryNearestItems(const float x, const float y, const float range,
+						  unsigned short* ids, float* distSqr, const int maxIds,
+						  dtProximityItemFilter filter = 0, void* filterData = 0) const;
+	
 	int getItemCountAt(const int x, const int y) const;
 	
 	inline const int* getBounds() const { return m_bounds; }
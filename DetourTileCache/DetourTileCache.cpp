@@ -440,8 +440,11 @@ dtStatus dtTileCache::queryTiles(const float* bmin, const float* bmax,
 	return DT_SUCCESS;
 }
 
-dtStatus dtTileCache::update(const float /*dt*/, dtNavMesh* navmesh)
+dtStatus dtTileCache::update(const float /*dt*/, dtNavMesh* navmesh, dtTileRef* replacedTile)
 {
+	if (replacedTile)
+		*replacedTile = 0;
+	
 	if (m_nupdate == 0)
 	{
 		// Process requests.
@@ -504,7 +507,7 @@ dtStatus dtTileCache::update(const float /*dt*/, dtNavMesh* navmesh)
 	{
 		// Build mesh
 		const dtCompressedTileRef ref = m_update[0];
-		dtStatus status = buildNavMeshTile(ref, navmesh);
+		dtStatus status = buildNavMeshTile(ref, navmesh, replacedTile);
 		m_nupdate--;
 		if (m_nupdate > 0)
 			memmove(m_update, m_update+1, m_nupdate*sizeof(dtCompressedTileRef));
@@ -572,11 +575,14 @@ dtStatus dtTileCache::buildNavMeshTilesAt(const int tx, const int ty, dtNavMesh*
 	return DT_SUCCESS;
 }
 
-dtStatus dtTileCache::buildNavMeshTile(const dtCompressedTileRef ref, dtNavMesh* navmesh)
+dtStatus dtTileCache::buildNavMeshTile(const dtCompressedTileRef ref, dtNavMesh* navmesh, dtTileRef* replacedTile)
 {	
 	dtAssert(m_talloc);
 	dtAssert(m_tcomp);
 	
+	if (replacedTile)
+		*replacedTile = 0;
+	
 	unsigned int idx = decodeTileIdTile(ref);
 	if (idx > (unsigned int)m_params.maxTiles)
 		return DT_FAILURE | DT_INVALID_PARAM;
@@ -665,7 +671,10 @@ dtStatus dtTileCache::buildNavMeshTile(const dtCompressedTileRef ref, dtNavMesh*
 		return DT_FAILURE;
 
 	// Remove existing tile.
-	navmesh->removeTile(navmesh->getTileRefAt(tile->header->tx,tile->header->ty,tile->header->tlayer),0,0);
+	const dtTileRef oldRef = navmesh->getTileRefAt(tile->header->tx,tile->header->ty,tile->header->tlayer);
+	navmesh->removeTile(oldRef,0,0);
+	if (replacedTile)
+		*replacedTile = oldRef;
 
 	// Add new tile, or leave the location empty.
 	if (navData)
@@ -2,6 +2,7 @@
 #define DETOURTILECACHE_H
 
 #include "DetourStatus.h"
+#include "DetourNavMesh.h"
 
 
 
@@ -109,11 +110,14 @@ public:
 	dtStatus queryTiles(const float* bmin, const float* bmax,
 						dtCompressedTileRef* results, int* resultCount, const int maxResults) const;
 	
-	dtStatus update(const float /*dt*/, class dtNavMesh* navmesh);
+	/// Processes the obstacle requests and rebuilds at most one tile.
+	///  @param[out]	replacedTile	The reference the rebuilt navmesh tile had before it was replaced, or 0.
+	///  								Pass it to dtCrowd::repairCorridors() to repair the paths through the tile.
+	dtStatus update(const float /*dt*/, class dtNavMesh* navmesh, dtTileRef* replacedTile = 0);
 	
 	dtStatus buildNavMeshTilesAt(const int tx, const int ty, class dtNavMesh* navmesh);
 	
-	dtStatus buildNavMeshTile(const dtCompressedTileRef ref, class dtNavMesh* navmesh);
+	dtStatus buildNavMeshTile(const dtCompressedTileRef ref, class dtNavMesh* navmesh, dtTileRef* replacedTile = 0);
 	
 	void calcTightTileBounds(const struct dtTileCacheLayerHeader* header, float* bmin, float* bmax) const;
 	
@@ -77,11 +77,30 @@ class CrowdToolState : public SampleToolState
 	
 	ValueHistory m_crowdTotalTime;
 	ValueHistory m_crowdSampleCount;
+	ValueHistory m_crowdPathTime;
+	ValueHistory m_crowdBoundaryTime;
+	ValueHistory m_crowdSteeringTime;
+	ValueHistory m_crowdAvoidanceTime;
+	ValueHistory m_crowdCollisionTime;
+
+	static const int BENCHMARK_AGENTS = 1000;
+	static const int BENCHMARK_TICKS = 100;
+	int m_benchmarkAgentCount;
+	float m_benchmarkUpdateTime;
+	
+	static const int REPLAY_AGENTS = 256;
+	static const int REPLAY_TICKS = 300;
+	int m_replayTicks;
+	int m_replayDivergedTick;
+	unsigned int m_replayHash;
 
 	CrowdToolParams m_toolParams;
 
 	bool m_run;
 
+	void getAgentParams(dtCrowdAgentParams* ap);
+	dtCrowd* allocTestCrowd(const int maxAgents);
+
 public:
 	CrowdToolState();
 	virtual ~CrowdToolState();
@@ -102,6 +121,16 @@ public:
 	int hitTestAgents(const float* s, const float* p);
 	void setMoveTarget(const float* p, bool adjust);
 	void updateTick(const float dt);
+	void runBenchmark();
+
+	inline int getBenchmarkAgentCount() const { return m_benchmarkAgentCount; }
+	inline float getBenchmarkUpdateTime() const { return m_benchmarkUpdateTime; }
+	
+	void runReplayCheck();
+	
+	inline int getReplayTicks() const { return m_replayTicks; }
+	inline int getReplayDivergedTick() const { return m_replayDivergedTick; }
+	inline unsigned int getReplayHash() const { return m_replayHash; }
 
 	inline CrowdToolParams* getToolParams() { return &m_toolParams; }
 };
@@ -19,6 +19,7 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <float.h>
 #include "SDL.h"
@@ -38,6 +39,19 @@
 #	define snprintf _snprintf
 #endif
 
+// Returns a random number [0..1)
+static float frand()
+{
+	return (float)rand()/(float)RAND_MAX;
+}
+
+
+// Clock used by the crowd to time the phases of its update.
+static unsigned int crowdClock()
+{
+	static const TimeVal base = getPerfTime();
+	return (unsigned int)getPerfDeltaTimeUsec(base, getPerfTime());
+}
 
 static bool isectSegAABB(const float* sp, const float* sq,
 						 const float* amin, const float* amax,
@@ -96,6 +110,11 @@ CrowdToolState::CrowdToolState() :
 	m_nav(0),
 	m_crowd(0),
 	m_targetRef(0),
+	m_benchmarkAgentCount(0),
+	m_benchmarkUpdateTime(0),
+	m_replayTicks(0),
+	m_replayDivergedTick(-1),
+	m_replayHash(0),
 	m_run(true)
 {
 	m_toolParams.m_expandSelectedDebugDraw = true;
@@ -153,6 +172,7 @@ void CrowdToolState::init(class Sample* sample)
 		m_crowd = crowd;
 	
 		crowd->init(MAX_AGENTS, m_sample->getAgentRadius(), nav);
+		crowd->setStatsClock(crowdClock);
 		
 		// Make polygons with 'disabled' flag invalid.
 		crowd->getEditableFilter()->setExcludeFlags(SAMPLE_POLYFLAGS_DISABLED);
@@ -620,11 +640,27 @@ void CrowdToolState::handleRenderOverlay(double* proj, double* model, int* view)
 		gp.setValueRange(0.0f, 2.0f, 4, "ms");
 		
 		drawGraphBackground(&gp);
-		drawGraph(&gp, &m_crowdTotalTime, 1, "Total", duRGBA(255,128,0,255));
+		drawGraph(&gp, &m_crowdTotalTime, 0, "Total", duRGBA(255,128,0,255));
+		drawGraph(&gp, &m_crowdPathTime, 1, "Path", duRGBA(0,192,255,255));
+		drawGraph(&gp, &m_crowdBoundaryTime, 2, "Boundary", duRGBA(128,255,0,255));
+		drawGraph(&gp, &m_crowdSteeringTime, 3, "Steering", duRGBA(255,255,0,255));
+		drawGraph(&gp, &m_crowdAvoidanceTime, 4, "Avoidance", duRGBA(255,64,192,255));
+		drawGraph(&gp, &m_crowdCollisionTime, 5, "Collision", duRGBA(192,128,255,255));
 		
 		gp.setRect(300, 10, 500, 50, 8);
 		gp.setValueRange(0.0f, 2000.0f, 1, "");
 		drawGraph(&gp, &m_crowdSampleCount, 0, "Sample Count", duRGBA(96,96,96,128));
+		
+		dtCrowd* crowd = m_sample->getCrowd();
+		if (crowd)
+		{
+			const dtCrowdStats* stats = crowd->getStats();
+			char text[128];
+			snprintf(text, sizeof(text), "Agents %d  Path requests %d  Queries %d  Nodes %d  Collision iterations %d",
+					 stats->numAgents, stats->numPathRequests, stats->numQueries, stats->numNodes,
+					 stats->numCollisionIterations);
+			imguiDrawText(300, 220, IMGUI_ALIGN_LEFT, text, imguiRGBA(255,255,255,192));
+		}
 	}
 	
 }
@@ -635,32 +671,41 @@ void CrowdToolState::handleUpdate(const float dt)
 		updateTick(dt);
 }
 
-void CrowdToolState::addAgent(const float* p)
+void CrowdToolState::getAgentParams(dtCrowdAgentParams* ap)
 {
-	if (!m_sample) return;
-	dtCrowd* crowd = m_sample->getCrowd();
-	
-	dtCrowdAgentParams ap;
-	memset(&ap, 0, sizeof(ap));
-	ap.radius = m_sample->getAgentRadius();
-	ap.height = m_sample->getAgentHeight();
-	ap.maxAcceleration = 8.0f;
-	ap.maxSpeed = 3.5f;
-	ap.collisionQueryRange = ap.radius * 12.0f;
-	ap.pathOptimizationRange = ap.radius * 30.0f;
-	ap.updateFlags = 0; 
+	memset(ap, 0, sizeof(dtCrowdAgentParams));
+	ap->radius = m_sample->getAgentRadius();
+	ap->height = m_sample->getAgentHeight();
+	ap->maxAcceleration = 8.0f;
+	ap->maxSpeed = 3.5f;
+	ap->collisionQueryRange = ap->radius * 12.0f;
+	ap->pathOptimizationRange = ap->radius * 30.0f;
+	ap->updateFlags = 0; 
 	if (m_toolParams.m_anticipateTurns)
-		ap.updateFlags |= DT_CROWD_ANTICIPATE_TURNS;
+		ap->updateFlags |= DT_CROWD_ANTICIPATE_TURNS;
 	if (m_toolParams.m_optimizeVis)
-		ap.updateFlags |= DT_CROWD_OPTIMIZE_VIS;
+		ap->updateFlags |= DT_CROWD_OPTIMIZE_VIS;
 	if (m_toolParams.m_optimizeTopo)
-		ap.updateFlags |= DT_CROWD_OPTIMIZE_TOPO;
+		ap->updateFlags |= DT_CROWD_OPTIMIZE_TOPO;
 	if (m_toolParams.m_obstacleAvoidance)
-		ap.updateFlags |= DT_CROWD_OBSTACLE_AVOIDANCE;
+		ap->updateFlags |= DT_CROWD_OBSTACLE_AVOIDANCE;
 	if (m_toolParams.m_separation)
-		ap.updateFlags |= DT_CROWD_SEPARATION;
-	ap.obstacleAvoidanceType = (unsigned char)m_toolParams.m_obstacleAvoidanceType;
-	ap.separationWeight = m_toolParams.m_separationWeight;
+		ap->updateFlags |= DT_CROWD_SEPARATION;
+	ap->obstacleAvoidanceType = (unsigned char)m_toolParams.m_obstacleAvoidanceType;
+	ap->separationWeight = m_toolParams.m_separationWeight;
+}
+
+void CrowdToolState::addAgent(const float* p)
+{
+	if (!m_sample) return;
+	dtCrowd* crowd = m_sample->getCrowd();
+	
+	// The crowd grows when full, keep the agents within the trail buffers.
+	if (crowd->getActiveAgentCount() >= MAX_AGENTS)
+		return;
+	
+	dtCrowdAgentParams ap;
+	getAgentParams(&ap);
 	
 	int idx = crowd->addAgent(p, &ap);
 	if (idx != -1)
@@ -851,6 +896,149 @@ void CrowdToolState::updateTick(const float dt)
 	
 	m_crowdSampleCount.addSample((float)crowd->getVelocitySampleCount());
 	m_crowdTotalTime.addSample(getPerfDeltaTimeUsec(startTime, endTime) / 1000.0f);
+	
+	const dtCrowdStats* stats = crowd->getStats();
+	m_crowdPathTime.addSample(stats->pathTime / 1000.0f);
+	m_crowdBoundaryTime.addSample(stats->boundaryTime / 1000.0f);
+	m_crowdSteeringTime.addSample(stats->steeringTime / 1000.0f);
+	m_crowdAvoidanceTime.addSample(stats->avoidanceTime / 1000.0f);
+	m_crowdCollisionTime.addSample(stats->collisionTime / 1000.0f);
+}
+
+void CrowdToolState::runBenchmark()
+{
+	if (!m_sample) return;
+	dtNavMesh* nav = m_sample->getNavMesh();
+	dtNavMeshQuery* navquery = m_sample->getNavMeshQuery();
+	dtCrowd* crowd = m_sample->getCrowd();
+	if (!nav || !navquery || !crowd) return;
+	
+	// Run the benchmark on a separate crowd so that the agents of the tool are not disturbed.
+	dtCrowd* bench = allocTestCrowd(BENCHMARK_AGENTS);
+	if (!bench) return;
+	
+	// Scatter the agents on the navmesh and send them all to the same target.
+	const dtQueryFilter* filter = bench->getFilter();
+	dtPolyRef targetRef = m_targetRef;
+	float targetPos[3];
+	dtVcopy(targetPos, m_targetPos);
+	if (!targetRef)
+		navquery->findRandomPoint(filter, frand, &targetRef, targetPos);
+	
+	dtCrowdAgentParams ap;
+	getAgentParams(&ap);
+	
+	int nagents = 0;
+	for (int i = 0; i < BENCHMARK_AGENTS; ++i)
+	{
+		dtPolyRef ref = 0;
+		float pos[3];
+		if (dtStatusFailed(navquery->findRandomPoint(filter, frand, &ref, pos)))
+			continue;
+		const int idx = bench->addAgent(pos, &ap);
+		if (idx == -1)
+			continue;
+		if (targetRef)
+			bench->requestMoveTarget(idx, targetRef, targetPos);
+		nagents++;
+	}
+	
+	const float dt = 1.0f/30.0f;
+	TimeVal startTime = getPerfTime();
+	for (int i = 0; i < BENCHMARK_TICKS; ++i)
+		bench->update(dt, 0);
+	TimeVal endTime = getPerfTime();
+	
+	m_benchmarkAgentCount = nagents;
+	m_benchmarkUpdateTime = getPerfDeltaTimeUsec(startTime, endTime) / 1000.0f / BENCHMARK_TICKS;
+	
+	dtFreeCrowd(bench);
+}
+
+// Allocates a crowd with the settings of the tool's crowd, for the benchmark and the replay check.
+dtCrowd* CrowdToolState::allocTestCrowd(const int maxAgents)
+{
+	dtNavMesh* nav = m_sample->getNavMesh();
+	dtCrowd* crowd = m_sample->getCrowd();
+	
+	dtCrowd* test = dtAllocCrowd();
+	if (!test) return 0;
+	if (!test->init(maxAgents, m_sample->getAgentRadius(), nav))
+	{
+		dtFreeCrowd(test);
+		return 0;
+	}
+	memcpy(test->getEditableFilter(), crowd->getFilter(), sizeof(dtQueryFilter));
+	for (int i = 0; i < DT_CROWD_MAX_OBSTAVOIDANCE_PARAMS; ++i)
+		test->setObstacleAvoidanceParams(i, crowd->getObstacleAvoidanceParams(i));
+	return test;
+}
+
+void CrowdToolState::runReplayCheck()
+{
+	if (!m_sample) return;
+	dtNavMesh* nav = m_sample->getNavMesh();
+	dtNavMeshQuery* navquery = m_sample->getNavMeshQuery();
+	dtCrowd* crowd = m_sample->getCrowd();
+	if (!nav || !navquery || !crowd) return;
+	
+	// Pick the start positions and the target once, both runs start from the same agents.
+	const dtQueryFilter* filter = crowd->getFilter();
+	dtPolyRef targetRef = m_targetRef;
+	float targetPos[3];
+	dtVcopy(targetPos, m_targetPos);
+	if (!targetRef)
+		navquery->findRandomPoint(filter, frand, &targetRef, targetPos);
+	
+	float positions[REPLAY_AGENTS*3];
+	int npositions = 0;
+	for (int i = 0; i < REPLAY_AGENTS; ++i)
+	{
+		dtPolyRef ref = 0;
+		if (dtStatusSucceed(navquery->findRandomPoint(filter, frand, &ref, &positions[npositions*3])))
+			npositions++;
+	}
+	
+	dtCrowdAgentParams ap;
+	getAgentParams(&ap);
+	
+	// Run the same ticks on two deterministic crowds, one after the other, and compare the state
+	// hashes of every tick.
+	unsigned int hashes[REPLAY_TICKS];
+	m_replayTicks = 0;
+	m_replayDivergedTick = -1;
+	for (int run = 0; run < 2 && m_replayDivergedTick == -1; ++run)
+	{
+		dtCrowd* replay = allocTestCrowd(REPLAY_AGENTS);
+		if (!replay)
+			return;
+		replay->setDeterministic(true);
+		for (int i = 0; i < npositions; ++i)
+		{
+			const int idx = replay->addAgent(&positions[i*3], &ap);
+			if (idx != -1 && targetRef)
+				replay->requestMoveTarget(idx, targetRef, targetPos);
+		}
+		
+		const float dt = 1.0f/30.0f;
+		for (int i = 0; i < REPLAY_TICKS; ++i)
+		{
+			replay->update(dt, 0);
+			const unsigned int hash = replay->getStateHash();
+			if (run == 0)
+			{
+				hashes[i] = hash;
+			}
+			else if (hash != hashes[i])
+			{
+				m_replayDivergedTick = i;
+				break;
+			}
+		}
+		m_replayHash = replay->getStateHash();
+		dtFreeCrowd(replay);
+	}
+	m_replayTicks = REPLAY_TICKS;
 }
 
 
@@ -950,6 +1138,30 @@ void CrowdTool::handleMenu()
 		imguiUnindent();
 	}
 
+	if (imguiButton("Run Benchmark"))
+		m_state->runBenchmark();
+	if (m_state->getBenchmarkAgentCount() > 0)
+	{
+		char msg[64];
+		snprintf(msg, 64, "%d agents, %.2f ms/update", m_state->getBenchmarkAgentCount(), m_state->getBenchmarkUpdateTime());
+		imguiValue(msg);
+		snprintf(msg, 64, "%.2f ms/update per 1k agents",
+				 m_state->getBenchmarkUpdateTime() * 1000.0f / m_state->getBenchmarkAgentCount());
+		imguiValue(msg);
+	}
+	
+	if (imguiButton("Run Replay Check"))
+		m_state->runReplayCheck();
+	if (m_state->getReplayTicks() > 0)
+	{
+		char msg[64];
+		if (m_state->getReplayDivergedTick() == -1)
+			snprintf(msg, 64, "%d ticks replayed, hash %08x", m_state->getReplayTicks(), m_state->getReplayHash());
+		else
+			snprintf(msg, 64, "Replay diverged at tick %d", m_state->getReplayDivergedTick());
+		imguiValue(msg);
+	}
+
 	if (imguiCollapse("Selected Debug Draw", 0, params->m_expandSelectedDebugDraw))
 		params->m_expandSelectedDebugDraw = !params->m_expandSelectedDebugDraw;
 		
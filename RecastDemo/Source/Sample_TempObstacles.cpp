@@ -1348,7 +1348,12 @@ void Sample_TempObstacles::handleUpdate(const float dt)
 	if (!m_tileCache)
 		return;
 	
-	m_tileCache->update(dt, m_navMesh);
+	dtTileRef replacedTile = 0;
+	m_tileCache->update(dt, m_navMesh, &replacedTile);
+	
+	// Repair the paths of the agents through the rebuilt tile before they run into it.
+	if (replacedTile && m_crowd)
+		m_crowd->repairCorridors(&replacedTile, 1);
 }
 
 void Sample_TempObstacles::getTilePos(const float* pos, int& tx, int& ty)